@@ -7,17 +7,36 @@
 #define VKDRV_ACCESS_H
 
 /*
- * if we use a user space model of the driver
- * we need to overload kernel call functions
- * to simulate open,close,read,write.
+ * functions a user space model of the driver (libvksim.so) implements, in
+ * place of the kernel calls open, close, read, write, poll and writev. The
+ * model is loaded at run time by the "model" transport of the vkil; its
+ * functions return a negative error code rather than setting errno.
+ * vkdrv_poll and vkdrv_writev are optional
  */
-#define open(x, y) _Generic(x, default : vkdrv_open)(x, y)
-#define read(x, y, z) _Generic(x, default : vkdrv_read)(x, y, z)
-#define write(x, y, z) _Generic(x, default : vkdrv_write)(x, y, z)
-#define close(x) _Generic(x, default : vkdrv_close)(x)
+
+/*
+ * read contract: vkdrv_read() copies into buf as many whole messages as fit
+ * in nbytes, back to back, and returns the number of bytes copied. Each
+ * message spans 16 * (1 + vk2host_msg::size) bytes and is never split; a
+ * model returning a single message per call is compliant. If the first
+ * message doesn't fit, -EMSGSIZE is returned with its size written in
+ * buf; -ENOMSG is returned if there is no message. The loopback transport
+ * of vkil follows it, as the reference for a batching model.
+ */
+
+/*
+ * write contract: vkdrv_writev() writes the messages held by each iovec in
+ * order, and returns the number of bytes written; a failure on a message
+ * other than the first one is reported as a short write
+ */
+
+struct pollfd;
+struct iovec;
 
 int vkdrv_open(const char *dev_name, int flags);
 int vkdrv_close(int fd);
 ssize_t vkdrv_write(int fd, const void *buf, size_t nbytes);
 ssize_t vkdrv_read(int fd, void *buf, size_t nbytes);
+int vkdrv_poll(struct pollfd *fds, unsigned long nfds, int timeout);
+ssize_t vkdrv_writev(int fd, const struct iovec *iov, int iovcnt);
 #endif
@@ -0,0 +1,207 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/*
+ * Copyright 2018-2020 Broadcom.
+ */
+
+#ifndef VKDRV_RING_H
+#define VKDRV_RING_H
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * shared memory rings a user space model of the driver can optionally
+ * expose, used by the "model_ring" transport of the vkil in place of
+ * vkdrv_write and vkdrv_read.
+ *
+ * vkdrv_ring_setup() hands over a memory file holding a struct vkdrv_ring_hdr
+ * followed by the ring slots. Each queue has a host2vk ring, produced by the
+ * host and consumed by the model, and a vk2host ring, produced by the model
+ * and consumed by the host; each ring has a single producer and a single
+ * consumer. The host2vk ring of a message is the one of its queue_id, and the
+ * model puts a response in the vk2host ring of its queue_id.
+ *
+ * A message spans 1 + size blocks of VKDRV_RING_BLK_SIZE bytes, size being the
+ * byte at VKDRV_RING_SIZE_OFFSET of its first block; it takes consecutive
+ * slots modulo the ring size, and is never split between a partial
+ * publication and the next. The indexes are free running block counts, the
+ * slot of index i being i & (nblks - 1): the producer copies a message at
+ * tail and then moves tail past it (release), and the consumer copies it at
+ * head and then moves head past it (release).
+ *
+ * Neither side makes a system call as long as the other one is busy:
+ * - the model sets card_sleeping before waiting on doorbell_fd, checking
+ * its host2vk rings again before it blocks; the host writes 1 to doorbell_fd
+ * after publishing messages only if card_sleeping is set
+ * - the host increments host_waiters before waiting on cmpl_fd, checking
+ * its vk2host rings again before it blocks; the model writes 1 to cmpl_fd
+ * after publishing responses only if host_waiters isn't zero
+ * The flags are accessed sequentially consistent, so a side can't miss the
+ * other one going to sleep. A model finding a vk2host ring full retries
+ * later.
+ *
+ * The vkdrv_ring_* inline functions below are the reference producer and
+ * consumer, used by the vkil on the host side; a model can use them as well.
+ */
+
+#define VKDRV_RING_MAGIC   0x564b5247 /* "VKRG" */
+#define VKDRV_RING_VERSION 1
+#define VKDRV_RING_Q_MAX   4 /* max number of queues */
+#define VKDRV_RING_BLK_SIZE 16 /* sizeof(host2vk_msg), sizeof(vk2host_msg) */
+#define VKDRV_RING_SIZE_OFFSET 1 /* offsetof(host2vk_msg, size) */
+
+struct vkdrv_ring {
+	_Alignas(64) _Atomic uint32_t head; /* consumer index */
+	_Alignas(64) _Atomic uint32_t tail; /* producer index */
+	_Alignas(64) uint32_t nblks; /* number of slots, a power of 2 */
+	uint32_t offset; /* offset of the slots in the memory file */
+};
+
+struct vkdrv_ring_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t nq; /* number of queues */
+	_Alignas(64) _Atomic uint32_t card_sleeping;
+	_Alignas(64) _Atomic uint32_t host_waiters;
+	struct vkdrv_ring host2vk[VKDRV_RING_Q_MAX];
+	struct vkdrv_ring vk2host[VKDRV_RING_Q_MAX];
+};
+
+/*
+ * the descriptors are owned by the model, and closed by vkdrv_close(); the
+ * host maps mem_fd shared, and unmaps it before calling vkdrv_close()
+ */
+struct vkdrv_ring_info {
+	int mem_fd; /* memory file holding the rings */
+	size_t size; /* size of the memory file */
+	int doorbell_fd; /* eventfd, written by the host */
+	int cmpl_fd; /* non blocking eventfd, written by the model */
+};
+
+int vkdrv_ring_setup(int fd, struct vkdrv_ring_info *info);
+
+/*
+ * size of a memory file holding nq queues of rings of nblks slots each, nblks
+ * being a power of 2
+ */
+static inline size_t vkdrv_ring_size(const uint32_t nq, const uint32_t nblks)
+{
+	return sizeof(struct vkdrv_ring_hdr) +
+	       (size_t)2 * nq * nblks * VKDRV_RING_BLK_SIZE;
+}
+
+/*
+ * lay the rings out in a zeroed memory file of vkdrv_ring_size(nq, nblks)
+ * bytes, the host2vk rings first
+ */
+static inline void vkdrv_ring_init(struct vkdrv_ring_hdr *hdr,
+				   const uint32_t nq, const uint32_t nblks)
+{
+	size_t offset = sizeof(*hdr);
+	uint32_t i;
+
+	hdr->magic = VKDRV_RING_MAGIC;
+	hdr->version = VKDRV_RING_VERSION;
+	hdr->nq = nq;
+	for (i = 0; i < 2 * nq; i++) {
+		struct vkdrv_ring *r = (i < nq) ? &hdr->host2vk[i] :
+						  &hdr->vk2host[i - nq];
+
+		r->nblks = nblks;
+		r->offset = offset;
+		offset += (size_t)nblks * VKDRV_RING_BLK_SIZE;
+	}
+}
+
+/* slot of index idx in a ring of the memory file mapped at base */
+static inline uint8_t *vkdrv_ring_slot(void *base, const struct vkdrv_ring *r,
+				       const uint32_t idx)
+{
+	return (uint8_t *)base + r->offset +
+	       (size_t)(idx & (r->nblks - 1)) * VKDRV_RING_BLK_SIZE;
+}
+
+/*
+ * copy nblks blocks in (in != 0) or out of a ring from index idx on, wrapping
+ * around its end
+ */
+static inline void vkdrv_ring_copy(void *base, const struct vkdrv_ring *r,
+				   const uint32_t idx, void *buf,
+				   const uint32_t nblks, const int in)
+{
+	uint32_t n = r->nblks - (idx & (r->nblks - 1));
+	uint8_t *slot[2];
+	size_t len[2];
+	int i;
+
+	if (n > nblks)
+		n = nblks;
+	slot[0] = vkdrv_ring_slot(base, r, idx);
+	slot[1] = vkdrv_ring_slot(base, r, 0);
+	len[0] = (size_t)n * VKDRV_RING_BLK_SIZE;
+	len[1] = (size_t)(nblks - n) * VKDRV_RING_BLK_SIZE;
+	for (i = 0; i < 2; i++) {
+		if (in)
+			memcpy(slot[i], buf, len[i]);
+		else
+			memcpy(buf, slot[i], len[i]);
+		buf = (uint8_t *)buf + len[i];
+	}
+}
+
+/*
+ * producer: queue a message of nblks blocks; returns 0, or -EAGAIN if the
+ * ring doesn't have room for it. The caller rings the consumer if needed
+ */
+static inline int vkdrv_ring_put(void *base, struct vkdrv_ring *r,
+				 const void *msg, const uint32_t nblks)
+{
+	uint32_t head, tail;
+
+	head = atomic_load_explicit(&r->head, memory_order_acquire);
+	tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+	if (r->nblks - (tail - head) < nblks)
+		return -EAGAIN;
+	vkdrv_ring_copy(base, r, tail, (void *)msg, nblks, 1);
+	atomic_store_explicit(&r->tail, tail + nblks, memory_order_release);
+	return 0;
+}
+
+/*
+ * consumer: dequeue as many whole messages as fit in max_blks blocks, back to
+ * back in buf; returns the number of blocks dequeued, -ENOMSG if the ring is
+ * empty, or -EMSGSIZE if the first message doesn't fit, with its size written
+ * in buf
+ */
+static inline int vkdrv_ring_get(void *base, struct vkdrv_ring *r, void *buf,
+				 const uint32_t max_blks)
+{
+	uint8_t *blk = buf, *slot;
+	uint32_t head, tail, nblks, n = 0;
+
+	head = atomic_load_explicit(&r->head, memory_order_relaxed);
+	tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+	while (head != tail) {
+		slot = vkdrv_ring_slot(base, r, head);
+		nblks = slot[VKDRV_RING_SIZE_OFFSET] + 1;
+		if (n + nblks > max_blks) {
+			if (n)
+				break;
+			blk[VKDRV_RING_SIZE_OFFSET] = nblks - 1;
+			return -EMSGSIZE;
+		}
+		vkdrv_ring_copy(base, r, head, &blk[n * VKDRV_RING_BLK_SIZE],
+				nblks, 0);
+		head += nblks;
+		n += nblks;
+	}
+	if (!n)
+		return -ENOMSG;
+
+	atomic_store_explicit(&r->head, head, memory_order_release);
+	return n;
+}
+#endif
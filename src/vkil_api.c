@@ -12,10 +12,13 @@
  * read, resp. write messages to the VKIL backend part (vkil_backend.c)
  */
 
+#include <dirent.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include "vk_buffers.h"
 #include "vkil_api.h"
@@ -23,37 +26,67 @@
 #include "vkil_internal.h"
 #include "vkil_utils.h"
 
+/* no processing priority set, the contexts stay on the legacy queue 0 */
+#define VKIL_PROCESSING_PRI_UNSET UINT32_MAX
+
 /*
  * store global configurations that are from CLI parser
  */
 static struct _vkil_cfg {
 	const char *vkapi_device; /* device/affinity, which card to be used */
 	uint32_t    vkapi_processing_pri; /* processing priority */
-} vkil_cfg = { NULL, VKIL_DEF_PROCESSING_PRI };
+	uint32_t    vkapi_cmpl_mode; /* who reads the completions */
+	uint32_t    vkapi_transport; /* how the driver is accessed */
+	vkil_reaper vkapi_reaper; /* how stale responses are reaped */
+	uint32_t    vkapi_pri_backlog; /* high lane backlog deferring low */
+} vkil_cfg = {
+	.vkapi_processing_pri = VKIL_PROCESSING_PRI_UNSET,
+	.vkapi_cmpl_mode = VKIL_CMPL_CALLER,
+	.vkapi_transport = VKIL_DEF_TRANSPORT,
+	.vkapi_reaper = { .timeout_ms = VKIL_REAP_TIMEOUT_MS },
+};
 
-/*
- * usually we wait for response message up to TIMEOUT us
- * However, in certain case, (essentially component initialization)
- * we could need to provide more time for the card to do the initialization
- * (at this time, all this is empiric)
- * TODO: implement a polling on ctrl queue (sideband like), to enquire the
- * status of the card rather than to rely on an arbitrary time out value
- */
+/** max msg size that can be sent to card */
+#define VKIL_SEND_MSG_MAX_SIZE 16
 
-/** this VKIL_READ_TIMEOUT factor tells vkil_read to wait "normal time"
- * for message
+/** expected process buffer response size: a single buffer handle */
+#define VKIL_PROC_BUF_DONE_SIZE 0
+
+/** max number of cards the automatic placement chooses from */
+#define VKIL_PLACE_CARDS_MAX 16
+/** period of the card load sampling of the automatic placement */
+#define VKIL_PLACE_SAMPLE_MS 1000
+/** max wait of each card query sampling the load, short not to stall init */
+#define VKIL_PLACE_QUERY_MS 100
+/**
+ * tolerance band of the placement: a card is deemed as loaded as the least
+ * loaded one if its load is within 1/VKIL_PLACE_TOLERANCE of it
  */
-#ifndef VKIL_READ_TIMEOUT
-#define VKIL_READ_TIMEOUT 1
-#endif
-/** this wait factor tells vkil_read to wait "extra time" for message */
-#define WAIT_INIT (VKIL_READ_TIMEOUT)
+#define VKIL_PLACE_TOLERANCE 8
 
-/** max expected return message size, can be locally overidden */
-#define VKIL_RET_MSG_MAX_SIZE 16
+/** frame rate assumed for the load of a context, until configured */
+#define VKIL_LOAD_DEF_FPS 30
+/** pixel rate assumed for a video context, until configured */
+#define VKIL_LOAD_DEF_RATE (1920 * 1080 * VKIL_LOAD_DEF_FPS)
 
-/** max msg size that can be sent to card */
-#define VKIL_SEND_MSG_MAX_SIZE 16
+/**
+ * @brief card load view of the automatic placement
+ *
+ * the cards are enumerated at most once every VKIL_PLACE_SAMPLE_MS. If the
+ * shared load table can be used, the processes alive are then found out, and
+ * each context is placed as per their current loads; otherwise the available
+ * load of the cards is sampled, the contexts being placed on the cached view
+ * in between. The sampling is done out of the lock, by one thread at a time
+ */
+static struct _vkil_place {
+	pthread_mutex_t lock; /**< protect the view */
+	int64_t sample_us;    /**< time of the last sampling, 0 for never */
+	int32_t sampling;     /**< a thread is sampling the loads */
+	int32_t shared;       /**< the shared load table is used */
+	int32_t ncards;       /**< number of cards found */
+	int32_t id[VKIL_PLACE_CARDS_MAX];    /**< card ids */
+	uint32_t load[VKIL_PLACE_CARDS_MAX]; /**< available load, 0 unknown */
+} vkil_place = { .lock = PTHREAD_MUTEX_INITIALIZER };
 
 /**
  * @brief instrument the write failure
@@ -65,18 +98,19 @@ static struct _vkil_cfg {
 static int fail_write(const int error, const void *ilctx)
 {
 	/*
-	 * some cases are intercepted here and handled. Right now, only
-	 * -EAGAIN and -EPERM, where the formal is when the h2vk queue is
-	 * full, and the second case is when the drive access is off - ie,
-	 * no communication.  In both cases, we could not continue.
+	 * -EAGAIN is returned when the h2vk queue is full: the host is
+	 * requested to try again, once some responses have been retrieved.
+	 *
+	 * -EPERM is intercepted here and handled: the driver access is off -
+	 * ie, no communication, so we could not continue.
 	 * FFMPEG with VK is working in a pipelined fashion, and when one
 	 * component exits, it is observed that other threads do not seem
 	 * to know, so we need to do some special handling here.
 	 */
-	VKIL_LOG(VK_LOG_ERROR,
+	VKIL_LOG(error == -EAGAIN ? VK_LOG_DEBUG : VK_LOG_ERROR,
 		 "Failure on writing message in ilctx %p - %s(%d)\n",
 		 ilctx, strerror(-error), error);
-	if ((error == -EAGAIN) || (error == -EPERM))
+	if (error == -EPERM)
 		kill(getpid(), SIGINT);
 
 	return error;
@@ -100,6 +134,147 @@ static int fail_read(const int error, const void *ilctx)
 	return error;
 }
 
+/**
+ * @brief get the policy to use when waiting for a context response
+ * @param[in] ilctx il context
+ * @return wait policy
+ */
+static inline const vkil_wait_policy *get_wait_policy(const vkil_context *ilctx)
+{
+	const vkil_context_internal *ilpriv = ilctx->priv_data;
+
+	return &ilpriv->wait_policy;
+}
+
+/**
+ * @brief get the time a blocking call of a context gives up, as per its
+ * wait policy timeout only
+ *
+ * the context deadline doesn't apply to the calls releasing the card
+ * resources, which are to go through even once it has passed
+ * @param[in] ilctx il context
+ * @return deadline in vkil_get_time_us time, INT64_MAX for none
+ */
+static int64_t get_timeout_deadline(const vkil_context *ilctx)
+{
+	const vkil_context_internal *ilpriv = ilctx->priv_data;
+	int64_t timeout_ms = VKIL_TIMEOUT_MS;
+
+	if (ilpriv && ilpriv->wait_policy.timeout_ms)
+		timeout_ms = ilpriv->wait_policy.timeout_ms;
+	return timeout_ms ? vkil_get_time_us() + timeout_ms * 1000 : INT64_MAX;
+}
+
+/**
+ * @brief get the time a blocking call of a context gives up
+ *
+ * that is the context deadline, if any, capped by the wait policy timeout;
+ * computed once per call, so that the write and the read of the response
+ * share it
+ * @param[in] ilctx il context
+ * @return deadline in vkil_get_time_us time, INT64_MAX for none
+ */
+static int64_t get_deadline(const vkil_context *ilctx)
+{
+	const vkil_context_internal *ilpriv = ilctx->priv_data;
+	int64_t deadline_us = get_timeout_deadline(ilctx);
+
+	if (ilpriv && ilpriv->deadline_us &&
+	    (ilpriv->deadline_us < deadline_us))
+		deadline_us = ilpriv->deadline_us;
+	return deadline_us;
+}
+
+/**
+ * @brief write the messages staged in the submission batch of a context
+ *
+ * the messages which couldn't be written have their msg_id returned, since
+ * they will never get any response
+ * @param[in] ilctx il context
+ * @return zero on success, error code otherwise
+ */
+static int32_t batch_flush(const vkil_context *ilctx)
+{
+	vkil_context_internal *ilpriv = ilctx->priv_data;
+	vkil_batch *batch = &ilpriv->batch;
+	host2vk_msg *msg = batch->blk;
+	int32_t i, ret;
+
+	if (!batch->nmsgs)
+		return 0;
+
+	ret = vkil_writev(ilctx->devctx, batch->blk, batch->nmsgs);
+	for (i = 0; i < batch->nmsgs; i++) {
+		if (i >= ret)
+			vkil_return_msg_id(ilctx->devctx, msg->msg_id);
+		msg += msg->size + 1;
+	}
+	/* a short write is most likely due to the queue being full */
+	if (ret >= 0)
+		ret = (ret == batch->nmsgs) ? 0 : -EAGAIN;
+
+	batch->nmsgs = 0;
+	batch->nblks = 0;
+	return ret;
+}
+
+/**
+ * @brief submit a message to the card
+ *
+ * while a submission batch is open in the context, a deferrable message is
+ * staged, to be written on the batch commit. Any other message gets the
+ * staged ones written first, so that the card receives all of them in the
+ * issuing order
+ *
+ * a message which can't be deferred waits for its queue to have room
+ *
+ * the context ticket is the one of the message once written, or staged
+ * @param[in] ilctx il context
+ * @param[in] msg message to submit
+ * @param[in] defer the message can be staged
+ * @param[in] deadline_us time to give up waiting for room, if not deferred
+ * @return zero on success, -EAGAIN if the queue is full, other error code
+ *	   otherwise
+ */
+static int32_t submit_msg(const vkil_context *ilctx, host2vk_msg *msg,
+			  const int32_t defer, const int64_t deadline_us)
+{
+	vkil_context_internal *ilpriv = ilctx->priv_data;
+	int32_t ret, stage, nblks = msg->size + 1;
+	vkil_ticket ticket;
+	vkil_batch *batch;
+
+	if (!ilpriv)
+		return vkil_write(ilctx->devctx, msg);
+
+	/* taken before the response can be retrieved, and its msg_id reused */
+	if (msg->msg_id)
+		vkil_set_ticket(ilctx->devctx, msg, &ticket);
+
+	batch = &ilpriv->batch;
+	stage = batch->open && defer && (nblks <= VKIL_BATCH_MAX_BLKS);
+	if (!stage || (batch->nblks + nblks > VKIL_BATCH_MAX_BLKS)) {
+		ret = batch_flush(ilctx);
+		if (ret)
+			return ret;
+	}
+
+	if (!stage) {
+		ret = defer ? vkil_write(ilctx->devctx, msg) :
+			      vkil_write_wait(ilctx->devctx, msg, deadline_us);
+		if (ret)
+			return ret;
+	} else {
+		memcpy(&batch->blk[batch->nblks], msg, sizeof(*msg) * nblks);
+		batch->nblks += nblks;
+		batch->nmsgs++;
+	}
+
+	if (msg->msg_id)
+		ilpriv->ticket = ticket;
+	return 0;
+}
+
 /**
  * @brief extract handles from the input buffer
  * that have to be processed
@@ -286,6 +461,37 @@ fail:
 	return -EOVERFLOW;
 }
 
+/**
+ * @brief get a msg_id for a message to send, and attach the user data to it
+ *
+ * @param ilctx     handle to a vkil_context
+ * @param user_data user data to retrieve with the response
+ * @return          the msg_id on success, error code otherwise
+ */
+static int32_t get_msg_id(const vkil_context *ilctx, const int64_t user_data)
+{
+	vkil_context_internal *ilpriv = ilctx->priv_data;
+	int32_t ret, msg_id;
+
+	msg_id = vkil_get_msg_id(ilctx->devctx, ilpriv->msg_account);
+	/* the msg_ids could be held by stale responses */
+	if ((msg_id < 0) && (vkil_reap_stale(ilctx->devctx) > 0))
+		msg_id = vkil_get_msg_id(ilctx->devctx, ilpriv->msg_account);
+	if (msg_id < 0)
+		/*
+		 * unable to get an id, too much message in transit; the
+		 * context is over quota if -EAGAIN, and has to retrieve some
+		 * responses before trying again
+		 */
+		return msg_id;
+
+	ret = vkil_set_msg_user_data(ilctx->devctx, msg_id, user_data);
+	if (ret < 0)
+		/* unable to set the user data */
+		return ret;
+	return msg_id;
+}
+
 /**
  * @brief prepopulate the command message with control field
  * arguments
@@ -301,35 +507,97 @@ static int32_t preset_host2vk_msg(host2vk_msg *msg2vk, const void *handle,
 				  const int64_t user_data)
 {
 	const vkil_context *ilctx = handle;
-
-	int32_t ret, msg_id;
+	int32_t msg_id;
 
 	VK_ASSERT(handle);
 	VK_ASSERT(msg2vk);
 
-	msg_id = vkil_get_msg_id(ilctx->devctx);
+	msg_id = get_msg_id(ilctx, user_data);
 	if (msg_id < 0) {
-		ret = -ENOBUFS;
-		/* unable to get an id, too much message in transit */
-		goto fail;
+		VKIL_LOG(msg_id == -EAGAIN ? VK_LOG_DEBUG : VK_LOG_ERROR,
+			 "error %d on preset msg %p in ilctx %p", msg_id,
+			 msg2vk, ilctx);
+		return msg_id;
 	}
 
-	ret = vkil_set_msg_user_data(ilctx->devctx, msg_id, user_data);
-	if (ret < 0)
-		/* unable to set the user data */
-		goto fail;
-
 	msg2vk->msg_id = msg_id;
 	msg2vk->queue_id = ilctx->context_essential.queue_id;
 	msg2vk->context_id  = ilctx->context_essential.handle;
 	msg2vk->function_id = fid;
 	msg2vk->size        = 0;
 	return 0;
+}
 
-fail:
-	VKIL_LOG(VK_LOG_ERROR, "error %d on preset msg %p in ilctx %p",
-		 ret, msg2vk, ilctx);
-	return ret;
+/**
+ * @brief estimate the pixel rate of a context from a parameter being set
+ * @param field parameter set
+ * @param value parameter value
+ * @return pixels per second, negative if the parameter doesn't tell
+ */
+static int64_t load_rate_of(const vkil_parameter_t field, const void *value)
+{
+	const vk_enc_cfg *enc = value;
+	const vk_scl_cfg *scl = value;
+	vk_size size;
+	int64_t rate;
+
+	switch (field) {
+	case VK_PARAM_VIDEO_ENC_CONFIG:
+		rate = (int64_t)enc->size.width * enc->size.height *
+		       (enc->fps ? enc->fps : VKIL_LOAD_DEF_FPS);
+		break;
+	case VK_PARAM_VIDEO_SCL_CONFIG:
+		rate = (int64_t)scl->input_size.width *
+		       scl->input_size.height * VKIL_LOAD_DEF_FPS;
+		break;
+	case VK_PARAM_VIDEO_SIZE:
+		size.size = *(const uint32_t *)value;
+		rate = (int64_t)size.width * size.height * VKIL_LOAD_DEF_FPS;
+		break;
+	default:
+		rate = 0;
+		break;
+	}
+	/* a zero size means undefined */
+	return rate ? rate : -1;
+}
+
+/**
+ * @brief publish the load of a new context in the shared load table
+ *
+ * a video context is assumed to process VKIL_LOAD_DEF_RATE until configured
+ * @param ilctx handle to a vkil_context, just created on the card
+ */
+static void load_publish(const vkil_context *ilctx)
+{
+	vkil_context_internal *ilpriv = ilctx->priv_data;
+	const vkil_devctx *devctx = ilctx->devctx;
+	const uint32_t role = ilctx->context_essential.component_role;
+
+	ilpriv->load_rate = ((role == VK_INFO) || (role == VK_DMA)) ?
+			    0 : VKIL_LOAD_DEF_RATE;
+	ilpriv->load_card = devctx->id;
+	vkil_load_add(ilpriv->load_card, role, 1, ilpriv->load_rate);
+}
+
+/**
+ * @brief update the load of a context in the shared load table
+ * @param ilctx handle to a vkil_context
+ * @param field parameter set
+ * @param value parameter value
+ */
+static void load_update(const vkil_context *ilctx,
+			const vkil_parameter_t field, const void *value)
+{
+	vkil_context_internal *ilpriv = ilctx->priv_data;
+	const int64_t rate = load_rate_of(field, value);
+
+	if ((rate < 0) || (ilpriv->load_card < 0))
+		return;
+	vkil_load_add(ilpriv->load_card,
+		      ilctx->context_essential.component_role, 0,
+		      rate - ilpriv->load_rate);
+	ilpriv->load_rate = rate;
 }
 
 /**
@@ -347,6 +615,7 @@ static int32_t vkil_deinit_com(void *handle)
 	vkil_context_internal *ilpriv;
 	host2vk_msg msg2vk;
 	vk2host_msg msg2host;
+	int64_t deadline_us;
 
 	VK_ASSERT(handle);
 
@@ -364,9 +633,11 @@ static int32_t vkil_deinit_com(void *handle)
 
 	ret = preset_host2vk_msg(&msg2vk, handle, VK_FID_DEINIT, 0);
 	if (ret)
-		goto fail_write;
+		return ret;
 
-	ret = vkil_write((void *)ilctx->devctx, &msg2vk);
+	/* the context is released even if its deadline has passed */
+	deadline_us = get_timeout_deadline(ilctx);
+	ret = submit_msg(ilctx, &msg2vk, 0, deadline_us);
 	if (VKDRV_WR_ERR(ret)) {
 		vkil_return_msg_id(ilctx->devctx, msg2vk.msg_id);
 		goto fail_write;
@@ -377,13 +648,8 @@ static int32_t vkil_deinit_com(void *handle)
 	msg2host.queue_id = msg2vk.queue_id;
 	msg2host.context_id = msg2vk.context_id;
 
-	/*
-	 * in the deinit phase the card will need to flush some stuff we don't
-	 * have visibility at vkil, but it is expected this take longer time
-	 * than usual so we don't abort at the first timeout
-	 */
-
-	ret = vkil_read((void *)ilctx->devctx, &msg2host, WAIT_INIT);
+	ret = vkil_read((void *)ilctx->devctx, &msg2host, deadline_us,
+			get_wait_policy(ilctx));
 	if (VKDRV_RD_ERR(ret))
 		goto fail_read;
 
@@ -416,6 +682,7 @@ static int32_t vkil_init_com(void *handle)
 	vkil_context_internal *ilpriv;
 	host2vk_msg msg2vk;
 	vk2host_msg msg2host;
+	int64_t deadline_us;
 
 	VK_ASSERT(handle);
 
@@ -425,7 +692,7 @@ static int32_t vkil_init_com(void *handle)
 
 	ret = preset_host2vk_msg(&msg2vk, handle, VK_FID_INIT, 0);
 	if (ret)
-		goto fail_write;
+		return ret;
 	if (msg2vk.context_id == VK_NEW_CTX) {
 		/*
 		 * the context is not yet existing on the device the arguments
@@ -436,7 +703,8 @@ static int32_t vkil_init_com(void *handle)
 			sizeof(vkil_context_essential));
 	}
 
-	ret = vkil_write((void *)ilctx->devctx, &msg2vk);
+	deadline_us = get_deadline(ilctx);
+	ret = submit_msg(ilctx, &msg2vk, 0, deadline_us);
 	if (VKDRV_WR_ERR(ret)) {
 		vkil_return_msg_id(ilctx->devctx, msg2vk.msg_id);
 		goto fail_write;
@@ -451,13 +719,16 @@ static int32_t vkil_init_com(void *handle)
 	 * visibility at vkil, but it is expected this take longer time than
 	 * usual so we don't abort at the first timeout
 	 */
-	ret = vkil_read((void *)ilctx->devctx, &msg2host, WAIT_INIT);
+	ret = vkil_read((void *)ilctx->devctx, &msg2host, deadline_us,
+			get_wait_policy(ilctx));
 	if (VKDRV_RD_ERR(ret))
 		goto fail_read;
 
 	vkil_return_msg_id(ilctx->devctx, msg2host.msg_id);
-	if (msg2vk.context_id == VK_NEW_CTX)
+	if (msg2vk.context_id == VK_NEW_CTX) {
 		ilctx->context_essential.handle = msg2host.context_id;
+		load_publish(ilctx);
+	}
 
 	VKIL_LOG(VK_LOG_DEBUG, "ilctx=%p: card inited %p for context_id=0x%x",
 		 ilctx, ilctx->devctx, ilctx->context_essential.handle);
@@ -478,21 +749,32 @@ fail_read:
  * already opened, it will add a reference to it
  *
  * @param handle    handle to a vkil_context
+ * @param dev_id    card to use, if no device is opened yet
  * @return          zero on succes, error code otherwise
  *
  * @pre @p handle must already be a _vkil_context but it's private data
  * no yet created (pointing to NULL).
  */
-static int32_t vkil_init_ctx(void *handle)
+static int32_t vkil_init_ctx(void *handle, const int32_t dev_id)
 {
 	int32_t ret;
 	vkil_context *ilctx = handle;
+	vkil_context_internal *ilpriv;
+	pthread_condattr_t attr;
 
 	VK_ASSERT(ilctx);
 	VK_ASSERT(!ilctx->priv_data);
 
 	ilctx->context_essential.handle = VK_NEW_CTX;
 	ilctx->context_essential.pid = getpid();
+	/*
+	 * the priority lanes are opt-in: unless the user picked a queue, use
+	 * the lane of the processing priority, if one has been set
+	 */
+	if (!ilctx->context_essential.queue_id &&
+	    (vkil_cfg.vkapi_processing_pri != VKIL_PROCESSING_PRI_UNSET))
+		ilctx->context_essential.queue_id =
+			vkil_cfg.vkapi_processing_pri;
 
 	/* the priv_data structure size could be component specific */
 	ret = vkil_mallocz(&ilctx->priv_data, sizeof(vkil_context_internal));
@@ -503,12 +785,25 @@ static int32_t vkil_init_ctx(void *handle)
 	 * we pair the device initialization with the private data one to
 	 * prevent multiple device opening
 	 */
-	ret = vkil_init_dev(&ilctx->devctx);
+	ret = vkil_init_dev(&ilctx->devctx, dev_id);
 	if (ret < 0)
 		goto fail;
 
+	ilpriv = ilctx->priv_data;
+	ilpriv->load_card = -1;
+	ret = vkil_new_msg_account(&ilpriv->msg_account);
+	if (ret)
+		goto fail_account;
+
+	pthread_mutex_init(&ilpriv->async_lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&ilpriv->async_idle, &attr);
+	pthread_condattr_destroy(&attr);
 	return 0;
 
+fail_account:
+	vkil_deinit_dev(&ilctx->devctx);
 fail:
 	vkil_free(&ilctx->priv_data);
 	VKIL_LOG(VK_LOG_ERROR, "initialization failure %d for ilctx %p",
@@ -516,6 +811,125 @@ fail:
 	return ret;
 }
 
+/** the thread is running a completion callback, see vkil_done_cb */
+static _Thread_local int32_t async_in_cb;
+
+/**
+ * @brief call the completion callback of an asynchronous command
+ * @param acmd   asynchronous command, unlinked from its context
+ * @param buffer buffer of the command
+ * @param status status of the command
+ * @param size   bytes transferred
+ */
+static void async_call_cb(vkil_async_cmd *acmd, void *buffer,
+			  const int32_t status, const int32_t size)
+{
+	async_in_cb++;
+	acmd->cb(acmd->cookie, buffer, status, size);
+	async_in_cb--;
+}
+
+/**
+ * @brief add an asynchronous command to the ones of its context
+ * @param ilpriv context private data
+ * @param acmd   asynchronous command
+ */
+static void async_link(vkil_context_internal *ilpriv, vkil_async_cmd *acmd)
+{
+	pthread_mutex_lock(&ilpriv->async_lock);
+	acmd->next = ilpriv->async_list;
+	if (acmd->next)
+		acmd->next->pprev = &acmd->next;
+	acmd->pprev = &ilpriv->async_list;
+	ilpriv->async_list = acmd;
+	pthread_mutex_unlock(&ilpriv->async_lock);
+}
+
+/**
+ * @brief remove an asynchronous command from the ones of its context
+ *
+ * async_lock shall be held
+ * @param ilpriv context private data
+ * @param acmd   asynchronous command
+ */
+static void async_unlink_locked(vkil_context_internal *ilpriv,
+				vkil_async_cmd *acmd)
+{
+	*acmd->pprev = acmd->next;
+	if (acmd->next)
+		acmd->next->pprev = acmd->pprev;
+	if (!ilpriv->async_list)
+		pthread_cond_broadcast(&ilpriv->async_idle);
+}
+
+/**
+ * @brief remove an asynchronous command from the ones of its context
+ *
+ * once completed, the context can be gone as soon as it returns
+ * @param ilpriv context private data
+ * @param acmd   asynchronous command
+ */
+static void async_unlink(vkil_context_internal *ilpriv, vkil_async_cmd *acmd)
+{
+	pthread_mutex_lock(&ilpriv->async_lock);
+	async_unlink_locked(ilpriv, acmd);
+	pthread_mutex_unlock(&ilpriv->async_lock);
+}
+
+/**
+ * @brief wait for the asynchronous commands of a context to complete
+ *
+ * their completion accesses the context; the wait is bounded by the wait
+ * policy timeout, the context deadline may have passed already. The commands
+ * still waiting for their response are then abandoned, and their callback
+ * called with -ETIMEDOUT; the ones whose response has come are waited for,
+ * their completion not blocking
+ * @param ilctx handle to a vkil_context
+ */
+static void wait_async(const vkil_context *ilctx)
+{
+	vkil_context_internal *ilpriv = ilctx->priv_data;
+	const int64_t deadline_us = get_timeout_deadline(ilctx);
+	vkil_async_cmd *acmd, *next, *abandoned = NULL;
+	struct timespec ts;
+	int32_t n = 0;
+
+	ts.tv_sec = deadline_us / 1000000;
+	ts.tv_nsec = (deadline_us % 1000000) * 1000;
+	pthread_mutex_lock(&ilpriv->async_lock);
+	while (ilpriv->async_list) {
+		if (deadline_us == INT64_MAX)
+			pthread_cond_wait(&ilpriv->async_idle,
+					  &ilpriv->async_lock);
+		else if (pthread_cond_timedwait(&ilpriv->async_idle,
+						&ilpriv->async_lock, &ts))
+			break;
+	}
+
+	for (acmd = ilpriv->async_list; acmd; acmd = next) {
+		next = acmd->next;
+		if (vkil_abandon_msg_async(ilctx->devctx, &acmd->async))
+			continue;
+		async_unlink_locked(ilpriv, acmd);
+		acmd->next = abandoned;
+		abandoned = acmd;
+		n++;
+	}
+	while (ilpriv->async_list)
+		pthread_cond_wait(&ilpriv->async_idle, &ilpriv->async_lock);
+	pthread_mutex_unlock(&ilpriv->async_lock);
+
+	if (n)
+		VKIL_LOG(VK_LOG_ERROR,
+			 "ilctx=%p: %d asynchronous commands abandoned",
+			 ilctx, n);
+	for (acmd = abandoned; acmd; acmd = next) {
+		next = acmd->next;
+		async_call_cb(acmd, acmd->buffer, -ETIMEDOUT, 0);
+		vkil_free((void **)&acmd);
+	}
+}
+
 /**
  * @brief de-initialize the device context
  *
@@ -534,13 +948,29 @@ int32_t vkil_deinit(void **handle)
 		VKIL_LOG(VK_LOG_ERROR, "unexpected call\n");
 		return 0;
 	}
+	/* it would wait for the thread reading the driver, that is itself */
+	if (async_in_cb) {
+		VKIL_LOG(VK_LOG_ERROR, "ilctx=%p: deinit from a callback",
+			 ilctx);
+		return -EDEADLK;
+	}
 	if (ilctx->priv_data) {
 		vkil_context_internal *ilpriv;
 
-		ret |= vkil_deinit_com(*handle);
 		ilpriv = ilctx->priv_data;
-		if (ilctx->devctx)
-			vkil_deinit_dev(&ilctx->devctx);
+		wait_async(ilctx);
+		pthread_cond_destroy(&ilpriv->async_idle);
+		pthread_mutex_destroy(&ilpriv->async_lock);
+		vkil_del_evt(ilctx->devctx, &ilpriv->evt);
+		/* a context over quota shall still be able to deinit */
+		vkil_set_msg_account(ilctx->devctx, ilpriv->msg_account, 0, 0);
+		ret |= vkil_deinit_com(*handle);
+		if (ilpriv->load_card >= 0)
+			vkil_load_add(ilpriv->load_card,
+				      ilctx->context_essential.component_role,
+				      -1, -ilpriv->load_rate);
+		vkil_detach_msg_account(ilctx->devctx, ilpriv->msg_account);
+		vkil_deinit_dev(&ilctx->devctx);
 		vkil_free((void **)&ilpriv);
 	}
 	vkil_free(handle);
@@ -548,6 +978,299 @@ int32_t vkil_deinit(void **handle)
 	return ret;
 };
 
+/**
+ * @brief enumerate the cards of the host
+ *
+ * the cards are found as /dev/bcm_vk.<id> or, for the legacy driver,
+ * /dev/bcm-vk.<id>; they are sorted by id
+ * @param[out] id card ids, VKIL_PLACE_CARDS_MAX at most
+ * @return number of cards found
+ */
+static int32_t place_enum_cards(int32_t *id)
+{
+	static const char * const drv_names[] = {VKIL_DEV_DRV_NAME,
+						 VKIL_DEV_LEGACY_DRV_NAME};
+	char dev_name[300];
+	struct dirent *ent;
+	int32_t i, j, card, n = 0;
+	size_t len;
+	char *end;
+	DIR *dir;
+
+	dir = opendir("/dev");
+	if (!dir)
+		return 0;
+
+	while ((ent = readdir(dir)) && (n < VKIL_PLACE_CARDS_MAX)) {
+		snprintf(dev_name, sizeof(dev_name), "/dev/%s", ent->d_name);
+		for (i = 0; i < (int32_t)ARRAY_SIZE(drv_names); i++) {
+			len = strlen(drv_names[i]);
+			if (!strncmp(dev_name, drv_names[i], len) &&
+			    (dev_name[len] == '.'))
+				break;
+		}
+		if (i == ARRAY_SIZE(drv_names))
+			continue;
+
+		card = strtol(&dev_name[len + 1], &end, 10);
+		if ((end == &dev_name[len + 1]) || *end || (card < 0))
+			continue;
+
+		/* insertion sort, a card under both names being kept once */
+		for (i = 0; (i < n) && (id[i] < card); i++)
+			;
+		if ((i < n) && (id[i] == card))
+			continue;
+		for (j = n; j > i; j--)
+			id[j] = id[j - 1];
+		id[i] = card;
+		n++;
+	}
+	closedir(dir);
+	return n;
+}
+
+/**
+ * @brief sample the available load of a card
+ *
+ * the load is queried through an info context opened on the card for the
+ * purpose, each query giving up after VKIL_PLACE_QUERY_MS; the high priority
+ * processing gets the high priority load
+ * @param[in]  id   card id
+ * @param[out] load available load
+ * @return zero on success, error code otherwise
+ */
+static int32_t place_sample_load(const int32_t id, uint32_t *load)
+{
+	/* processing priority 0 is "high" */
+	const vkil_parameter_t field = !vkil_get_processing_pri() ?
+				       VK_PARAM_AVAILABLE_LOAD_HI :
+				       VK_PARAM_AVAILABLE_LOAD;
+	vkil_context_internal *ilpriv;
+	vkil_context *ilctx;
+	int32_t ret;
+
+	ret = vkil_mallocz((void **)&ilctx, sizeof(*ilctx));
+	if (ret)
+		return ret;
+
+	ret = vkil_init_ctx(ilctx, id);
+	if (!ret) {
+		/* an unresponsive card is not to hold the placement back */
+		ilpriv = ilctx->priv_data;
+		ilpriv->wait_policy.timeout_ms = VKIL_PLACE_QUERY_MS;
+		ret = vkil_init_com(ilctx);
+	}
+	if (!ret) {
+		*load = 0;
+		ret = vkil_get_parameter(ilctx, field, load,
+					 VK_CMD_RUN | VK_CMD_OPT_BLOCKING);
+	}
+	vkil_deinit((void **)&ilctx);
+	return ret;
+}
+
+/**
+ * @brief tell if the shared load table can be used to place the contexts
+ *
+ * the processes alive are scanned along the way
+ * @param place load view, with the cards enumerated
+ * @return non zero if the table can be used
+ */
+static int32_t place_use_table(const struct _vkil_place *place)
+{
+	int32_t i;
+
+	/* the table only tracks the first cards */
+	for (i = 0; i < place->ncards; i++)
+		if (place->id[i] >= VKIL_LOAD_CARDS_MAX)
+			return 0;
+	return !vkil_load_scan();
+}
+
+/**
+ * @brief refresh the load view
+ *
+ * the cards are enumerated and, unless the shared load table can be used,
+ * their available loads sampled. The card queries are done out of the lock:
+ * meanwhile, the other threads place their contexts on the cards just
+ * enumerated, with the loads sampled the last time
+ * @param place load view
+ * @pre place->lock is held, and no thread is sampling
+ */
+static void place_refresh(struct _vkil_place *place)
+{
+	uint32_t load[VKIL_PLACE_CARDS_MAX];
+	int32_t id[VKIL_PLACE_CARDS_MAX];
+	int32_t i, j, n, ret;
+
+	place->sample_us = vkil_get_time_us();
+	n = place_enum_cards(id);
+	/* the cards still there keep their load until sampled again */
+	for (i = 0; i < n; i++) {
+		for (j = 0; (j < place->ncards) && (place->id[j] != id[i]); j++)
+			;
+		load[i] = (j < place->ncards) ? place->load[j] : 0;
+	}
+	memcpy(place->id, id, n * sizeof(*id));
+	memcpy(place->load, load, n * sizeof(*load));
+	place->ncards = n;
+	place->shared = place_use_table(place);
+	if (place->shared)
+		return;
+
+	place->sampling = 1;
+	pthread_mutex_unlock(&place->lock);
+	for (i = 0; i < n; i++) {
+		ret = place_sample_load(id[i], &load[i]);
+		if (ret) {
+			VKIL_LOG(VK_LOG_WARNING, "card %d load unknown %s(%d)",
+				 id[i], strerror(-ret), ret);
+			load[i] = 0;
+		}
+	}
+	pthread_mutex_lock(&place->lock);
+
+	/* the view is only enumerated by the thread sampling it */
+	memcpy(place->load, load, n * sizeof(*load));
+	place->sample_us = vkil_get_time_us();
+	place->sampling = 0;
+}
+
+/**
+ * @brief pick a card as per the sampled available loads
+ *
+ * the context goes to the card with the most available load
+ * @param id   card ids
+ * @param load available loads, 0 if unknown
+ * @param n    number of cards
+ * @return index of the card, negative if none
+ */
+static int32_t place_pick_sampled(const int32_t *id, const uint32_t *load,
+				  const int32_t n)
+{
+	int32_t i, ref, pick = -1, pick_ref = 0;
+	uint32_t best = 0;
+
+	for (i = 0; i < n; i++)
+		best = MAX(best, load[i]);
+	for (i = 0; i < n; i++) {
+		if (load[i] < best - best / VKIL_PLACE_TOLERANCE)
+			continue;
+		ref = vkil_dev_refs(id[i]);
+		if ((pick < 0) || (ref < pick_ref)) {
+			pick = i;
+			pick_ref = ref;
+		}
+	}
+	return pick;
+}
+
+/**
+ * @brief pick a card as per the shared load table
+ *
+ * the context goes to the card with the lowest pixel rate, summed over the
+ * processes of the user
+ * @param id card ids, tracked by the table
+ * @param n  number of cards
+ * @return index of the card, negative if none
+ */
+static int32_t place_pick_shared(const int32_t *id, const int32_t n)
+{
+	uint64_t rate[VKIL_PLACE_CARDS_MAX], least = UINT64_MAX;
+	int32_t i, ref, pick = -1, pick_ref = 0;
+	uint32_t nctx;
+
+	for (i = 0; i < n; i++) {
+		if (vkil_load_get(id[i], &rate[i], &nctx))
+			return -1;
+		least = MIN(least, rate[i]);
+		VKIL_LOG(VK_LOG_DEBUG, "card %d: %u contexts, %" PRIu64
+			 " pixel/s", id[i], nctx, rate[i]);
+	}
+	for (i = 0; i < n; i++) {
+		if (rate[i] - least > least / VKIL_PLACE_TOLERANCE)
+			continue;
+		ref = vkil_dev_refs(id[i]);
+		if ((pick < 0) || (ref < pick_ref)) {
+			pick = i;
+			pick_ref = ref;
+		}
+	}
+	return pick;
+}
+
+/**
+ * @brief pick a card out of a load view
+ *
+ * the context goes to the least loaded card, as per the shared load table,
+ * or as per the sampled available loads if given. The cards within the
+ * tolerance band of it are deemed equally loaded, the one with the fewest
+ * contexts of the process being then picked; so that a burst of contexts
+ * placed on the same load view is spread over the cards
+ * @param id   card ids
+ * @param load available loads, NULL to use the shared load table
+ * @param n    number of cards, VKIL_PLACE_CARDS_MAX at most
+ * @return index of the card, negative if none
+ */
+int32_t vkil_place_pick(const int32_t *id, const uint32_t *load,
+			const int32_t n)
+{
+	if (n > VKIL_PLACE_CARDS_MAX)
+		return -EINVAL;
+	return load ? place_pick_sampled(id, load, n) :
+		      place_pick_shared(id, n);
+}
+
+/**
+ * @brief pick the card of a new context
+ *
+ * the load view is refreshed if due, and if no other thread is at it
+ * @return card id if positive, error code otherwise
+ */
+static int32_t place_pick_card(void)
+{
+	struct _vkil_place *place = &vkil_place;
+	int32_t n, pick, ret;
+
+	pthread_mutex_lock(&place->lock);
+	if (!place->sampling &&
+	    (!place->sample_us || (vkil_get_time_us() - place->sample_us >=
+				   VKIL_PLACE_SAMPLE_MS * 1000LL)))
+		place_refresh(place);
+
+	n = place->ncards;
+	pick = vkil_place_pick(place->id,
+			       place->shared ? NULL : place->load, n);
+	ret = (pick < 0) ? -ENODEV : place->id[pick];
+	pthread_mutex_unlock(&place->lock);
+
+	VKIL_LOG(VK_LOG_DEBUG, "card %d picked among %d", ret, n);
+	return ret;
+}
+
+/**
+ * @brief get the card to open a context on, as per the affinity
+ * @return card id if positive, error code otherwise
+ */
+static int32_t get_dev_id(void)
+{
+	const char *device = vkil_cfg.vkapi_device;
+	int32_t id;
+
+	if (!device)
+		return 0;
+	if (strcmp(device, VKIL_AFFINITY_AUTO))
+		return atoi(device);
+
+	id = place_pick_card();
+	if (id < 0) {
+		VKIL_LOG(VK_LOG_WARNING, "no card found, use card 0");
+		id = 0;
+	}
+	return id;
+}
+
 /**
  * @brief initialize a vkil_context
  *
@@ -579,7 +1302,7 @@ int32_t vkil_init(void **handle)
 		vkil_context *ilctx = *handle;
 
 		if (!ilctx->priv_data) {
-			ret = vkil_init_ctx(*handle);
+			ret = vkil_init_ctx(*handle, get_dev_id());
 			if (ret)
 				goto fail;
 		}
@@ -644,6 +1367,7 @@ int32_t vkil_set_parameter(void *handle,
 			   const vkil_command_t cmd)
 {
 	const vkil_context *ilctx = handle;
+	int64_t deadline_us;
 	int32_t ret;
 	int32_t field_size = vkil_get_struct_size(field);
 	/* message size is expressed in 16 bytes unit */
@@ -659,7 +1383,7 @@ int32_t vkil_set_parameter(void *handle,
 
 	ret = preset_host2vk_msg(message, handle, VK_FID_SET_PARAM, 0);
 	if (ret)
-		goto fail_write;
+		return ret;
 	/* complete message setting */
 	message->size = msg_size;
 	VKMSG_FIELD(message) = field;
@@ -667,7 +1391,8 @@ int32_t vkil_set_parameter(void *handle,
 	/* align  structure copy on 16 bytes boundary */
 	memcpy(msg_size ? host2vk_getdatap(message) : &VKMSG_FIELD_VAL(message),
 	       value, field_size);
-	ret = vkil_write((void *)ilctx->devctx, message);
+	deadline_us = get_deadline(ilctx);
+	ret = submit_msg(ilctx, message, 0, deadline_us);
 	if (VKDRV_WR_ERR(ret)) {
 		vkil_return_msg_id(ilctx->devctx, message->msg_id);
 		goto fail_write;
@@ -682,11 +1407,12 @@ int32_t vkil_set_parameter(void *handle,
 		response.context_id  = ilctx->context_essential.handle;
 		response.size        = 0;
 		ret = vkil_read((void *)ilctx->devctx, &response,
-				VKIL_READ_TIMEOUT);
+				deadline_us, get_wait_policy(ilctx));
 		if (VKDRV_RD_ERR(ret))
 			goto fail_read;
 
 		vkil_return_msg_id(ilctx->devctx, response.msg_id);
+		load_update(ilctx, field, value);
 	}
 	return ret;
 
@@ -714,6 +1440,7 @@ int32_t vkil_get_parameter(void *handle,
 {
 	int32_t ret;
 	const vkil_context *ilctx = handle;
+	int64_t deadline_us;
 	int32_t field_size = vkil_get_struct_size(field);
 	/* message size is expressed in 16 bytes unit */
 	int32_t msg_size = field_size == sizeof(uint32_t) ?
@@ -728,14 +1455,15 @@ int32_t vkil_get_parameter(void *handle,
 
 	ret = preset_host2vk_msg(message, handle, VK_FID_GET_PARAM, 0);
 	if (ret)
-		goto fail_write;
+		return ret;
 	/* complete setting */
 	message->size = msg_size;
 	VKMSG_FIELD(message) = field;
 	memcpy(msg_size ? host2vk_getdatap(message) : &VKMSG_FIELD_VAL(message),
 	       value, field_size);
 
-	ret = vkil_write((void *)ilctx->devctx, message);
+	deadline_us = get_deadline(ilctx);
+	ret = submit_msg(ilctx, message, 0, deadline_us);
 	if (VKDRV_WR_ERR(ret)) {
 		vkil_return_msg_id(ilctx->devctx, message->msg_id);
 		goto fail_write;
@@ -750,7 +1478,7 @@ int32_t vkil_get_parameter(void *handle,
 		response->context_id  = ilctx->context_essential.handle;
 		response->size        = msg_size;
 		ret = vkil_read((void *)ilctx->devctx, response,
-				VKIL_READ_TIMEOUT);
+				deadline_us, get_wait_policy(ilctx));
 		if (VKDRV_RD_ERR(ret))
 			goto fail_read;
 
@@ -1033,31 +1761,97 @@ static int32_t vkil_sanity_check_buffer(vkil_buffer *buffer)
 }
 
 /**
- * @brief transfer buffers
- *
- * This function need to be called for all buffer to transfer to/from the the
- * Valkyrie card.
- * @li all buffer transfer are done via DMA
- * @li the card memory management are under the card control, typically an
- * upload infers a memory allocation on the card, and a downlaod a memory
- * freeing. the vkil see only opaque handle  to on card buffer descriptor
- * in no case the host can see the on card used memory addresses
+ * @brief retrieve the response of a transfer buffer command
  *
- * @param[in] component_handle	handle to a vkil_context
- * @param[in] host_buffer	buffer to transfer
+ * @param ilctx     handle to a vkil_context
+ * @param buffer    buffer to populate from the response
+ * @param msg_id    msg_id of the command, zero for a call back call
+ * @param cmd       transfer direction
+ * @param deadline_us vkil_read deadline, zero to read without waiting
+ * @param[out] transferred_bytes bytes downloaded, may be NULL on upload
+ * @param[in,out] ref_delta reference change to apply to the buffer
+ * @return          vkil_read return value on success, error code otherwise
+ */
+static int32_t get_trans_buf_done(const vkil_context *ilctx,
+				  vkil_buffer *buffer, const int32_t msg_id,
+				  const vkil_command_t cmd,
+				  const int64_t deadline_us,
+				  int32_t *transferred_bytes,
+				  int32_t *ref_delta)
+{
+	vk2host_msg response;
+	int32_t ret, ret1;
+	/*
+	 * we create a structure to allow to specify a 24 bits field which
+	 * grants us proper handling of sign extension
+	 */
+	struct {
+		int32_t used_size:VK_FLAG_POS;
+	} ret_size = {.used_size = 0};
+
+	response.function_id  = VK_FID_TRANS_BUF_DONE;
+	response.msg_id      = msg_id;
+	response.queue_id    = ilctx->context_essential.queue_id;
+	response.context_id  = ilctx->context_essential.handle;
+	response.size        = 0;
+	ret = vkil_read((void *)ilctx->devctx, &response, deadline_us,
+			get_wait_policy(ilctx));
+	if (VKDRV_RD_ERR(ret))
+		return ret;
+
+	if ((cmd & VK_CMD_MASK) == VK_CMD_UPLOAD) {
+		buffer->handle = response.arg;
+		if (transferred_bytes)
+			*transferred_bytes = 0;
+		*ref_delta = 1;
+	} else { /* VK_CMD_DOWNLOAD */
+		VK_ASSERT(transferred_bytes);
+		ret_size.used_size = response.arg & VK_SIZE_MASK;
+		if (ret_size.used_size < 0)
+			/* buffer not downloaded,  not dereferenced */
+			*ref_delta = 0;
+		*transferred_bytes = ret_size.used_size;
+		buffer->flags = (uint16_t)((response.arg >> VK_FLAG_POS)
+					    & VK_FLAG_MASK);
+	}
+
+	ret1 = ret;
+	ret = vkil_get_msg_user_data(ilctx->devctx, response.msg_id,
+				      &buffer->user_data);
+	/* we return the message no matter the error status above */
+	vkil_return_msg_id(ilctx->devctx, response.msg_id);
+	if (ret)
+		return ret;
+	return ret1;
+}
+
+/**
+ * @brief transfer buffers
+ *
+ * This function need to be called for all buffer to transfer to/from the the
+ * Valkyrie card.
+ * @li all buffer transfer are done via DMA
+ * @li the card memory management are under the card control, typically an
+ * upload infers a memory allocation on the card, and a downlaod a memory
+ * freeing. the vkil see only opaque handle  to on card buffer descriptor
+ * in no case the host can see the on card used memory addresses
+ *
+ * @param[in] component_handle	handle to a vkil_context
+ * @param[in] host_buffer	buffer to transfer
  * @param[in] cmd		transfer direction (upload/download) and mode
  *				(blocking or not)
  * @param[out] transferred_bytes downlaoded  bytes if positive,
  *                               required buffer extension in byte if negative
  *                               The field is mandatory for download, but can be
  *                               set to NULL in upload mode
+ * @param[in] async		 completion of the command, NULL if the response
+ *				 is retrieved by the caller
  * @return			 zero on success, error code otherwise
  * @pre the  _vkil_buffer to transfer must have a valid _vkil_buffer_type
  */
-static int32_t vkil_transfer_buffer2(void *component_handle,
-				     void *buffer_handle,
-				     const vkil_command_t cmd,
-				     int32_t *transferred_bytes)
+static int32_t transfer_buffer2(void *component_handle, void *buffer_handle,
+				const vkil_command_t cmd,
+				int32_t *transferred_bytes, vkil_async *async)
 {
 	int32_t ret, ret1 = 0, msg_id = 0;
 	vkil_buffer *buffer = buffer_handle;
@@ -1067,13 +1861,7 @@ static int32_t vkil_transfer_buffer2(void *component_handle,
 	int32_t msg_size = MSG_SIZE(size);
 	host2vk_msg message[msg_size + 1];
 	int32_t ref_delta = 0;
-	/*
-	 * we create a structure to allow to specify a 24 bits field which
-	 * grants us proper handling of sign extension
-	 */
-	struct {
-		int32_t used_size:VK_FLAG_POS;
-	} ret_size = {.used_size = 0};
+	int64_t deadline_us;
 
 	VKIL_LOG(VK_LOG_DEBUG, "ilctx=%p, buffer=%p, cmd=0x%x (%s%s)",
 		 ilctx,
@@ -1083,6 +1871,7 @@ static int32_t vkil_transfer_buffer2(void *component_handle,
 		 vkil_cmd_opts_str(cmd));
 	VK_ASSERT(component_handle);
 	VK_ASSERT(cmd);
+	deadline_us = (cmd & VK_CMD_OPT_BLOCKING) ? get_deadline(ilctx) : 0;
 
 	ret = vkil_sanity_check_buffer(buffer);
 	if (ret)
@@ -1095,7 +1884,7 @@ static int32_t vkil_transfer_buffer2(void *component_handle,
 					 VK_FID_TRANS_BUF,
 					 buffer->user_data);
 		if (ret)
-			goto fail_write;
+			return ret;
 
 		/* complete setting */
 		message->size = msg_size;
@@ -1115,9 +1904,12 @@ static int32_t vkil_transfer_buffer2(void *component_handle,
 
 		/* we convert the il frontend structure into a backend one */
 		convert_vkil2vk_buffer(host2vk_getdatap(message), buffer);
+		if (async)
+			vkil_set_msg_async(ilctx->devctx, message, async);
 
 		/* then we write the command to the queue */
-		ret = vkil_write((void *)ilctx->devctx, message);
+		ret = submit_msg(ilctx, message,
+				 !(cmd & VK_CMD_OPT_BLOCKING), deadline_us);
 		if (VKDRV_WR_ERR(ret)) {
 			vkil_return_msg_id(ilctx->devctx, message->msg_id);
 			goto fail_write;
@@ -1130,42 +1922,12 @@ static int32_t vkil_transfer_buffer2(void *component_handle,
 
 	if ((cmd & VK_CMD_OPT_BLOCKING) || (cmd & VK_CMD_OPT_CB)) {
 		/* we check for the the card response */
-		vk2host_msg response;
-		int32_t wait = (cmd & VK_CMD_OPT_BLOCKING) ?
-				VKIL_READ_TIMEOUT : 0;
-
-		response.function_id  = VK_FID_TRANS_BUF_DONE;
-		response.msg_id      = msg_id;
-		response.queue_id    = ilctx->context_essential.queue_id;
-		response.context_id  = ilctx->context_essential.handle;
-		response.size        = 0;
-		ret = vkil_read((void *)ilctx->devctx, &response, wait);
+		ret = get_trans_buf_done(ilctx, buffer, msg_id, cmd,
+					 deadline_us, transferred_bytes,
+					 &ref_delta);
 		if (VKDRV_RD_ERR(ret))
 			goto fail_read;
-
-		if ((cmd & VK_CMD_MASK) == VK_CMD_UPLOAD) {
-			buffer->handle = response.arg;
-			if (transferred_bytes)
-				*transferred_bytes = 0;
-			ref_delta = 1;
-		} else { /* VK_CMD_DOWNLOAD */
-			VK_ASSERT(transferred_bytes);
-			ret_size.used_size = response.arg & VK_SIZE_MASK;
-			if (ret_size.used_size < 0)
-				/* buffer not downloaded,  not dereferenced */
-				ref_delta = 0;
-			*transferred_bytes = ret_size.used_size;
-			buffer->flags = (uint16_t)((response.arg >> VK_FLAG_POS)
-						    & VK_FLAG_MASK);
-		}
-
 		ret1 = ret;
-		ret = vkil_get_msg_user_data(ilctx->devctx, response.msg_id,
-					      &buffer->user_data);
-		/* we return the message no matter the error status above */
-		vkil_return_msg_id(ilctx->devctx, response.msg_id);
-		if (ret)
-			goto fail_read;
 	}
 
 	if (ref_delta) {
@@ -1186,6 +1948,27 @@ fail:
 	return ret;
 };
 
+/**
+ * @brief transfer buffers
+ *
+ * @param[in] component_handle	handle to a vkil_context
+ * @param[in] host_buffer	buffer to transfer
+ * @param[in] cmd		transfer direction (upload/download) and mode
+ *				(blocking or not)
+ * @param[out] transferred_bytes	bytes transferred, may be
+ *				set to NULL in upload mode
+ * @return			zero on success, error code otherwise
+ * @see transfer_buffer2
+ */
+static int32_t vkil_transfer_buffer2(void *component_handle,
+				     void *buffer_handle,
+				     const vkil_command_t cmd,
+				     int32_t *transferred_bytes)
+{
+	return transfer_buffer2(component_handle, buffer_handle, cmd,
+				transferred_bytes, NULL);
+}
+
 /**
  * @brief transfer buffers
  *
@@ -1221,6 +2004,84 @@ static int32_t vkil_transfer_buffer(void *component_handle,
 	return ret;
 }
 
+/**
+ * @brief retrieve the response of a process buffer command
+ *
+ * the response is read in a buffer sized after the largest response seen
+ * for the context role, a single block until a larger one is seen. A larger
+ * response is left in the completion table and reported with -EMSGSIZE, its
+ * size being learnt so that it can be retrieved in a new pass
+ *
+ * @param ilctx     handle to a vkil_context
+ * @param buffer    buffer to populate from the response
+ * @param msg_id    msg_id of the command, zero for a call back call; set to
+ *		    the msg_id of the response left in the table on -EMSGSIZE
+ * @param deadline_us vkil_read deadline, zero to read without waiting
+ * @param retry     the response has been reported with -EMSGSIZE before
+ * @return          vkil_read return value on success, error code otherwise
+ */
+static int32_t get_proc_buf_done(const vkil_context *ilctx,
+				 vkil_buffer *buffer, int32_t *msg_id,
+				 const int64_t deadline_us, const int32_t retry)
+{
+	const uint32_t role = ilctx->context_essential.component_role;
+	const int32_t size = vkil_get_resp_size(ilctx->devctx,
+						VK_FID_PROC_BUF_DONE, role,
+						VKIL_PROC_BUF_DONE_SIZE);
+	vk2host_msg response[size + 1];
+	uint64_t user_data;
+	int32_t ret, ret1;
+
+	response->function_id = VK_FID_PROC_BUF_DONE;
+	response->msg_id      = *msg_id;
+	response->queue_id    = ilctx->context_essential.queue_id;
+	response->context_id  = ilctx->context_essential.handle;
+	response->size        = size;
+	ret = vkil_read((void *)ilctx->devctx, response, deadline_us,
+			get_wait_policy(ilctx));
+	vkil_learn_resp_size(ilctx->devctx, response, role,
+			     retry ? size : VKIL_PROC_BUF_DONE_SIZE, ret);
+	if (ret == -EMSGSIZE)
+		/* so that a call back call gets the same response again */
+		*msg_id = response->msg_id;
+	if (VKDRV_RD_ERR(ret))
+		return ret;
+
+	ret1 = ret;
+
+	ret = vkil_get_msg_user_data(ilctx->devctx, response->msg_id,
+				      &user_data);
+	/* we return the message no matter the error status above */
+	vkil_return_msg_id(ilctx->devctx, response->msg_id);
+	if (ret)
+		return ret;
+	ret = set_buffer(buffer, response, user_data, 1);
+	if (ret)
+		return ret;
+	return ret1;
+}
+
+/**
+ * @brief check for the response of a process buffer command
+ *
+ * @param ilctx     handle to a vkil_context
+ * @param buffer    buffer to populate from the response
+ * @param msg_id    msg_id of the command, zero for a call back call
+ * @param deadline_us vkil_read deadline, zero to read without waiting
+ * @return          vkil_read return value on success, error code otherwise
+ */
+static int32_t wait_proc_buf_done(const vkil_context *ilctx,
+				  vkil_buffer *buffer, const int32_t msg_id,
+				  const int64_t deadline_us)
+{
+	int32_t ret, id = msg_id;
+
+	ret = get_proc_buf_done(ilctx, buffer, &id, deadline_us, 0);
+	if (ret == -EMSGSIZE) /* the size is now known */
+		ret = get_proc_buf_done(ilctx, buffer, &id, deadline_us, 1);
+	return ret;
+}
+
 /**
  * @brief process a buffer
  *
@@ -1233,12 +2094,13 @@ static int32_t vkil_transfer_buffer(void *component_handle,
  * @param component_handle    handle to a vkil_context
  * @param buffer_handle       handle to the buffer to process
  * @param cmd                 options (blocking, call back call,...)
+ * @param async               completion of the command, NULL if the response
+ *			      is retrieved by the caller
  * @return                    zero on success, error code otherwise
  * @pre the  _vkil_buffer to process must have a valid _vkil_buffer_type
  */
-int32_t vkil_process_buffer(void *component_handle,
-			    void *buffer_handle,
-			    const vkil_command_t cmd)
+static int32_t process_buffer(void *component_handle, void *buffer_handle,
+			      const vkil_command_t cmd, vkil_async *async)
 {
 	const vkil_context *ilctx = component_handle;
 	vkil_context_internal *ilpriv;
@@ -1247,6 +2109,7 @@ int32_t vkil_process_buffer(void *component_handle,
 	int32_t msg_id = 0;
 	uint32_t handles[VKIL_MAX_AGGREGATED_BUFFERS];
 	uint32_t nbuf, msg_size;
+	int64_t deadline_us;
 
 	VKIL_LOG(VK_LOG_DEBUG, "ilctx=%p, buffer=%p, cmd=0x%x (%s%s)",
 		 ilctx,
@@ -1257,6 +2120,7 @@ int32_t vkil_process_buffer(void *component_handle,
 
 	VK_ASSERT(component_handle);
 	VK_ASSERT(buffer_handle);
+	deadline_us = (cmd & VK_CMD_OPT_BLOCKING) ? get_deadline(ilctx) : 0;
 
 	ilpriv = ilctx->priv_data;
 	buffer = buffer_handle;
@@ -1278,7 +2142,7 @@ int32_t vkil_process_buffer(void *component_handle,
 					 VK_FID_PROC_BUF,
 					 buffer->user_data);
 		if (ret)
-			goto fail_write;
+			return ret;
 
 		ret = buffer_check_ref(buffer);
 		if (ret)
@@ -1288,8 +2152,11 @@ int32_t vkil_process_buffer(void *component_handle,
 		VKMSG_CMD(message) = cmd & VK_CMD_MASK;
 		message->size = msg_size;
 		memcpy(&VKMSG_CMD_ARG(message), handles, nbuf * sizeof(uint32_t));
+		if (async)
+			vkil_set_msg_async(ilctx->devctx, message, async);
 
-		ret = vkil_write((void *)ilctx->devctx, message);
+		ret = submit_msg(ilctx, message,
+				 !(cmd & VK_CMD_OPT_BLOCKING), deadline_us);
 		if (VKDRV_WR_ERR(ret)) {
 			vkil_return_msg_id(ilctx->devctx,
 					   message->msg_id);
@@ -1305,31 +2172,10 @@ int32_t vkil_process_buffer(void *component_handle,
 
 	if ((cmd & VK_CMD_OPT_BLOCKING) || (cmd & VK_CMD_OPT_CB)) {
 		/* we check for the the card response */
-		vk2host_msg response[VKIL_RET_MSG_MAX_SIZE];
-		int32_t wait = (cmd & VK_CMD_OPT_BLOCKING) ?
-				VKIL_READ_TIMEOUT : 0;
-		uint64_t user_data;
-
-		response->function_id = VK_FID_PROC_BUF_DONE;
-		response->msg_id      = msg_id;
-		response->queue_id    = ilctx->context_essential.queue_id;
-		response->context_id  = ilctx->context_essential.handle;
-		response->size        = VKIL_RET_MSG_MAX_SIZE - 1;
-		ret = vkil_read((void *)ilctx->devctx, response, wait);
+		ret = wait_proc_buf_done(ilctx, buffer, msg_id, deadline_us);
 		if (VKDRV_RD_ERR(ret))
 			goto fail_read;
-
 		ret1 = ret;
-
-		ret = vkil_get_msg_user_data(ilctx->devctx, response->msg_id,
-					      &user_data);
-		/* we return the message no matter the error status above */
-		vkil_return_msg_id(ilctx->devctx, response->msg_id);
-		if (ret)
-			goto fail_read;
-		ret = set_buffer(buffer, response, user_data, 1);
-		if (ret)
-			goto fail_read;
 	}
 	return ret1;
 
@@ -1344,6 +2190,22 @@ fail:
 	return ret;
 };
 
+/**
+ * @brief process a buffer
+ *
+ * @param component_handle    handle to a vkil_context
+ * @param buffer_handle       handle to the buffer to process
+ * @param cmd                 options (blocking, call back call,...)
+ * @return                    zero on success, error code otherwise
+ * @see process_buffer
+ */
+int32_t vkil_process_buffer(void *component_handle,
+			    void *buffer_handle,
+			    const vkil_command_t cmd)
+{
+	return process_buffer(component_handle, buffer_handle, cmd, NULL);
+}
+
 /**
  * @brief a ref/unref buffer
  *
@@ -1365,6 +2227,7 @@ int32_t vkil_xref_buffer(void *ctx_handle,
 	int32_t ret, ret1 = 0, msg_id = 0;
 	vkil_buffer *buffer = buffer_handle;
 	host2vk_msg message[1];
+	int64_t deadline_us;
 
 	const vkil_context *ilctx = ctx_handle;
 
@@ -1376,6 +2239,7 @@ int32_t vkil_xref_buffer(void *ctx_handle,
 		 vkil_cmd_opts_str(cmd));
 	VK_ASSERT(ctx_handle);
 	VK_ASSERT(cmd);
+	deadline_us = (cmd & VK_CMD_OPT_BLOCKING) ? get_deadline(ilctx) : 0;
 
 	ret = vkil_sanity_check_buffer(buffer);
 	if (ret)
@@ -1388,7 +2252,7 @@ int32_t vkil_xref_buffer(void *ctx_handle,
 					 VK_FID_XREF_BUF,
 					 buffer->user_data);
 		if (ret)
-			goto fail_write;
+			return ret;
 
 		/* complete setting */
 		message->size = 0;
@@ -1402,7 +2266,8 @@ int32_t vkil_xref_buffer(void *ctx_handle,
 		}
 
 		/* then we write the command to the queue */
-		ret = vkil_write((void *)ilctx->devctx, message);
+		ret = submit_msg(ilctx, message,
+				 !(cmd & VK_CMD_OPT_BLOCKING), deadline_us);
 		if (VKDRV_WR_ERR(ret)) {
 			vkil_return_msg_id(ilctx->devctx, message->msg_id);
 			goto fail_write;
@@ -1419,15 +2284,14 @@ int32_t vkil_xref_buffer(void *ctx_handle,
 	if ((cmd & VK_CMD_OPT_BLOCKING) || (cmd & VK_CMD_OPT_CB)) {
 		/* we check for the the card response */
 		vk2host_msg response;
-		int32_t wait = (cmd & VK_CMD_OPT_BLOCKING) ?
-				VKIL_READ_TIMEOUT : 0;
 
 		response.function_id = VK_FID_TRANS_BUF_DONE;
 		response.msg_id = msg_id;
 		response.queue_id = ilctx->context_essential.queue_id;
 		response.context_id = ilctx->context_essential.handle;
 		response.size = 0;
-		ret = vkil_read((void *)ilctx->devctx, &response, wait);
+		ret = vkil_read((void *)ilctx->devctx, &response,
+				deadline_us, get_wait_policy(ilctx));
 		if (VKDRV_RD_ERR(ret))
 			goto fail_read;
 
@@ -1509,10 +2373,724 @@ int vkil_destroy_api(void **ilapi)
 	return 0;
 }
 
+/**
+ * @brief set the policy used to wait for card responses in a context
+ *
+ * @param[in] ctx_handle handle to a vkil_context
+ * @param[in] policy     wait policy, NULL to restore the default one
+ * @return               zero on success, error code otherwise
+ */
+int vkil_set_wait_policy(void *ctx_handle, const vkil_wait_policy *policy)
+{
+	vkil_context *ilctx = ctx_handle;
+	vkil_context_internal *ilpriv;
+
+	if (!ilctx || !ilctx->priv_data)
+		return -EINVAL;
+
+	ilpriv = ilctx->priv_data;
+	if (policy)
+		ilpriv->wait_policy = *policy;
+	else
+		memset(&ilpriv->wait_policy, 0, sizeof(ilpriv->wait_policy));
+
+	VKIL_LOG(VK_LOG_DEBUG, "ilctx=%p spin %dus yield %dus%s timeout %dms",
+		 ilctx, ilpriv->wait_policy.spin_us,
+		 ilpriv->wait_policy.yield_us,
+		 ilpriv->wait_policy.adaptive ? " adaptive" : "",
+		 ilpriv->wait_policy.timeout_ms);
+	return 0;
+}
+
+/**
+ * @brief set the deadline of the blocking calls of a context
+ *
+ * past the deadline, the blocking calls give up waiting and fail with
+ * -ETIMEDOUT; the response of a command given up on is discarded when it
+ * shows up, releasing its msg_id. The deadline applies to all the calls
+ * issued until it is changed, in addition to the wait policy timeout
+ *
+ * @param[in] ctx_handle  handle to a vkil_context
+ * @param[in] deadline_us absolute time in us, on CLOCK_MONOTONIC; zero to
+ *			  clear the deadline
+ * @return                zero on success, error code otherwise
+ */
+int vkil_set_deadline(void *ctx_handle, const int64_t deadline_us)
+{
+	vkil_context *ilctx = ctx_handle;
+	vkil_context_internal *ilpriv;
+
+	if (!ilctx || !ilctx->priv_data || (deadline_us < 0))
+		return -EINVAL;
+
+	ilpriv = ilctx->priv_data;
+	ilpriv->deadline_us = deadline_us;
+
+	VKIL_LOG(VK_LOG_DEBUG, "ilctx=%p deadline %" PRId64 "us", ilctx,
+		 deadline_us);
+	return 0;
+}
+
+/**
+ * @brief set the in flight message quota of a context
+ *
+ * a context over its quota gets -EAGAIN on any command to be written to the
+ * card, until it retrieves some responses. The msg_ids reserved for the
+ * context can't be consumed by the other contexts, even those without a
+ * quota
+ *
+ * @param[in] ctx_handle handle to a vkil_context
+ * @param[in] quota      message quota, NULL to restore the default one
+ * @return               zero on success, -ENOSPC if not enough msg_ids are
+ *			 available to be reserved, error code otherwise
+ */
+int vkil_set_msg_quota(void *ctx_handle, const vkil_msg_quota *quota)
+{
+	vkil_context *ilctx = ctx_handle;
+	vkil_context_internal *ilpriv;
+	int32_t ret;
+
+	if (!ilctx || !ilctx->priv_data || !ilctx->devctx)
+		return -EINVAL;
+
+	ilpriv = ilctx->priv_data;
+	ret = vkil_set_msg_account(ilctx->devctx, ilpriv->msg_account,
+				   quota ? quota->max : 0,
+				   quota ? quota->reserved : 0);
+
+	VKIL_LOG(ret ? VK_LOG_ERROR : VK_LOG_DEBUG,
+		 "ilctx=%p max %d reserved %d: %d", ilctx,
+		 quota ? quota->max : 0, quota ? quota->reserved : 0, ret);
+	return ret;
+}
+
+/**
+ * @brief get the number of responses retrieved in a single pass thanks to
+ * the response size learnt on the context device
+ *
+ * such responses, larger than expected, would otherwise have been reported
+ * with -EMSGSIZE first
+ *
+ * @param[in]  ctx_handle handle to a vkil_context
+ * @param[out] count      number of retries avoided
+ * @return                zero on success, error code otherwise
+ */
+int vkil_get_retries_avoided(void *ctx_handle, uint64_t *count)
+{
+	vkil_context *ilctx = ctx_handle;
+	vkil_devctx *devctx;
+
+	if (!ilctx || !ilctx->devctx || !count)
+		return -EINVAL;
+
+	devctx = ilctx->devctx;
+	*count = atomic_load_explicit(&devctx->resp.retries_avoided,
+				      memory_order_relaxed);
+	return 0;
+}
+
+/**
+ * @brief get the credits of the queue of a context
+ *
+ * (limit - inflight) messages can be written to the queue before it is
+ * deemed full; a command written to a full queue gets -EAGAIN if non
+ * blocking, or waits for the queue to have room otherwise. The limit is
+ * learnt from the driver reporting the queue full
+ *
+ * @param[in]  ctx_handle handle to a vkil_context
+ * @param[out] credits    credits of the context queue
+ * @return                zero on success, error code otherwise
+ */
+int vkil_get_credits(void *ctx_handle, vkil_credits *credits)
+{
+	vkil_context *ilctx = ctx_handle;
+	vkil_devctx *devctx;
+	vkil_credit *cr;
+
+	if (!ilctx || !ilctx->devctx || !credits ||
+	    (ilctx->context_essential.queue_id >= VKIL_MSG_Q_MAX))
+		return -EINVAL;
+
+	devctx = ilctx->devctx;
+	cr = &devctx->q[ilctx->context_essential.queue_id].credit;
+	credits->limit = atomic_load_explicit(&cr->limit,
+					      memory_order_relaxed);
+	credits->inflight = atomic_load_explicit(&cr->inflight,
+						 memory_order_relaxed);
+	return 0;
+}
+
+/**
+ * @brief get the number of stale responses reaped on the context device
+ *
+ * @param[in]  ctx_handle handle to a vkil_context
+ * @param[out] count      number of responses reaped
+ * @return                zero on success, error code otherwise
+ */
+int vkil_get_reaped(void *ctx_handle, uint64_t *count)
+{
+	vkil_context *ilctx = ctx_handle;
+	vkil_devctx *devctx;
+
+	if (!ilctx || !ilctx->devctx || !count)
+		return -EINVAL;
+
+	devctx = ilctx->devctx;
+	*count = atomic_load_explicit(&devctx->reaped, memory_order_relaxed);
+	return 0;
+}
+
+/**
+ * @brief get a descriptor signaled when responses of a context are pending
+ *
+ * the descriptor, an eventfd, becomes readable when responses to the
+ * commands of the context are ready to be retrieved, and can be watched by an
+ * event loop (poll, epoll, libuv...) in place of polling the non blocking
+ * calls. Once readable, the descriptor is to be read, clearing it, and the
+ * responses retrieved with non blocking calls until they return -EAGAIN.
+ * The descriptor is first signaled right away, and a response can have been
+ * retrieved before its notification is read: a wake up without response is
+ * expected once in a while.
+ *
+ * the responses being deposited by the completion dispatcher, the device
+ * gets one from then on if it hasn't any. The descriptor is owned by the
+ * context, and closed by its deinit
+ *
+ * @param[in]  ctx_handle handle to an initialized vkil_context
+ * @param[out] fd         eventfd of the context
+ * @return                zero on success, error code otherwise
+ */
+int vkil_get_event_fd(void *ctx_handle, int *fd)
+{
+	vkil_context *ilctx = ctx_handle;
+	vkil_context_internal *ilpriv;
+	int32_t ret;
+
+	if (!ilctx || !ilctx->priv_data || !ilctx->devctx || !fd ||
+	    (ilctx->context_essential.handle < VK_START_VALID_HANDLE))
+		return -EINVAL;
+
+	ilpriv = ilctx->priv_data;
+	if (!ilpriv->evt) {
+		ret = vkil_new_evt(ilctx->devctx,
+				   ilctx->context_essential.handle,
+				   &ilpriv->evt);
+		if (ret) {
+			VKIL_LOG(VK_LOG_ERROR, "ilctx=%p: failure %s(%d)",
+				 ilctx, strerror(-ret), ret);
+			return ret;
+		}
+		VKIL_LOG(VK_LOG_DEBUG, "ilctx=%p: eventfd %d", ilctx,
+			 ilpriv->evt->fd);
+	}
+	*fd = ilpriv->evt->fd;
+	return 0;
+}
+
+/**
+ * @brief get the ticket of the last command written by a context
+ *
+ * to be called by the thread issuing the command, right after a non blocking
+ * process_buffer, transfer_buffer or xref_buffer has returned; the ticket is
+ * then waited for with vkil_wait_any or vkil_wait_all, along with tickets
+ * of other contexts, on the same card or not. A command staged in a
+ * submission batch gets its ticket as well, completing once committed
+ *
+ * @param[in]  ctx_handle handle to a vkil_context
+ * @param[out] ticket     ticket of the command
+ * @return                zero on success, -ENOENT if the context hasn't
+ *			  written any command, other error code otherwise
+ */
+int vkil_get_ticket(void *ctx_handle, vkil_ticket *ticket)
+{
+	vkil_context *ilctx = ctx_handle;
+	vkil_context_internal *ilpriv;
+
+	if (!ilctx || !ilctx->priv_data || !ticket)
+		return -EINVAL;
+
+	ilpriv = ilctx->priv_data;
+	if (!ilpriv->ticket.msg_id)
+		return -ENOENT;
+
+	*ticket = ilpriv->ticket;
+	return 0;
+}
+
+/**
+ * @brief check a ticket has been filled by vkil_get_ticket
+ * @param[in] ticket ticket to check
+ * @return non zero if valid
+ */
+static int32_t ticket_valid(const vkil_ticket *ticket)
+{
+	return ticket->devctx && (ticket->queue_id < VKIL_MSG_Q_MAX) &&
+	       ticket->msg_id && (ticket->msg_id < VKIL_MSG_ID_MAX);
+}
+
+/**
+ * @brief wait for tickets
+ * @param[in] tickets     tickets to wait for
+ * @param[in] n           number of tickets
+ * @param[in] all         wait for all the tickets, rather than any of them
+ * @param[in] deadline_us absolute time in us, on CLOCK_MONOTONIC; zero for
+ *			  no deadline
+ * @return                as vkil_wait_tickets
+ */
+static int32_t wait_tickets(const vkil_ticket *tickets, const int n,
+			    const int32_t all, const int64_t deadline_us)
+{
+	int32_t i, ret;
+
+	if (!tickets || (n <= 0) || (deadline_us < 0))
+		return -EINVAL;
+
+	for (i = 0; i < n; i++)
+		if (!ticket_valid(&tickets[i]))
+			return -EINVAL;
+
+	ret = vkil_wait_tickets(tickets, n, all,
+				deadline_us ? deadline_us : INT64_MAX);
+	if ((ret < 0) && (ret != -ETIMEDOUT) && (ret != -ECANCELED))
+		VKIL_LOG(VK_LOG_ERROR, "failure %s(%d) on %d tickets",
+			 strerror(-ret), ret, n);
+	return ret;
+}
+
+/**
+ * @brief wait for any of several tickets to complete
+ *
+ * a ticket completes once the response of its command can be retrieved
+ * without blocking, with a VK_CMD_OPT_CB call on its context; or has been
+ * retrieved already. The caller sleeps until then, the responses being
+ * deposited by the completion dispatchers of the devices, which get one
+ * if they haven't any
+ *
+ * a ticket whose response is lost, discarded by the reaper or given up on by
+ * a timed out call, completes as well: vkil_get_ticket_status then tells
+ * whether the ticket whose index is returned completed in error
+ *
+ * @param[in] tickets     tickets to wait for, of any context and device
+ * @param[in] n           number of tickets
+ * @param[in] deadline_us absolute time in us, on CLOCK_MONOTONIC; zero for
+ *			  no deadline
+ * @return                index of a completed ticket, -ETIMEDOUT if none
+ *			  completed by the deadline, -ENODEV if the device of
+ *			  a ticket is closed, other error code otherwise
+ */
+int vkil_wait_any(const vkil_ticket *tickets, const int n,
+		  const int64_t deadline_us)
+{
+	return wait_tickets(tickets, n, 0, deadline_us);
+}
+
+/**
+ * @brief wait for all of several tickets to complete
+ *
+ * as vkil_wait_any, returning once all the tickets are completed
+ *
+ * @param[in] tickets     tickets to wait for, of any context and device
+ * @param[in] n           number of tickets
+ * @param[in] deadline_us absolute time in us, on CLOCK_MONOTONIC; zero for
+ *			  no deadline
+ * @return                zero on success, -ETIMEDOUT if some are not
+ *			  completed by the deadline, -ECANCELED if some are
+ *			  lost, -ENODEV if the device of a ticket is closed,
+ *			  other error code otherwise
+ */
+int vkil_wait_all(const vkil_ticket *tickets, const int n,
+		  const int64_t deadline_us)
+{
+	return wait_tickets(tickets, n, 1, deadline_us);
+}
+
+/**
+ * @brief get the status of a ticket, without waiting
+ *
+ * @param[in] ticket ticket to check
+ * @return           zero if completed, -EINPROGRESS if not yet, -ECANCELED
+ *		     if its response is lost, -ESTALE if its msg_id has been
+ *		     reused too many times since to tell, -ENODEV if its
+ *		     device is closed, other error code otherwise
+ */
+int vkil_get_ticket_status(const vkil_ticket *ticket)
+{
+	if (!ticket || !ticket_valid(ticket))
+		return -EINVAL;
+
+	return vkil_ticket_status(ticket);
+}
+
+/**
+ * @brief open a submission batch in a context
+ *
+ * until the batch is committed, the non blocking transfer_buffer,
+ * process_buffer and xref_buffer commands issued on the context are staged
+ * rather than written to the card; each one still gets its own msg_id, and
+ * its response is retrieved individually, as usual. Any other command
+ * written on the context gets the staged ones written first
+ *
+ * @param[in] ctx_handle handle to a vkil_context
+ * @return               zero on success, error code otherwise
+ */
+int vkil_batch_begin(void *ctx_handle)
+{
+	vkil_context *ilctx = ctx_handle;
+	vkil_context_internal *ilpriv;
+
+	if (!ilctx || !ilctx->priv_data)
+		return -EINVAL;
+
+	ilpriv = ilctx->priv_data;
+	ilpriv->batch.open = 1;
+
+	VKIL_LOG(VK_LOG_DEBUG, "ilctx=%p", ilctx);
+	return 0;
+}
+
+/**
+ * @brief commit a submission batch
+ *
+ * all the staged commands are written to the card in a single system call,
+ * and the batch is closed
+ *
+ * @param[in] ctx_handle handle to a vkil_context
+ * @return               zero on success, error code otherwise; on error
+ *			 the commands not written will get no response
+ */
+int vkil_batch_commit(void *ctx_handle)
+{
+	vkil_context *ilctx = ctx_handle;
+	vkil_context_internal *ilpriv;
+	int32_t ret;
+
+	if (!ilctx || !ilctx->priv_data)
+		return -EINVAL;
+
+	ilpriv = ilctx->priv_data;
+	VKIL_LOG(VK_LOG_DEBUG, "ilctx=%p, %d messages", ilctx,
+		 ilpriv->batch.nmsgs);
+
+	ilpriv->batch.open = 0;
+	ret = batch_flush(ilctx);
+	if (ret)
+		return fail_write(ret, ilctx);
+	return 0;
+}
+
+/**
+ * @brief prepare a process_buffer command
+ *
+ * the buffer is validated, and the command message built, once; so that
+ * a stream submitting buffers of the same shape can patch only the msg_id,
+ * user data and handles of each one, via vkil_submit_prepared. The
+ * response is retrieved as for _vkil_api::process_buffer
+ *
+ * @param[in] ctx_handle     handle to a vkil_context, initialized on card
+ * @param[in] buffer_handle  buffer giving the shape; that is the type, and
+ *			     the number of aggregated buffers
+ * @param[in] cmd            command and options, except VK_CMD_OPT_CB
+ * @param[out] prepared      the prepared command, to release with
+ *			     vkil_release_prepared
+ * @return                   zero on success, error code otherwise
+ */
+int vkil_prepare_process_buffer(void *ctx_handle, const void *buffer_handle,
+				const vkil_command_t cmd,
+				vkil_prepared_cmd **prepared)
+{
+	const vkil_context *ilctx = ctx_handle;
+	vkil_buffer *buffer = (vkil_buffer *)buffer_handle;
+	uint32_t handles[VKIL_MAX_AGGREGATED_BUFFERS];
+	vkil_prepared_cmd *prep;
+	uint32_t nbuf, msg_size;
+	int32_t ret;
+
+	if (!ilctx || !ilctx->priv_data || !buffer || !prepared ||
+	    (cmd & VK_CMD_OPT_CB))
+		return -EINVAL;
+
+	ret = vkil_sanity_check_buffer(buffer);
+	if (ret)
+		goto fail;
+
+	get_buffer(buffer, &nbuf, handles);
+	/* handles[0] will always be primary buffer(packet/frame) */
+	msg_size = MSG_SIZE((nbuf - 1) * sizeof(uint32_t));
+
+	ret = vkil_mallocz((void **)&prep, sizeof(*prep) +
+			   (msg_size + 1) * sizeof(host2vk_msg));
+	if (ret)
+		goto fail;
+
+	prep->ilctx = ilctx;
+	prep->cmd = cmd;
+	prep->type = buffer->type;
+	prep->nbuf = nbuf;
+	prep->msg->queue_id = ilctx->context_essential.queue_id;
+	prep->msg->context_id = ilctx->context_essential.handle;
+	prep->msg->function_id = VK_FID_PROC_BUF;
+	prep->msg->size = msg_size;
+	VKMSG_CMD(prep->msg) = cmd & VK_CMD_MASK;
+
+	*prepared = prep;
+	VKIL_LOG(VK_LOG_DEBUG, "ilctx=%p, type=%d, nbuf=%d, cmd=0x%x (%s%s)",
+		 ilctx, prep->type, nbuf, cmd, vkil_cmd_str(cmd),
+		 vkil_cmd_opts_str(cmd));
+	return 0;
+
+fail:
+	VKIL_LOG(VK_LOG_ERROR, "failure %d in ilctx %p", ret, ilctx);
+	return ret;
+}
+
+/**
+ * @brief submit a buffer with a prepared process_buffer command
+ *
+ * @param[in] prepared       command prepared by vkil_prepare_process_buffer
+ * @param[in] buffer_handle  buffer to process, of the prepared shape
+ * @return                   same as _vkil_api::process_buffer; -EINVAL if
+ *			     the buffer shape is not the prepared one
+ */
+int vkil_submit_prepared(vkil_prepared_cmd *prepared, void *buffer_handle)
+{
+	const vkil_context *ilctx;
+	vkil_buffer *buffer = buffer_handle;
+	uint32_t handles[VKIL_MAX_AGGREGATED_BUFFERS];
+	host2vk_msg message[VKIL_SEND_MSG_MAX_SIZE];
+	int64_t deadline_us;
+	int32_t ret, msg_id;
+	uint32_t nbuf;
+
+	VK_ASSERT(prepared);
+	VK_ASSERT(buffer_handle);
+
+	ilctx = prepared->ilctx;
+	if (buffer->type != prepared->type)
+		return -EINVAL;
+
+	get_buffer(buffer, &nbuf, handles);
+	if (nbuf != prepared->nbuf)
+		return -EINVAL;
+
+	ret = buffer_check_ref(buffer);
+	if (ret)
+		return fail_write(ret, ilctx);
+
+	msg_id = get_msg_id(ilctx, buffer->user_data);
+	if (msg_id < 0)
+		return msg_id;
+
+	memcpy(message, prepared->msg,
+	       (prepared->msg->size + 1) * sizeof(host2vk_msg));
+	message->msg_id = msg_id;
+	memcpy(&VKMSG_CMD_ARG(message), handles, nbuf * sizeof(uint32_t));
+
+	deadline_us = (prepared->cmd & VK_CMD_OPT_BLOCKING) ?
+		      get_deadline(ilctx) : 0;
+	ret = submit_msg(ilctx, message,
+			 !(prepared->cmd & VK_CMD_OPT_BLOCKING), deadline_us);
+	if (VKDRV_WR_ERR(ret)) {
+		vkil_return_msg_id(ilctx->devctx, msg_id);
+		return fail_write(ret, ilctx);
+	}
+	buffer_ref(buffer, -1);
+
+	if (!(prepared->cmd & VK_CMD_OPT_BLOCKING))
+		return 0;
+
+	ret = wait_proc_buf_done(ilctx, buffer, msg_id, deadline_us);
+	if (VKDRV_RD_ERR(ret))
+		return fail_read(ret, ilctx);
+	return ret;
+}
+
+/**
+ * @brief release a prepared command
+ *
+ * @param[in,out] prepared  command to release, set to NULL
+ * @return                  zero on success, error code otherwise
+ */
+int vkil_release_prepared(vkil_prepared_cmd **prepared)
+{
+	if (!prepared)
+		return -EINVAL;
+
+	vkil_free((void **)prepared);
+	return 0;
+}
+
+/**
+ * @brief complete an asynchronous command
+ *
+ * the response is retrieved, populating the buffer, and the user callback
+ * called
+ * @param acmd asynchronous command, freed on return
+ */
+static void async_complete(vkil_async_cmd *acmd)
+{
+	const vkil_context *ilctx = acmd->ilctx;
+	vkil_context_internal *ilpriv = ilctx->priv_data;
+	vkil_buffer *buffer = acmd->buffer;
+	int32_t ret, size = 0, ref_delta = 0;
+
+	if (acmd->fid == VK_FID_PROC_BUF) {
+		ret = wait_proc_buf_done(ilctx, buffer, acmd->msg_id, 0);
+	} else {
+		ret = get_trans_buf_done(ilctx, buffer, acmd->msg_id,
+					 acmd->cmd, 0, &size, &ref_delta);
+		if (!VKDRV_RD_ERR(ret) && ref_delta)
+			buffer_ref(buffer, ref_delta);
+		/* as vkil_transfer_buffer does */
+		if (!ret && ((acmd->cmd & VK_CMD_MASK) == VK_CMD_DOWNLOAD))
+			buffer->handle = size;
+	}
+	if (VKDRV_RD_ERR(ret))
+		ret = fail_read(ret, ilctx);
+
+	/* the context can be gone once unlinked, the callback not using it */
+	async_unlink(ilpriv, acmd);
+	async_call_cb(acmd, buffer, ret, size);
+	vkil_free((void **)&acmd);
+}
+
+/**
+ * @brief hand a deposited response over to its asynchronous command
+ * @param async  asynchronous command
+ * @param msg_id msg_id of the response
+ */
+static void async_done(vkil_async *async, const int32_t msg_id)
+{
+	vkil_async_cmd *acmd = (vkil_async_cmd *)async;
+
+	acmd->msg_id = msg_id;
+	if (atomic_fetch_sub_explicit(&acmd->pending, 1,
+				      memory_order_acq_rel) == 1)
+		async_complete(acmd);
+}
+
+/**
+ * @brief issue a command, its completion being notified by a callback
+ * @param ctx_handle    handle to a vkil_context
+ * @param buffer_handle buffer of the command
+ * @param cmd           command, without VK_CMD_OPT_BLOCKING nor VK_CMD_OPT_CB
+ * @param fid           function of the command
+ * @param cb            completion callback
+ * @param cookie        passed to cb
+ * @return              zero on success, error code otherwise
+ */
+static int32_t submit_async(void *ctx_handle, void *buffer_handle,
+			    const vkil_command_t cmd, const uint32_t fid,
+			    vkil_done_cb cb, void *cookie)
+{
+	vkil_context *ilctx = ctx_handle;
+	vkil_context_internal *ilpriv;
+	vkil_async_cmd *acmd;
+	int32_t ret;
+
+	if (!ilctx || !ilctx->priv_data || !ilctx->devctx || !buffer_handle ||
+	    !cb || (cmd & (VK_CMD_OPT_BLOCKING | VK_CMD_OPT_CB)))
+		return -EINVAL;
+
+	/* someone has to read the driver for the response to show up */
+	ret = vkil_need_dispatcher(ilctx->devctx);
+	if (ret)
+		return ret;
+
+	ret = vkil_mallocz((void **)&acmd, sizeof(*acmd));
+	if (ret)
+		return ret;
+
+	acmd->async.done = async_done;
+	atomic_init(&acmd->pending, 2);
+	acmd->ilctx = ilctx;
+	acmd->buffer = buffer_handle;
+	acmd->cmd = cmd;
+	acmd->fid = fid;
+	acmd->cb = cb;
+	acmd->cookie = cookie;
+
+	ilpriv = ilctx->priv_data;
+	async_link(ilpriv, acmd);
+	if (fid == VK_FID_PROC_BUF)
+		ret = process_buffer(ilctx, buffer_handle, cmd, &acmd->async);
+	else
+		ret = transfer_buffer2(ilctx, buffer_handle, cmd, NULL,
+				       &acmd->async);
+	if (ret) {
+		async_unlink(ilpriv, acmd);
+		vkil_free((void **)&acmd);
+		return ret;
+	}
+
+	/*
+	 * the command is completed by whoever comes last, the submission
+	 * still accessing the buffer once the message is written
+	 */
+	if (atomic_fetch_sub_explicit(&acmd->pending, 1,
+				      memory_order_acq_rel) == 1)
+		async_complete(acmd);
+	return 0;
+}
+
+/**
+ * @brief process a buffer asynchronously
+ *
+ * the command is written as a non blocking process_buffer; once its response
+ * is deposited, the buffer is populated as a VK_CMD_OPT_CB call would, and
+ * the callback called with the command status. The device gets a completion
+ * dispatcher, reading the driver, if it hasn't any.
+ *
+ * a context issuing asynchronous commands shall not retrieve responses with
+ * VK_CMD_OPT_CB calls, which could get them first
+ *
+ * @param ctx_handle    handle to a vkil_context
+ * @param buffer_handle handle to the buffer to process, not to be accessed
+ *			until the callback is called
+ * @param cmd           command, without VK_CMD_OPT_BLOCKING nor VK_CMD_OPT_CB
+ * @param cb            callback, called only if zero is returned
+ * @param cookie        passed to cb
+ * @return              zero on success, error code otherwise; -EAGAIN if the
+ *			queue is full
+ */
+int vkil_process_buffer_async(void *ctx_handle, void *buffer_handle,
+			      const vkil_command_t cmd, vkil_done_cb cb,
+			      void *cookie)
+{
+	return submit_async(ctx_handle, buffer_handle, cmd, VK_FID_PROC_BUF,
+			    cb, cookie);
+}
+
+/**
+ * @brief transfer a buffer asynchronously
+ *
+ * as vkil_process_buffer_async, for a transfer_buffer command; the callback
+ * gets the number of bytes downloaded
+ *
+ * @param ctx_handle    handle to a vkil_context
+ * @param buffer_handle handle to the buffer to transfer, not to be accessed
+ *			until the callback is called
+ * @param cmd           transfer direction, without VK_CMD_OPT_BLOCKING nor
+ *			VK_CMD_OPT_CB
+ * @param cb            callback, called only if zero is returned
+ * @param cookie        passed to cb
+ * @return              zero on success, error code otherwise; -EAGAIN if the
+ *			queue is full
+ */
+int vkil_transfer_buffer_async(void *ctx_handle, void *buffer_handle,
+			       const vkil_command_t cmd, vkil_done_cb cb,
+			       void *cookie)
+{
+	return submit_async(ctx_handle, buffer_handle, cmd, VK_FID_TRANS_BUF,
+			    cb, cookie);
+}
+
 /**
  * @brief set the device to be used, configured by user CLI
  *
- * @param[in] device    id in ASCII format
+ * with VKIL_AFFINITY_AUTO, each new context is placed on the card with the
+ * most available load, the contexts of a process spreading over the cards
+ *
+ * @param[in] device    id in ASCII format, or VKIL_AFFINITY_AUTO
  * @return              zero on success, error code otherwise
  */
 int vkil_set_affinity(const char *device)
@@ -1523,7 +3101,7 @@ int vkil_set_affinity(const char *device)
 		 device ? device : "NULL");
 
 	/* check if device exists or not */
-	if (device) {
+	if (device && strcmp(device, VKIL_AFFINITY_AUTO)) {
 		if (!snprintf(dev_name, sizeof(dev_name),
 			      VKIL_DEV_DRV_NAME ".%s", device))
 			return -EINVAL;
@@ -1546,7 +3124,11 @@ int vkil_set_affinity(const char *device)
 /**
  * @brief set the processing priority, configured by user CLI
  *
- * @param[in] pri    priority in ASCII format
+ * the contexts created afterward use the queue of the priority lane, unless
+ * they have been given one. Until a priority is set, or after it is unset,
+ * they stay on queue 0
+ *
+ * @param[in] pri    priority in ASCII format, NULL to unset it
  * @return           zero on success, error code otherwise
  */
 int vkil_set_processing_pri(const char *pri)
@@ -1565,10 +3147,126 @@ int vkil_set_processing_pri(const char *pri)
 			return -EINVAL;
 
 		vkil_cfg.vkapi_processing_pri = val;
+	} else {
+		vkil_cfg.vkapi_processing_pri = VKIL_PROCESSING_PRI_UNSET;
+	}
+	return 0;
+}
+
+/**
+ * @brief set the completion mode, configured by user CLI
+ *
+ * in "caller" mode, the driver is read by the thread waiting for a
+ * completion; in "dispatcher" mode, a per device thread reads the driver and
+ * wakes up the waiting callers. The mode applies to devices opened afterward
+ *
+ * @param[in] mode   mode in ASCII format
+ * @return           zero on success, error code otherwise
+ */
+int vkil_set_completion_mode(const char *mode)
+{
+	static const char * const mode_tab[] = {"caller", "dispatcher"};
+	uint32_t val;
+
+	VKIL_LOG(VK_LOG_DEBUG, "Completion mode %s specified by user.",
+		 mode ? mode : "NULL");
+
+	if (mode) {
+		for (val = 0; val < ARRAY_SIZE(mode_tab); val++)
+			if (strcmp(mode, mode_tab[val]) == 0)
+				break;
+		if (val == ARRAY_SIZE(mode_tab))
+			return -EINVAL;
+
+		vkil_cfg.vkapi_cmpl_mode = val;
 	}
 	return 0;
 }
 
+/**
+ * @brief set the driver transport, configured by user CLI
+ *
+ * "sync" reads and writes the kernel driver directly; "io_uring" queues them
+ * to io_uring rings, and "io_uring_sqpoll" additionally has a kernel thread
+ * submitting the writes. The io_uring transports, built with
+ * --enable-io-uring, are never the default, and fall back to "sync" if not
+ * available. "model" loads the user space driver model (libvksim.so), and
+ * "model_ring" exchanges the messages with it through shared memory rings,
+ * falling back to "model" if it has none. "loopback" has an in process card
+ * complete all the commands right away.
+ * The transport applies to devices opened afterward, each device keeping
+ * the one it has been opened with
+ *
+ * @param[in] transport  transport in ASCII format
+ * @return               zero on success, error code otherwise
+ */
+int vkil_set_transport(const char *transport)
+{
+	static const char * const transport_tab[] = {"sync", "io_uring",
+						     "io_uring_sqpoll",
+						     "model", "loopback",
+						     "model_ring"};
+	uint32_t val;
+
+	VKIL_LOG(VK_LOG_DEBUG, "Transport %s specified by user.",
+		 transport ? transport : "NULL");
+
+	if (transport) {
+		for (val = 0; val < ARRAY_SIZE(transport_tab); val++)
+			if (strcmp(transport, transport_tab[val]) == 0)
+				break;
+		if (val == ARRAY_SIZE(transport_tab))
+			return -EINVAL;
+
+		vkil_cfg.vkapi_transport = val;
+	}
+	return 0;
+}
+
+/**
+ * @brief set the reaper of the stale responses
+ *
+ * the reaper applies to devices opened afterward
+ *
+ * @param[in] reaper  reaper, NULL to restore the default one
+ * @return            zero on success, error code otherwise
+ */
+int vkil_set_reaper(const vkil_reaper *reaper)
+{
+	static const vkil_reaper def_reaper = {
+		.timeout_ms = VKIL_REAP_TIMEOUT_MS
+	};
+
+	if (!reaper)
+		reaper = &def_reaper;
+
+	VKIL_LOG(VK_LOG_DEBUG, "Reaper timeout %u ms specified by user.",
+		 reaper->timeout_ms);
+	vkil_cfg.vkapi_reaper = *reaper;
+	return 0;
+}
+
+/**
+ * @brief set the high priority lane backlog deferring the low priority lane
+ *
+ * while the high priority lane has max messages in flight, the messages of
+ * the low priority lane are held back: a non blocking command fails with
+ * -EAGAIN, as on a full queue, and a blocking one waits. The backlog applies
+ * to devices opened afterward
+ *
+ * @param[in] max  messages in flight, zero to never defer the low lane
+ * @return         zero on success, error code otherwise
+ */
+int vkil_set_pri_backlog(const uint32_t max)
+{
+	if (max > VKIL_MSG_ID_MAX)
+		return -EINVAL;
+
+	VKIL_LOG(VK_LOG_DEBUG, "Priority backlog %u specified by user.", max);
+	vkil_cfg.vkapi_pri_backlog = max;
+	return 0;
+}
+
 /**
  * @brief set the log level, configured by user CLI
  *
@@ -1606,11 +3304,62 @@ const char *vkil_get_affinity(void)
 /**
  * @brief get the processing priority configured and used by user CLI
  *
- * @return  processing priority in numeric format
+ * @return  processing priority in numeric format, the default one if unset
  */
 uint32_t vkil_get_processing_pri(void)
+{
+	const uint32_t pri =
+		(vkil_cfg.vkapi_processing_pri == VKIL_PROCESSING_PRI_UNSET) ?
+		VKIL_DEF_PROCESSING_PRI : vkil_cfg.vkapi_processing_pri;
+
+	VKIL_LOG(VK_LOG_DEBUG, "Return %d chosen by user.", pri);
+	return pri;
+}
+
+/**
+ * @brief get the completion mode configured and used by user CLI
+ *
+ * @return  completion mode in numeric format
+ */
+uint32_t vkil_get_completion_mode(void)
 {
 	VKIL_LOG(VK_LOG_DEBUG, "Return %d chosen by user.",
-		 vkil_cfg.vkapi_processing_pri);
-	return vkil_cfg.vkapi_processing_pri;
+		 vkil_cfg.vkapi_cmpl_mode);
+	return vkil_cfg.vkapi_cmpl_mode;
+}
+
+/**
+ * @brief get the driver transport configured and used by user CLI
+ *
+ * @return  transport in numeric format
+ */
+uint32_t vkil_get_transport(void)
+{
+	VKIL_LOG(VK_LOG_DEBUG, "Return %d chosen by user.",
+		 vkil_cfg.vkapi_transport);
+	return vkil_cfg.vkapi_transport;
+}
+
+/**
+ * @brief get the reaper of the stale responses
+ *
+ * @return  reaper
+ */
+const vkil_reaper *vkil_get_reaper(void)
+{
+	VKIL_LOG(VK_LOG_DEBUG, "Return %u ms chosen by user.",
+		 vkil_cfg.vkapi_reaper.timeout_ms);
+	return &vkil_cfg.vkapi_reaper;
+}
+
+/**
+ * @brief get the high priority lane backlog deferring the low priority lane
+ *
+ * @return  messages in flight, zero for never
+ */
+uint32_t vkil_get_pri_backlog(void)
+{
+	VKIL_LOG(VK_LOG_DEBUG, "Return %u chosen by user.",
+		 vkil_cfg.vkapi_pri_backlog);
+	return vkil_cfg.vkapi_pri_backlog;
 }
@@ -32,6 +32,9 @@ typedef enum _vkil_buffer_type {
 	VKIL_BUF_MAX         = 0xF
 } vkil_buffer_type;
 
+/** affinity placing each new context on the least loaded card */
+#define VKIL_AFFINITY_AUTO "auto"
+
 /** default processing priority */
 #define VKIL_DEF_PROCESSING_PRI            1
 
@@ -152,6 +155,115 @@ typedef struct _vkil_aggregated_buffers {
 	vkil_buffer *buffer[VKIL_MAX_AGGREGATED_BUFFERS];
 } vkil_aggregated_buffers;
 
+/**
+ * @brief policy used to wait for a card response in blocking calls
+ *
+ * the response is first busy polled for up to spin_us, then polled while
+ * yielding the cpu for up to yield_us, and finally waited for without any
+ * cpu usage. The default policy (all zero) blocks right away.
+ *
+ * In adaptive mode, spin_us and yield_us are upper bounds; the actual
+ * durations are tuned from the response latency observed for each
+ * function_id, so that no cpu is burnt waiting for responses known to be
+ * slower than the budget
+ *
+ * A blocking call gives up after timeout_ms, failing with -ETIMEDOUT
+ */
+typedef struct _vkil_wait_policy {
+	uint32_t spin_us;  /**< busy polling duration, in us */
+	uint32_t yield_us; /**< yielding polling duration, in us */
+	uint32_t adaptive; /**< tune the polling from the observed latency */
+	uint32_t timeout_ms; /**< max wait, zero for the default (30 s) */
+} vkil_wait_policy;
+
+/**
+ * @brief quota of in flight messages of a context
+ *
+ * all the contexts opened on a device share its msg_ids; the reserved ones
+ * are set aside for the context, whatever the load of the other contexts.
+ * The default quota (all zero) is unlimited, without reservation
+ */
+typedef struct _vkil_msg_quota {
+	int32_t max;      /**< max in flight messages, 0 for no limit */
+	int32_t reserved; /**< in flight messages always granted */
+} vkil_msg_quota;
+
+/**
+ * @brief reaper of the stale responses
+ *
+ * a response not retrieved within timeout_ms of the submission of its
+ * command (e.g. a non blocking command never followed by its VK_CMD_OPT_CB
+ * call) is discarded, and its msg_id released
+ *
+ * the msg_id of a command given up on by a timed out call is released once
+ * its response comes, or, if it never does, once timeout_ms has elapsed
+ * (VKIL_REAP_TIMEOUT_MS if zero) since the call gave up
+ */
+typedef struct _vkil_reaper {
+	uint32_t timeout_ms; /**< 0 to keep the responses forever */
+	/**
+	 * called, if not NULL, on each discarded response by the thread
+	 * reading the driver, which shall not be blocked
+	 */
+	void (*reaped)(void *opaque, uint32_t context_id, uint32_t function_id,
+		       uint64_t user_data);
+	void *opaque; /**< passed to reaped */
+} vkil_reaper;
+
+/**
+ * @brief flow control state of a queue
+ *
+ * (limit - inflight) messages can be written before the queue is deemed full
+ */
+typedef struct _vkil_credits {
+	int32_t limit;    /**< max messages in flight, learnt from the driver */
+	int32_t inflight; /**< messages written, response not read yet */
+} vkil_credits;
+
+/**
+ * @brief completion callback of an asynchronous command
+ *
+ * called by the thread reading the driver, usually the device completion
+ * dispatcher, which shall not be blocked: the callback can issue non
+ * blocking commands, but no blocking ones. It can also be called by the
+ * thread issuing the command, before the asynchronous call returns, or by
+ * vkil_deinit, with -ETIMEDOUT, if the response didn't come in time.
+ * vkil_deinit is blocking, so it shall not be called from the callback, on
+ * any context: it fails there with -EDEADLK; a context is to be deinited
+ * once its last callback has returned, by another thread
+ * @param cookie cookie given with the command
+ * @param buffer buffer given with the command, populated from the response
+ * @param status zero on success, error code otherwise, as the blocking
+ *		 command would return
+ * @param size   bytes transferred by a download, zero otherwise
+ */
+typedef void (*vkil_done_cb)(void *cookie, void *buffer, int status,
+			     int32_t size);
+
+/**
+ * @brief completion ticket of a command written to the card
+ *
+ * to be treated as opaque, see vkil_get_ticket. The msg_id of a command is
+ * reused once its response is retrieved, the generation telling the uses
+ * apart. A ticket can be waited for as long as a context of its card is
+ * open; once the card device is closed, with the last of them, it is only
+ * reported as such (-ENODEV)
+ */
+typedef struct _vkil_ticket {
+	void *devctx;      /**< device the command has been written to */
+	uint32_t dev_serial; /**< opening of the device */
+	uint32_t queue_id; /**< queue of the command */
+	uint32_t msg_id;   /**< msg_id of the command, zero for none */
+	uint32_t gen;      /**< generation of the msg_id */
+} vkil_ticket;
+
+/**
+ * @brief process_buffer command pre-built for a context and a buffer shape
+ *
+ * opaque to the caller, see vkil_prepare_process_buffer
+ */
+typedef struct _vkil_prepared_cmd vkil_prepared_cmd;
+
 /**
  * @brief The vkil software context
  *
@@ -280,10 +392,47 @@ typedef struct _vkil_api {
 extern void *vkil_create_api(void);
 extern int vkil_destroy_api(void **ilapi);
 
+extern int vkil_set_wait_policy(void *ctx_handle,
+				const vkil_wait_policy *policy);
+extern int vkil_set_deadline(void *ctx_handle, const int64_t deadline_us);
+extern int vkil_set_msg_quota(void *ctx_handle, const vkil_msg_quota *quota);
+extern int vkil_get_retries_avoided(void *ctx_handle, uint64_t *count);
+extern int vkil_get_credits(void *ctx_handle, vkil_credits *credits);
+extern int vkil_get_reaped(void *ctx_handle, uint64_t *count);
+extern int vkil_get_event_fd(void *ctx_handle, int *fd);
+extern int vkil_batch_begin(void *ctx_handle);
+extern int vkil_batch_commit(void *ctx_handle);
+extern int vkil_prepare_process_buffer(void *ctx_handle,
+				       const void *buffer_handle,
+				       const vkil_command_t cmd,
+				       vkil_prepared_cmd **prepared);
+extern int vkil_submit_prepared(vkil_prepared_cmd *prepared,
+				void *buffer_handle);
+extern int vkil_release_prepared(vkil_prepared_cmd **prepared);
+extern int vkil_process_buffer_async(void *ctx_handle, void *buffer_handle,
+				     const vkil_command_t cmd,
+				     vkil_done_cb cb, void *cookie);
+extern int vkil_transfer_buffer_async(void *ctx_handle, void *buffer_handle,
+				      const vkil_command_t cmd,
+				      vkil_done_cb cb, void *cookie);
+extern int vkil_get_ticket(void *ctx_handle, vkil_ticket *ticket);
+extern int vkil_wait_any(const vkil_ticket *tickets, const int n,
+			 const int64_t deadline_us);
+extern int vkil_wait_all(const vkil_ticket *tickets, const int n,
+			 const int64_t deadline_us);
+extern int vkil_get_ticket_status(const vkil_ticket *ticket);
 extern int vkil_set_affinity(const char *device);
 extern int vkil_set_processing_pri(const char *pri);
 extern int vkil_set_log_level(const char *level);
+extern int vkil_set_completion_mode(const char *mode);
+extern int vkil_set_transport(const char *transport);
+extern int vkil_set_reaper(const vkil_reaper *reaper);
+extern int vkil_set_pri_backlog(const uint32_t max);
 extern const char *vkil_get_affinity(void);
 extern uint32_t vkil_get_processing_pri(void);
+extern uint32_t vkil_get_completion_mode(void);
+extern uint32_t vkil_get_transport(void);
+extern const vkil_reaper *vkil_get_reaper(void);
+extern uint32_t vkil_get_pri_backlog(void);
 
 #endif
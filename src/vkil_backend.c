@@ -7,38 +7,43 @@
  * @file
  * @brief backend vkil functions
  *
- * This file defines all the functions interfacing with the kernel driver;
- * including the opening and closing of it.
+ * This file defines all the functions interfacing with the driver, accessed
+ * through the transport of the device; including the opening and closing of
+ * it.
  *
  * It also implements all functions required for proper message handling from
  * the backend viewpoint, that is providing a unique message id, and handling
- * of the message read from the driver into an intermediate linked list
+ * of the message read from the driver into an intermediate completion table
  * the driver read message queue act as a FIFO, but the host need to read
  * messages in "random" order.
  */
 
 #include <errno.h>
-#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
 #include "vkil_api.h"
 #include "vkil_backend.h"
 #include "vkil_internal.h"
 #include "vkil_utils.h"
 
-#ifdef VKDRV_USERMODEL
-#include "../drv_model/vkdrv_access.h"
-#endif
-
-#define BIG_MSG_SIZE_INC   2
-/**
- * we should wait long enough to allow for non real time transcoding scheme
- * short enough to bail-out quickly on unresponsive card
- * if VKIL_TIMEOUT_MS is set to zero, wait can then be infinite.
- */
-#define VKIL_TIMEOUT_MS  (30 * 1000)
 /** in the ffmpeg context ms order to magnitude is OK */
 #define VKIL_PROBE_INTERVAL_MS 1
+/**
+ * a driver not implementing poll is reported as always readable; after this
+ * number of consecutive wake ups without message, we fall back to the
+ * periodic probing of the driver
+ */
+#define VKIL_POLL_SPURIOUS_MAX 8
+/** max time the dispatcher takes to acknowledge a stop request */
+#define VKIL_DISPATCH_POLL_MS 10
+/** period of the scan of the completion tables for stale responses */
+#define VKIL_REAP_PERIOD_MS 1000
 
 /*
  * this refers to the maximum number of intransit message into a single context
@@ -52,8 +57,74 @@
  * we prefer the the second option, since output of the HW need to be anyway
  * paired with input (for the passing of ancillary field, such as timestamp)
  * and so the mantenance of a list is a given
+ *
+ * the whole msg_id space is used, the allocation state being kept in a bitmap
+ * of VKIL_MSG_ID_WORDS 64 bits words
+ */
+#define MSG_LIST_SIZE VKIL_MSG_ID_MAX
+
+/** number of msg_ids which can be handed out, msg_id zero being reserved */
+#define MSG_ID_AVAIL (MSG_LIST_SIZE - 1)
+/** msg_ids set aside for the contexts, from a msgid_ctx budget */
+#define BUDGET_RESERVED(b) ((int32_t)((b) >> 32))
+/** shared msg_ids in use, from a msgid_ctx budget */
+#define BUDGET_SHARED(b) ((int32_t)((b) & 0xffffffff))
+
+/**
+ * @brief check if a msg_id is intransit
+ *
+ * @param  devctx device context
+ * @param  msg_id id to check
+ * @return non zero if the msg_id is in use
+ */
+static inline int32_t vkil_msg_id_used(vkil_devctx *devctx,
+				       const int32_t msg_id)
+{
+	_Atomic uint64_t *used = &devctx->msgid_ctx.used[msg_id / 64];
+	uint64_t word = atomic_load_explicit(used, memory_order_relaxed);
+
+	return !!(word & (1ULL << (msg_id % 64)));
+}
+
+/**
+ * @brief process wide registry of the callers waiting for tickets
+ *
+ * the tickets waited for can span several devices, so the waiters aren't
+ * attached to a device; the waiters count lets the completion path skip the
+ * registry lock when nobody waits
+ */
+static struct _vkil_tkt_registry {
+	pthread_mutex_t lock; /**< protect the list and the waiters state */
+	vkil_tkt_waiter *head; /**< waiting callers */
+	atomic_int n; /**< number of waiting callers */
+} vkil_tkt_waiters = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/**
+ * @brief wake up the callers waiting for the ticket of a msg_id
+ * @param[in] devctx device context
+ * @param[in] msg_id msg_id whose response has been deposited or retrieved
  */
-#define MSG_LIST_SIZE 256
+static void vkil_tkt_notify(vkil_devctx *devctx, const int32_t msg_id)
+{
+	vkil_tkt_waiter *waiter;
+	int32_t i;
+
+	/* pairs with the waiter registration, before it checks its tickets */
+	atomic_thread_fence(memory_order_seq_cst);
+	if (!atomic_load_explicit(&vkil_tkt_waiters.n, memory_order_relaxed))
+		return;
+
+	pthread_mutex_lock(&vkil_tkt_waiters.lock);
+	for (waiter = vkil_tkt_waiters.head; waiter; waiter = waiter->next)
+		for (i = 0; i < waiter->n; i++)
+			if ((waiter->tickets[i].devctx == devctx) &&
+			    (waiter->tickets[i].msg_id == msg_id)) {
+				waiter->signaled = 1;
+				pthread_cond_signal(&waiter->cond);
+				break;
+			}
+	pthread_mutex_unlock(&vkil_tkt_waiters.lock);
+}
 
 /**
  * @brief set user data for the msg_id
@@ -71,12 +142,34 @@ int32_t vkil_set_msg_user_data(vkil_devctx *devctx,
 	vkil_msg_id *msg_list = devctx->msgid_ctx.msg_list;
 
 	VK_ASSERT((msg_id >= 0) && (msg_id < MSG_LIST_SIZE));
-	VK_ASSERT(msg_list[msg_id].used);
+	VK_ASSERT(vkil_msg_id_used(devctx, msg_id));
 
 	msg_list[msg_id].user_data = user_data;
 	return 0;
 }
 
+/**
+ * @brief have the response to a msg_id handed to an asynchronous completion
+ *
+ * to be set before the message is written
+ * @param[in] devctx device context
+ * @param[in] msg    message
+ * @param[in] async  completion called once the response is deposited
+ * @return zero if success, error code otherwise
+ */
+int32_t vkil_set_msg_async(vkil_devctx *devctx, const host2vk_msg *msg,
+			   vkil_async *async)
+{
+	VK_ASSERT((msg->msg_id > 0) && (msg->msg_id < MSG_LIST_SIZE));
+	VK_ASSERT(vkil_msg_id_used(devctx, msg->msg_id));
+
+	async->msg_id = msg->msg_id;
+	async->queue_id = msg->queue_id;
+	async->context_id = msg->context_id;
+	devctx->msgid_ctx.msg_list[msg->msg_id].async = async;
+	return 0;
+}
+
 /**
  * @brief get user data froma message id
  * (including the HW, with the assigned msg_id
@@ -93,13 +186,247 @@ int32_t vkil_get_msg_user_data(vkil_devctx *devctx,
 	vkil_msg_id *msg_list = devctx->msgid_ctx.msg_list;
 
 	VK_ASSERT((msg_id >= 0) && (msg_id < MSG_LIST_SIZE));
-	VK_ASSERT(msg_list[msg_id].used);
+	VK_ASSERT(vkil_msg_id_used(devctx, msg_id));
 
 	*user_data = msg_list[msg_id].user_data;
 
 	return 0;
 }
 
+/**
+ * @brief account a msg_id about to be taken by a context
+ *
+ * @param  msgid_ctx message list context
+ * @param  acct      msg_id account of the context
+ * @return zero if the msg_id is set aside for the context, one if it is a
+ *	   shared one, -EAGAIN if the context is over quota or no shared
+ *	   msg_id is left
+ */
+static int32_t vkil_msg_account_get(vkil_msgid_ctx *msgid_ctx,
+				    vkil_msg_account *acct)
+{
+	uint64_t budget;
+	int32_t ret = 0;
+
+	pthread_mutex_lock(&acct->lock);
+	if (acct->max && (acct->inflight >= acct->max)) {
+		ret = -EAGAIN;
+		goto out;
+	}
+
+	if (acct->held < acct->reserved) {
+		acct->held++;
+	} else {
+		budget = atomic_load_explicit(&msgid_ctx->budget,
+					      memory_order_relaxed);
+		do {
+			if (BUDGET_RESERVED(budget) + BUDGET_SHARED(budget) >=
+			    MSG_ID_AVAIL) {
+				ret = -EAGAIN;
+				goto out;
+			}
+		} while (!atomic_compare_exchange_weak_explicit(
+				&msgid_ctx->budget, &budget, budget + 1,
+				memory_order_relaxed, memory_order_relaxed));
+		ret = 1;
+	}
+	acct->inflight++;
+
+out:
+	pthread_mutex_unlock(&acct->lock);
+	return ret;
+}
+
+/**
+ * @brief account a msg_id given back
+ *
+ * the account of a gone context is freed with its last msg_id
+ *
+ * @param  msgid_ctx message list context
+ * @param  entry     msg_list entry of the msg_id
+ */
+static void vkil_msg_account_put(vkil_msgid_ctx *msgid_ctx,
+				 const vkil_msg_id *entry)
+{
+	vkil_msg_account *acct = entry->owner;
+	int32_t release;
+
+	pthread_mutex_lock(&acct->lock);
+	acct->inflight--;
+	if (entry->shared) {
+		atomic_fetch_sub_explicit(&msgid_ctx->budget, 1,
+					  memory_order_relaxed);
+	} else {
+		acct->held--;
+		if (acct->charged > acct->reserved) {
+			/* set aside only until returned */
+			acct->charged--;
+			atomic_fetch_sub_explicit(&msgid_ctx->budget,
+						  1ULL << 32,
+						  memory_order_relaxed);
+		}
+	}
+	release = acct->detached && !acct->inflight;
+	pthread_mutex_unlock(&acct->lock);
+
+	if (release) {
+		pthread_mutex_destroy(&acct->lock);
+		vkil_free((void **)&acct);
+	}
+}
+
+/**
+ * @brief create a msg_id account, without quota
+ *
+ * @param[out] acct msg_id account
+ * @return zero on success, error code otherwise
+ */
+int32_t vkil_new_msg_account(vkil_msg_account **acct)
+{
+	int32_t ret;
+
+	ret = vkil_mallocz((void **)acct, sizeof(**acct));
+	if (ret)
+		return ret;
+
+	ret = pthread_mutex_init(&(*acct)->lock, NULL);
+	if (ret) {
+		vkil_free((void **)acct);
+		return -ret; /* error are forced to be negative */
+	}
+	return 0;
+}
+
+/**
+ * @brief set the msg_id quota of a context
+ *
+ * the msg_ids set aside for the context are taken from the shared ones, and
+ * so can't exceed the shared msg_ids currently unused. When the reservation
+ * is lowered, the msg_ids held beyond it stay set aside until returned
+ *
+ * @param  devctx   device context
+ * @param  acct     msg_id account of the context
+ * @param  max      max in flight messages, zero for no limit
+ * @param  reserved msg_ids to set aside for the context
+ * @return zero on success, error code otherwise
+ */
+int32_t vkil_set_msg_account(vkil_devctx *devctx, vkil_msg_account *acct,
+			     const int32_t max, const int32_t reserved)
+{
+	vkil_msgid_ctx *msgid_ctx = &devctx->msgid_ctx;
+	uint64_t budget, update;
+	int32_t rsv, charged, ret = 0;
+
+	if ((max < 0) || (reserved < 0) || (reserved > MSG_ID_AVAIL) ||
+	    (max && (max < reserved)))
+		return -EINVAL;
+
+	pthread_mutex_lock(&acct->lock);
+	charged = reserved > acct->held ? reserved : acct->held;
+	budget = atomic_load_explicit(&msgid_ctx->budget, memory_order_relaxed);
+	do {
+		rsv = BUDGET_RESERVED(budget) - acct->charged + charged;
+		if (rsv + BUDGET_SHARED(budget) > MSG_ID_AVAIL) {
+			ret = -ENOSPC;
+			goto out;
+		}
+		update = ((uint64_t)rsv << 32) | BUDGET_SHARED(budget);
+	} while (!atomic_compare_exchange_weak_explicit(&msgid_ctx->budget,
+							&budget, update,
+							memory_order_relaxed,
+							memory_order_relaxed));
+	acct->charged = charged;
+	acct->max = max;
+	acct->reserved = reserved;
+
+	VKIL_LOG(VK_LOG_DEBUG, "devctx=%p, acct=%p max %d reserved %d (%d)",
+		 devctx, acct, max, reserved, rsv);
+out:
+	pthread_mutex_unlock(&acct->lock);
+	return ret;
+}
+
+/**
+ * @brief detach a context from its msg_id account
+ *
+ * the msg_ids set aside for the context are given back; the account is
+ * freed right away if no msg_id is held anymore, otherwise along with the
+ * last one returned
+ *
+ * @param  devctx device context
+ * @param  acct   msg_id account of the context
+ */
+void vkil_detach_msg_account(vkil_devctx *devctx, vkil_msg_account *acct)
+{
+	int32_t release;
+
+	/* dropping the reservation never fails */
+	vkil_set_msg_account(devctx, acct, 0, 0);
+
+	pthread_mutex_lock(&acct->lock);
+	VKIL_LOG(VK_LOG_DEBUG, "devctx=%p, acct=%p: %d held msg_ids",
+		 devctx, acct, acct->inflight);
+	acct->detached = 1;
+	release = !acct->inflight;
+	pthread_mutex_unlock(&acct->lock);
+
+	if (release) {
+		pthread_mutex_destroy(&acct->lock);
+		vkil_free((void **)&acct);
+	}
+}
+
+/**
+ * @brief recycle a msg_id, recording if the response of its command is lost
+ *
+ * @param devctx device context
+ * @param msg_id id to recycle
+ * @param lost   the response is lost, discarded or never come
+ */
+static void vkil_put_msg_id(vkil_devctx *devctx, const int32_t msg_id,
+			    const int32_t lost)
+{
+	vkil_msg_id *entry = &devctx->msgid_ctx.msg_list[msg_id];
+	uint64_t bit, word;
+	uint32_t gen;
+
+	VK_ASSERT((msg_id > 0) && (msg_id < MSG_LIST_SIZE));
+
+	/* published along with the generation bump */
+	gen = atomic_load_explicit(&entry->gen, memory_order_relaxed);
+	bit = 1ULL << (gen % VKIL_LOST_GENS);
+	if (lost)
+		atomic_fetch_or_explicit(&entry->lost, bit,
+					 memory_order_relaxed);
+	else
+		atomic_fetch_and_explicit(&entry->lost, ~bit,
+					  memory_order_relaxed);
+
+	devctx->msgid_ctx.msg_list[msg_id].deadline_us = 0;
+	if (devctx->msgid_ctx.msg_list[msg_id].abandoned) {
+		devctx->msgid_ctx.msg_list[msg_id].abandoned = 0;
+		atomic_fetch_sub_explicit(&devctx->nabandoned, 1,
+					  memory_order_relaxed);
+	}
+	devctx->msgid_ctx.msg_list[msg_id].async = NULL;
+	atomic_fetch_add_explicit(&devctx->msgid_ctx.msg_list[msg_id].gen, 1,
+				  memory_order_seq_cst);
+	vkil_msg_account_put(&devctx->msgid_ctx,
+			     &devctx->msgid_ctx.msg_list[msg_id]);
+
+	/*
+	 * the release ordering guarantees the msg_list entry accesses are
+	 * completed before the msg_id can be handed out again
+	 */
+	bit = 1ULL << (msg_id % 64);
+	word = atomic_fetch_and_explicit(&devctx->msgid_ctx.used[msg_id / 64],
+					 ~bit, memory_order_release);
+	VK_ASSERT(word & bit);
+
+	/* a caller could wait for the ticket of a response already retrieved */
+	vkil_tkt_notify(devctx, msg_id);
+}
+
 /**
  * @brief Recycle a message id, indicate there is no more message in the
  * system; including the HW; with the assigned msg_id
@@ -110,56 +437,80 @@ int32_t vkil_get_msg_user_data(vkil_devctx *devctx,
  */
 int32_t vkil_return_msg_id(vkil_devctx *devctx, const int32_t msg_id)
 {
-	vkil_msg_id *msg_list = devctx->msgid_ctx.msg_list;
-
-	VK_ASSERT((msg_id >= 0) && (msg_id < MSG_LIST_SIZE));
-
-	VK_ASSERT(msg_list[msg_id].used);
-
-	msg_list[msg_id].used = 0;
+	vkil_put_msg_id(devctx, msg_id, 0);
 	return 0;
 }
 
+/**
+ * @brief recycle a msg_id whose response is lost, discarded or never come
+ *
+ * the tickets of its command then complete in error
+ * @param devctx device context
+ * @param msg_id id to recycle
+ */
+static void vkil_lose_msg_id(vkil_devctx *devctx, const int32_t msg_id)
+{
+	vkil_put_msg_id(devctx, msg_id, 1);
+}
+
 /**
  * @brief Get a unique message id
  *
+ * the msg_id is first accounted to the context, so that a context can't
+ * consume the msg_ids set aside for the others. The search then starts on
+ * the last bitmap word known to have free ids, so that in steady state the
+ * first word inspected provides an id
+ *
  * @param  devctx device context
+ * @param  acct   msg_id account of the requesting context
  * @return an unique msg_id if positive, error code otherwise
  */
-int32_t vkil_get_msg_id(vkil_devctx *devctx)
+int32_t vkil_get_msg_id(vkil_devctx *devctx, vkil_msg_account *acct)
 {
-	int32_t i, ret;
-	vkil_msg_id *msg_list;
+	vkil_msgid_ctx *msgid_ctx;
+	vkil_msg_id entry;
+	uint32_t i, w, start;
+	uint64_t word, bit;
+	int32_t msg_id, shared;
 
 	VK_ASSERT(devctx && devctx->msgid_ctx.msg_list);
-
-	msg_list = devctx->msgid_ctx.msg_list;
-	ret = pthread_mutex_lock(&(devctx->msgid_ctx.mwx));
-	if (ret)
-		goto fail;
-
-	/* msg_id zero is reserved */
-	for (i = 1; i < MSG_LIST_SIZE; i++) {
-		if (!msg_list[i].used) {
-			msg_list[i].used = 1;
-			break;
+	VK_ASSERT(acct);
+
+	msgid_ctx = &devctx->msgid_ctx;
+	shared = vkil_msg_account_get(msgid_ctx, acct);
+	if (shared < 0)
+		return shared;
+
+	start = atomic_load_explicit(&msgid_ctx->hint, memory_order_relaxed);
+	for (i = 0; i < VKIL_MSG_ID_WORDS; i++) {
+		w = (start + i) % VKIL_MSG_ID_WORDS;
+		word = atomic_load_explicit(&msgid_ctx->used[w],
+					    memory_order_relaxed);
+		while (~word) {
+			bit = ~word & (word + 1); /* lowest clear bit */
+			if (atomic_compare_exchange_weak_explicit(
+					&msgid_ctx->used[w], &word, word | bit,
+					memory_order_acquire,
+					memory_order_relaxed)) {
+				if (w != start)
+					atomic_store_explicit(
+						&msgid_ctx->hint, w,
+						memory_order_relaxed);
+				msg_id = w * 64 + __builtin_ctzll(bit);
+				msgid_ctx->msg_list[msg_id].owner = acct;
+				msgid_ctx->msg_list[msg_id].shared = shared;
+				return msg_id;
+			}
 		}
 	}
-	ret = pthread_mutex_unlock(&(devctx->msgid_ctx.mwx));
-	if (ret)
-		goto fail;
-
-	if (i >= MSG_LIST_SIZE) {
-		ret = ENOBUFS;
-		goto fail;
-	}
 
-	return i;
-
-fail:
+	/* not expected, the accounting bounding the msg_ids in use */
+	entry.owner = acct;
+	entry.shared = shared;
+	vkil_msg_account_put(msgid_ctx, &entry);
 	VKIL_LOG(VK_LOG_ERROR, "error %s(%d) in devctx %p",
-		 strerror(ret), ret, devctx);
-	return -ret; /* we always return negative error code if error */
+		 strerror(ENOBUFS), ENOBUFS, devctx);
+	return -ENOBUFS; /* we always return negative error code if error */
 }
 
 /**
@@ -170,18 +521,17 @@ fail:
  */
 static int32_t vkil_deinit_msglist(vkil_devctx *devctx)
 {
-	int32_t ret;
+	int32_t i;
 
-	vkil_free((void **)&devctx->msgid_ctx.msg_list);
-	ret = pthread_mutex_destroy(&(devctx->msgid_ctx.mwx));
-	if (ret)
-		goto fail;
+	/* the accounts of the gone contexts go with their msg_ids */
+	for (i = 1; devctx->msgid_ctx.msg_list && (i < MSG_LIST_SIZE); i++)
+		if (vkil_msg_id_used(devctx, i) &&
+		    devctx->msgid_ctx.msg_list[i].owner)
+			vkil_msg_account_put(&devctx->msgid_ctx,
+					     &devctx->msgid_ctx.msg_list[i]);
 
+	vkil_free((void **)&devctx->msgid_ctx.msg_list);
 	return 0;
-
-fail:
-	VKIL_LOG(VK_LOG_ERROR, "failure %s(%d)", strerror(ret), ret);
-	return -EPERM;
 }
 
 /**
@@ -192,16 +542,19 @@ fail:
  */
 static int32_t vkil_init_msglist(vkil_devctx *devctx)
 {
-	int32_t ret;
+	int32_t i, ret;
 
 	ret = vkil_mallocz((void **)&devctx->msgid_ctx.msg_list,
 			   sizeof(vkil_msg_id) * MSG_LIST_SIZE);
 	if (ret)
 		goto fail;
 
-	ret = pthread_mutex_init(&(devctx->msgid_ctx.mwx), NULL);
-	if (ret)
-		goto fail;
+	for (i = 0; i < VKIL_MSG_ID_WORDS; i++)
+		atomic_init(&devctx->msgid_ctx.used[i], 0);
+	/* msg_id zero is reserved */
+	atomic_init(&devctx->msgid_ctx.used[0], 1);
+	atomic_init(&devctx->msgid_ctx.hint, 0);
+	atomic_init(&devctx->msgid_ctx.budget, 0);
 
 	return 0;
 
@@ -212,452 +565,2277 @@ fail:
 }
 
 /**
- * @brief probe a driver for message up to VKIL_TIMEOUT_MS * wait_x
- * @param[in] driver to poll
- * @param[in|out] message returned on success
- * @param[in] max wait factor (=default_wait*wait_x, zero means no wait)
- * @return zero if success otherwise error message
+ * @brief wait for the driver to have a message to read
+ *
+ * the wait is done by polling the driver fd, so the caller is woken up as
+ * soon as a message is available. If the driver doesn't support it, this
+ * falls back to a sleep of VKIL_PROBE_INTERVAL_MS
+ * @param[in] devctx device context
+ * @param[in] timeout_ms max wait in ms, negative means infinite wait
+ * @return 1 if the driver reports a message to read, 0 otherwise
  */
-static ssize_t vkil_wait_probe_msg(int fd,
-				   vk2host_msg *msg,
-				   const uint32_t wait_x)
+static int32_t vkil_wait_fd(vkil_devctx *devctx, const int64_t timeout_ms)
 {
-	int32_t ret, nbytes, i = 0;
-	int32_t infinite_wait = (wait_x && (!VKIL_TIMEOUT_MS)) ? 1 : 0;
-
-	VK_ASSERT(msg);
-	VK_ASSERT(msg->size < UINT8_MAX);
-
-	nbytes = sizeof(*msg) * (msg->size + 1);
+	int32_t ret;
 
-	do {
-		ret = read(fd, msg, nbytes);
-		if (ret > 0)
+	if (devctx->poll_mode != VKIL_POLL_UNSUPPORTED) {
+		ret = devctx->tp->poll(devctx, (timeout_ms > INT_MAX) ?
+					       INT_MAX : (int)timeout_ms);
+		if (ret >= 0)
 			return ret;
+		if (ret == -EINTR)
+			return 0;
 
-#ifdef VKDRV_USERMODEL
-		/* in sw simulation only we don't use system errno */
-		if (ret == -EMSGSIZE)
-#else
-		if ((ret < 0) && (errno == EMSGSIZE))
-#endif
-			return -EMSGSIZE;
-		if (!wait_x)
-			return -ENOMSG;
-		usleep(1000 * VKIL_PROBE_INTERVAL_MS);
-		i++;
-	} while (i < ((wait_x * VKIL_TIMEOUT_MS) / VKIL_PROBE_INTERVAL_MS) ||
-		 infinite_wait);
+		VKIL_LOG(VK_LOG_WARNING,
+			 "poll not supported on devctx %p, use probing",
+			 devctx);
+		devctx->poll_mode = VKIL_POLL_UNSUPPORTED;
+		if (devctx->tp->rx_stop)
+			devctx->tp->rx_stop(devctx);
+	}
 
-	VKIL_LOG(VK_LOG_WARNING, "Hit timeout %d ms", wait_x * VKIL_TIMEOUT_MS);
-	return -ETIMEDOUT; /* if we are here we have timed out */
+	usleep(1000 * VKIL_PROBE_INTERVAL_MS);
+	return 0;
 }
 
 /**
- * @brief write a message to the device
- * @param devctx device context
- * @param message to write
- * @return 0 on success, error code otherwise
+ * @brief account a poll wake up without message to read
+ *
+ * after VKIL_POLL_SPURIOUS_MAX consecutive ones, poll is deemed unreliable
+ * @param[in] devctx device context
  */
-int32_t vkil_write(vkil_devctx * const devctx, host2vk_msg * const msg)
+static void vkil_poll_spurious(vkil_devctx *devctx)
 {
-	ssize_t ret;
+	if ((++devctx->poll_spurious >= VKIL_POLL_SPURIOUS_MAX) &&
+	    (devctx->poll_mode != VKIL_POLL_UNSUPPORTED)) {
+		VKIL_LOG(VK_LOG_WARNING,
+			 "poll unreliable on devctx %p, use probing", devctx);
+		devctx->poll_mode = VKIL_POLL_UNSUPPORTED;
+		if (devctx->tp->rx_stop)
+			devctx->tp->rx_stop(devctx);
+	}
+}
 
-	ret = write(devctx->fd, msg, sizeof(*msg) * (msg->size + 1));
-	/* on error, driver returns -1 and the error is stored in errno */
-	if (ret < 0)
-		return -errno;
+/**
+ * @brief account the response latency of a message into the function stat
+ * @param[in] devctx device context
+ * @param[in] msg response message
+ * @param[in] now time the message has been received
+ */
+static void vkil_lat_update(vkil_devctx *devctx, const vk2host_msg *msg,
+			    const int64_t now)
+{
+	vkil_msg_id *entry = &devctx->msgid_ctx.msg_list[msg->msg_id];
+	int64_t sample, err, mean, dev;
+	vkil_lat_stat *lat;
+
+	if (!msg->msg_id || !entry->submit_us ||
+	    (entry->function_id >= VK_FID_MAX))
+		return;
+
+	/* same gains as the TCP round trip time estimator */
+	lat = &devctx->lat[entry->function_id];
+	sample = now - entry->submit_us;
+	mean = atomic_load_explicit(&lat->mean_us, memory_order_relaxed);
+	dev = atomic_load_explicit(&lat->dev_us, memory_order_relaxed);
+	if (!mean) {
+		mean = sample ? sample : 1;
+		dev = sample / 2;
+	} else {
+		err = sample - mean;
+		mean += err / 8;
+		dev += (((err < 0) ? -err : err) - dev) / 4;
+	}
+	/* a waiter reading both in between gets a slightly off estimate */
+	atomic_store_explicit(&lat->mean_us, mean, memory_order_relaxed);
+	atomic_store_explicit(&lat->dev_us, dev, memory_order_relaxed);
+}
 
-	return 0;
+/**
+ * @brief compute how long to poll for a message before blocking on it
+ *
+ * in adaptive mode, the polling stops at the expected response time of the
+ * message (derived from the latency statistic of its function), and there is
+ * no polling at all if that time is beyond the policy budget
+ * @param[in] devctx device context
+ * @param[in] message message waited for
+ * @param[in] policy wait policy
+ * @param[out] spin_end_us end of the busy polling
+ * @param[out] yield_end_us end of the yield polling
+ */
+static void vkil_wait_budget(vkil_devctx *devctx,
+			     const vk2host_msg *message,
+			     const vkil_wait_policy *policy,
+			     int64_t *spin_end_us,
+			     int64_t *yield_end_us)
+{
+	int64_t now, spin, yield, remaining, mean = 0;
+	vkil_msg_id *entry;
+	vkil_lat_stat *lat;
+
+	*spin_end_us = 0;
+	*yield_end_us = 0;
+	if (!policy || (!policy->spin_us && !policy->yield_us))
+		return;
+
+	now = vkil_get_time_us();
+	spin = policy->spin_us;
+	yield = policy->yield_us;
+	entry = &devctx->msgid_ctx.msg_list[message->msg_id];
+	if (policy->adaptive && message->msg_id &&
+	    (entry->function_id < VK_FID_MAX)) {
+		lat = &devctx->lat[entry->function_id];
+		mean = atomic_load_explicit(&lat->mean_us,
+					    memory_order_relaxed);
+	}
+	if (mean) {
+		/* pessimistic estimate of the time left before the response */
+		remaining = entry->submit_us + mean +
+			    4 * atomic_load_explicit(&lat->dev_us,
+						     memory_order_relaxed) -
+			    now;
+		if (remaining > spin + yield) {
+			spin = 0;
+			yield = 0;
+		} else {
+			remaining = MAX(remaining, 0);
+			spin = MIN(spin, remaining);
+			yield = MIN(yield, remaining - spin);
+		}
+	}
+	*spin_end_us = now + spin;
+	*yield_end_us = now + spin + yield;
 }
 
 /**
- * @brief compare vk2host_msg::msg_id
- * @param first message to compare
- * @param second message to compare
- * @return 0 if matching, error code otherwise
+ * @brief record the submission of a message in its msg_id entry
+ * @param[in] devctx device context
+ * @param[in] msg message about to be written
+ * @param[in] now submission time
  */
-static int32_t cmp_msg_id(const void *data, const void *data_ref)
+static void vkil_msg_submit(vkil_devctx *devctx, const host2vk_msg *msg,
+			    const int64_t now)
 {
-	const vk2host_msg *msg = data;
-	const vk2host_msg *msg_ref = data_ref;
+	vkil_msg_id *entry = &devctx->msgid_ctx.msg_list[msg->msg_id];
 
-	if (msg->msg_id == msg_ref->msg_id)
-		return 0;
+	/* the credit taken is given back by the response to the msg_id */
+	atomic_fetch_add_explicit(&entry->credits, 1, memory_order_release);
 
-	return -EINVAL;
+	/* msg_id 0 is shared by all the messages without response tracking */
+	if (!msg->msg_id)
+		return;
+
+	entry->submit_us = now;
+	entry->function_id = msg->function_id;
+	entry->deadline_us = devctx->reaper.timeout_ms ?
+			     now + devctx->reaper.timeout_ms * 1000LL : 0;
 }
 
 /**
- * @brief compare vk2host_msg::function_id
- * @param first message to compare
- * @param second message to compare
- * @return 0 if matching, error code otherwise
+ * @brief drop the credit recorded by vkil_msg_submit, the message not
+ * having been written
+ * @param[in] devctx device context
+ * @param[in] msg message not written
  */
-static int32_t cmp_function(const void *data, const void *data_ref)
+static void vkil_msg_unsubmit(vkil_devctx *devctx, const host2vk_msg *msg)
 {
-	const vk2host_msg *msg = data;
-	const vk2host_msg *msg_ref = data_ref;
+	vkil_msg_id *entry = &devctx->msgid_ctx.msg_list[msg->msg_id];
 
-	/*
-	 * checking order doesn't matter but for efficiency we check from the
-	 * least probable to the most
-	 */
-	if (msg->function_id == msg_ref->function_id)
-		/* The message need to belong to the same context */
-		if (msg->context_id == msg_ref->context_id)
-			return 0;
+	atomic_fetch_sub_explicit(&entry->credits, 1, memory_order_relaxed);
+}
 
-	return -EINVAL;
+/**
+ * @brief take the credit held by a message whose response has been read
+ * @param[in] entry msg_id entry of the response
+ * @return non zero if a credit was held, to be given back to the queue
+ */
+static int32_t vkil_msg_uncharge(vkil_msg_id *entry)
+{
+	int32_t credits = atomic_load_explicit(&entry->credits,
+					       memory_order_acquire);
+
+	/* a response to a message not written by us holds no credit */
+	do {
+		if (credits <= 0)
+			return 0;
+	} while (!atomic_compare_exchange_weak_explicit(&entry->credits,
+							&credits,
+							credits - 1,
+							memory_order_acquire,
+							memory_order_acquire));
+	return 1;
 }
 
 /**
- * @brief retrieve a message from a linked list
+ * @brief take credits to write messages to a queue
  *
- * if it belongs to the only node in the list, the list will be deleted
- * @param[in|out] handle to the linked list
- * @param[in] where to write the read message,
- *	@li if a vk2host_msg::msg_id is provided, will extract only a message
- *	    matching the provided vk2host_msg::msg_id
- *	@li otherwise return message matching the provided
- *	    vk2host_msg::function_id
- * @return 0 if success, error code otherwise
+ * credits are always granted to a queue without message in flight, so that a
+ * queue is never stalled
+ * @param[in] cr queue credits
+ * @param[in] n number of messages to write
+ * @return number of messages in flight before the credits were taken,
+ *	   -EAGAIN if not enough credits are left
  */
-static int32_t retrieve_message(vkil_node **pvk2host_ll, vk2host_msg *message)
+static int32_t vkil_credit_get(vkil_credit *cr, const int32_t n)
 {
-	int msglen;
-	int32_t ret = 0;
-	vk2host_msg *msg;
-	vkil_node *node = NULL;
-	vkil_node *vk2host_ll = *pvk2host_ll;
-
-	/*
-	 * this function need to be called with
-	 * pthread_mutex_lock(&devctx->mwx);
-	 *
-	 * the caller function is here expected to lock/unlock the mutex
-	 */
+	int32_t inflight = atomic_load_explicit(&cr->inflight,
+						memory_order_relaxed);
 
-	if (!vk2host_ll) {
-		/* the list is empty, no message try later */
-		ret = -EAGAIN; /* message is not there yet */
-		goto out;
-	}
+	do {
+		if (inflight && (inflight + n > atomic_load_explicit(&cr->limit,
+						       memory_order_relaxed)))
+			return -EAGAIN;
+	} while (!atomic_compare_exchange_weak_explicit(&cr->inflight,
+							&inflight,
+							inflight + n,
+							memory_order_relaxed,
+							memory_order_relaxed));
+	return inflight;
+}
 
-	if (message->msg_id) /* search msg_id */
-		node = vkil_ll_search(vk2host_ll, cmp_msg_id, message);
-	else /* no msg_id set, search by function all msg non tagged blocking */
-		node = vkil_ll_search(vk2host_ll, cmp_function, message);
+/**
+ * @brief give credits back
+ * @param[in] cr queue credits
+ * @param[in] n number of credits
+ */
+static void vkil_credit_put(vkil_credit *cr, const int32_t n)
+{
+	int32_t inflight = atomic_load_explicit(&cr->inflight,
+						memory_order_relaxed);
 
-	if (!node) {
-		ret = -EAGAIN; /* message is not there yet */
-		goto out;
-	}
+	/* a response can't give back a credit it has not taken */
+	do {
+		if (!inflight)
+			return;
+	} while (!atomic_compare_exchange_weak_explicit(&cr->inflight,
+							&inflight,
+							MAX(inflight - n, 0),
+							memory_order_relaxed,
+							memory_order_relaxed));
+}
 
-	msg = node->data;
+/**
+ * @brief account a response read from the driver
+ * @param[in] cr credits of the queue the message has been written on
+ */
+static void vkil_credit_ack(vkil_credit *cr)
+{
+	int32_t limit = atomic_load_explicit(&cr->limit, memory_order_relaxed);
+
+	vkil_credit_put(cr, 1);
+	if ((limit < VKIL_CREDIT_MAX) &&
+	    (atomic_fetch_add_explicit(&cr->acked, 1,
+				       memory_order_relaxed) + 1 >= limit)) {
+		atomic_store_explicit(&cr->acked, 0, memory_order_relaxed);
+		atomic_compare_exchange_strong_explicit(&cr->limit, &limit,
+							limit + 1,
+							memory_order_relaxed,
+							memory_order_relaxed);
+	}
+}
+
+/**
+ * @brief learn the driver queue depth from the driver reporting it full
+ * @param[in] devctx device context
+ * @param[in] q_id queue reported full
+ * @param[in] inflight messages in flight when the write got rejected
+ */
+static void vkil_credit_full(vkil_devctx *devctx, const int32_t q_id,
+			     const int32_t inflight)
+{
+	vkil_credit *cr = &devctx->q[q_id].credit;
+	int32_t limit = MAX(inflight, VKIL_CREDIT_MIN);
+
+	atomic_store_explicit(&cr->limit, limit, memory_order_relaxed);
+	atomic_store_explicit(&cr->acked, 0, memory_order_relaxed);
+	VKIL_LOG(VK_LOG_DEBUG, "devctx=%p queue %d full, limit %d credits",
+		 devctx, q_id, limit);
+}
+
+/**
+ * @brief check if the low priority lane is to hold its messages back
+ *
+ * the low lane waits while the high lane has pri_backlog messages in flight
+ * @param[in] devctx device context
+ * @param[in] q_id queue of the message to write
+ * @return non zero if the message is to be deferred
+ */
+static inline int32_t vkil_lane_deferred(vkil_devctx *devctx,
+					 const int32_t q_id)
+{
+	vkil_credit *cr = &devctx->q[VKIL_PRI_HIGH_Q].credit;
+
+	return devctx->pri_backlog && (q_id == VKIL_PRI_LOW_Q) &&
+	       (atomic_load_explicit(&cr->inflight, memory_order_relaxed) >=
+		devctx->pri_backlog);
+}
+
+/**
+ * @brief write a message to the device
+ *
+ * the message is not written if its queue has no credit left, or if it is
+ * deferred by the high priority lane
+ * @param devctx device context
+ * @param message to write
+ * @return 0 on success, -EAGAIN if the queue is full, other error code
+ *	   otherwise
+ */
+int32_t vkil_write(vkil_devctx * const devctx, host2vk_msg * const msg)
+{
+	struct iovec iov = {msg, sizeof(*msg) * (msg->size + 1)};
+	ssize_t ret;
+	vkil_credit *cr;
+	int32_t inflight;
+
+	VK_ASSERT(msg->queue_id < VKIL_MSG_Q_MAX);
+
+	if (vkil_lane_deferred(devctx, msg->queue_id))
+		return -EAGAIN;
+
+	cr = &devctx->q[msg->queue_id].credit;
+	inflight = vkil_credit_get(cr, 1);
+	if (inflight < 0)
+		return inflight;
+
+	vkil_msg_submit(devctx, msg, vkil_get_time_us());
+
+	ret = devctx->tp->submit(devctx, &iov, 1);
+	if (ret < 0) {
+		vkil_msg_unsubmit(devctx, msg);
+		vkil_credit_put(cr, 1);
+		if (ret == -EAGAIN)
+			vkil_credit_full(devctx, msg->queue_id, inflight);
+		return ret;
+	}
+	return 0;
+}
+
+/**
+ * @brief write several messages to the device in a single system call
+ *
+ * a driver taking a single message per write gets them one after the other
+ * @param devctx device context
+ * @param blk messages to write, stored back to back
+ * @param nmsgs number of messages
+ * @return number of messages written if positive, error code otherwise
+ */
+int32_t vkil_writev(vkil_devctx * const devctx, host2vk_msg * const blk,
+		    const int32_t nmsgs)
+{
+	struct iovec iov[VKIL_BATCH_MAX_BLKS];
+	int32_t n[VKIL_MSG_Q_MAX] = {0}, inflight[VKIL_MSG_Q_MAX];
+	host2vk_msg *msg;
+	int64_t now;
+	ssize_t ret;
+	int32_t i, q;
+
+	VK_ASSERT(nmsgs <= VKIL_BATCH_MAX_BLKS);
+
+	for (i = 0, msg = blk; i < nmsgs; i++, msg += msg->size + 1) {
+		VK_ASSERT(msg->queue_id < VKIL_MSG_Q_MAX);
+		n[msg->queue_id]++;
+	}
+	if (n[VKIL_PRI_LOW_Q] && vkil_lane_deferred(devctx, VKIL_PRI_LOW_Q))
+		return -EAGAIN;
+	for (q = 0; q < VKIL_MSG_Q_MAX; q++) {
+		inflight[q] = n[q] ? vkil_credit_get(&devctx->q[q].credit,
+						     n[q]) : 0;
+		if (inflight[q] < 0) {
+			while (q--)
+				vkil_credit_put(&devctx->q[q].credit, n[q]);
+			return -EAGAIN;
+		}
+	}
+
+	now = vkil_get_time_us();
+	msg = blk;
+	for (i = 0; i < nmsgs; i++) {
+		vkil_msg_submit(devctx, msg, now);
+		iov[i].iov_base = msg;
+		iov[i].iov_len = sizeof(*msg) * (msg->size + 1);
+		msg += msg->size + 1;
+	}
+
+	ret = devctx->tp->submit(devctx, iov, nmsgs);
+	if (ret < 0) {
+		for (i = 0; i < nmsgs; i++)
+			vkil_msg_unsubmit(devctx, iov[i].iov_base);
+		for (q = 0; q < VKIL_MSG_Q_MAX; q++) {
+			if (!n[q])
+				continue;
+			vkil_credit_put(&devctx->q[q].credit, n[q]);
+			if (ret == -EAGAIN)
+				vkil_credit_full(devctx, q, inflight[q]);
+		}
+		return ret;
+	}
+
+	/* a short write stops on a message boundary */
+	for (i = 0; i < nmsgs; i++) {
+		if (ret < (ssize_t)iov[i].iov_len)
+			break;
+		ret -= iov[i].iov_len;
+		q = ((host2vk_msg *)iov[i].iov_base)->queue_id;
+		n[q]--;
+		inflight[q]++;
+	}
+
+	/* most likely, the queue of the first message not written is full */
+	if (i < nmsgs) {
+		q = ((host2vk_msg *)iov[i].iov_base)->queue_id;
+		vkil_credit_full(devctx, q, inflight[q]);
+		for (q = i; q < nmsgs; q++)
+			vkil_msg_unsubmit(devctx, iov[q].iov_base);
+		for (q = 0; q < VKIL_MSG_Q_MAX; q++)
+			if (n[q])
+				vkil_credit_put(&devctx->q[q].credit, n[q]);
+	}
+	return i;
+}
+
+/**
+ * @brief compare vk2host_msg::function_id
+ * @param first message to compare
+ * @param second message to compare
+ * @return 0 if matching, error code otherwise
+ */
+static int32_t cmp_function(const void *data, const void *data_ref)
+{
+	const vk2host_msg *msg = data;
+	const vk2host_msg *msg_ref = data_ref;
+
+	/*
+	 * checking order doesn't matter but for efficiency we check from the
+	 * least probable to the most
+	 */
+	if (msg->function_id == msg_ref->function_id)
+		/* The message need to belong to the same context */
+		if (msg->context_id == msg_ref->context_id)
+			return 0;
+
+	return -EINVAL;
+}
+
+/**
+ * @brief size classes of the message pool, and number of objects in each
+ *
+ * most of the responses are a single vk2host_msg, the largest class holding
+ * the largest expected response
+ */
+static const struct {
+	int32_t max_size; /**< max vk2host_msg::size */
+	uint32_t count;
+} vkil_pool_cfg[VKIL_POOL_CLASSES] = {
+	{ 0,                         512 },
+	{ 3,                         128 },
+	{ VKIL_RET_MSG_MAX_SIZE - 1, 64  },
+};
+
+/** message pool objects are aligned on a cache line */
+#define VKIL_POOL_ALIGN 64
+
+/**
+ * @brief de-initialize a message pool
+ *
+ * all objects are expected to have been returned to the pool
+ * @param[in,out] pool message pool
+ */
+static void vkil_pool_deinit(vkil_msg_pool *pool)
+{
+	int32_t i;
+
+	for (i = 0; i < VKIL_POOL_CLASSES; i++)
+		vkil_free((void **)&pool->cls[i].slab);
+}
+
+/**
+ * @brief initialize a message pool
+ * @param[in,out] pool message pool
+ * @return zero on success, error code otherwise
+ */
+static int32_t vkil_pool_init(vkil_msg_pool *pool)
+{
+	vkil_pool_class *cls;
+	vkil_cmpl_node *node;
+	uint32_t i, j, size;
+	int32_t ret;
+
+	for (i = 0; i < VKIL_POOL_CLASSES; i++) {
+		cls = &pool->cls[i];
+		size = sizeof(*node) +
+		       sizeof(vk2host_msg) * (vkil_pool_cfg[i].max_size + 1);
+		cls->obj_size = (size + VKIL_POOL_ALIGN - 1) &
+				~(VKIL_POOL_ALIGN - 1);
+		cls->max_size = vkil_pool_cfg[i].max_size;
+		ret = posix_memalign((void **)&cls->slab, VKIL_POOL_ALIGN,
+				     cls->obj_size * vkil_pool_cfg[i].count);
+		if (ret) {
+			ret = -ret;
+			goto fail;
+		}
+
+		/* chain all the objects in the free list */
+		for (j = 0; j < vkil_pool_cfg[i].count; j++) {
+			node = (vkil_cmpl_node *)
+			       (cls->slab + j * cls->obj_size);
+			node->msg = (vk2host_msg *)(node + 1);
+			node->pool_cls = i;
+			atomic_init(&node->pool_next,
+				    (j + 1 < vkil_pool_cfg[i].count) ?
+				    j + 2 : 0);
+		}
+		atomic_init(&cls->head, 1);
+	}
+	return 0;
+
+fail:
+	vkil_pool_deinit(pool);
+	VKIL_LOG(VK_LOG_ERROR, "failure %s(%d)", strerror(-ret), ret);
+	return ret;
+}
+
+/**
+ * @brief get a node able to hold a message from a message pool
+ *
+ * if the class is exhausted, or the message is larger than any class, the
+ * node is allocated on the heap. The node links and the message header are
+ * cleared
+ * @param[in,out] pool message pool
+ * @param[in] size vk2host_msg::size of the message to hold
+ * @return node if success, NULL otherwise
+ */
+static vkil_cmpl_node *vkil_pool_get(vkil_msg_pool *pool, const int32_t size)
+{
+	vkil_pool_class *cls;
+	vkil_cmpl_node *node;
+	uint64_t head, next;
+	int32_t i;
+
+	for (i = 0; i < VKIL_POOL_CLASSES; i++) {
+		cls = &pool->cls[i];
+		if (size > cls->max_size)
+			continue;
+
+		head = atomic_load_explicit(&cls->head, memory_order_acquire);
+		while ((uint32_t)head) {
+			node = (vkil_cmpl_node *)(cls->slab + cls->obj_size *
+						  ((uint32_t)head - 1));
+			/*
+			 * the node can be concurrently popped and reused, in
+			 * which case the head tag has changed and the CAS fails
+			 */
+			next = atomic_load_explicit(&node->pool_next,
+						    memory_order_relaxed);
+			next |= ((head >> 32) + 1) << 32;
+			if (atomic_compare_exchange_weak_explicit(
+					&cls->head, &head, next,
+					memory_order_acquire,
+					memory_order_acquire))
+				goto out;
+		}
+		break;
+	}
+
+	if (vkil_malloc((void **)&node,
+			sizeof(*node) + sizeof(vk2host_msg) * (size + 1)))
+		return NULL;
+	node->msg = (vk2host_msg *)(node + 1);
+	node->pool_cls = VKIL_POOL_HEAP;
+
+out:
+	node->id_next = NULL;
+	node->fn_prev = NULL;
+	node->fn_next = NULL;
+	/*
+	 * a recycled node still holds the message it was returned with; its
+	 * header is cleared, as it was when each node was freshly allocated
+	 */
+	memset(node->msg, 0, sizeof(*node->msg));
+	return node;
+}
+
+/**
+ * @brief return a node to its message pool
+ * @param[in,out] pool message pool
+ * @param[in] node to return
+ */
+static void vkil_pool_put(vkil_msg_pool *pool, vkil_cmpl_node *node)
+{
+	vkil_pool_class *cls;
+	uint64_t head, next;
+	uint32_t index;
+
+	if (node->pool_cls == VKIL_POOL_HEAP) {
+		vkil_free((void **)&node);
+		return;
+	}
+
+	cls = &pool->cls[node->pool_cls];
+	index = ((uint8_t *)node - cls->slab) / cls->obj_size + 1;
+	head = atomic_load_explicit(&cls->head, memory_order_relaxed);
+	do {
+		atomic_store_explicit(&node->pool_next, (uint32_t)head,
+				      memory_order_relaxed);
+		next = (((head >> 32) + 1) << 32) | index;
+	} while (!atomic_compare_exchange_weak_explicit(&cls->head, &head,
+							next,
+							memory_order_release,
+							memory_order_relaxed));
+}
+
+/**
+ * @brief get the (context_id, function_id) bucket of a message
+ * @param table completion table
+ * @param msg message to hash
+ * @return bucket the message belongs to
+ */
+static inline vkil_cmpl_bucket *cmpl_fn_bucket(vkil_cmpl_table *table,
+					       const vk2host_msg *msg)
+{
+	/* multiplicative hashing, the upper bits being the most mixed ones */
+	uint32_t hash = (msg->context_id ^ (msg->function_id << 24)) *
+			0x9E3779B1;
+
+	return &table->by_fn[(hash >> 16) % VKIL_CMPL_FN_BUCKETS];
+}
+
+/**
+ * @brief deposit a message into a completion table
+ * @param[in,out] table completion table
+ * @param[in] node holding the message to deposit
+ */
+static void cmpl_insert(vkil_cmpl_table *table, vkil_cmpl_node *node)
+{
+	vkil_cmpl_bucket *bucket;
+	vkil_cmpl_node **pnode;
+
+	/*
+	 * a msg_id is unique among intransit messages, so the chain is
+	 * expected to be empty; it is walked only if the card returns several
+	 * messages for the same msg_id
+	 */
+	pnode = &table->by_id[node->msg->msg_id];
+	while (*pnode)
+		pnode = &(*pnode)->id_next;
+	*pnode = node;
+
+	bucket = cmpl_fn_bucket(table, node->msg);
+	node->fn_prev = bucket->tail;
+	if (bucket->tail)
+		bucket->tail->fn_next = node;
+	else
+		bucket->head = node;
+	bucket->tail = node;
+}
+
+/**
+ * @brief remove a node from a completion table
+ * @param[in,out] table completion table
+ * @param[in] node to remove
+ */
+static void cmpl_remove(vkil_cmpl_table *table, vkil_cmpl_node *node)
+{
+	vkil_cmpl_bucket *bucket = cmpl_fn_bucket(table, node->msg);
+	vkil_cmpl_node **pnode = &table->by_id[node->msg->msg_id];
+
+	while (*pnode != node)
+		pnode = &(*pnode)->id_next;
+	*pnode = node->id_next;
+
+	if (node->fn_prev)
+		node->fn_prev->fn_next = node->fn_next;
+	else
+		bucket->head = node->fn_next;
+	if (node->fn_next)
+		node->fn_next->fn_prev = node->fn_prev;
+	else
+		bucket->tail = node->fn_prev;
+}
+
+/**
+ * @brief look up a message in a completion table
+ * @param[in] table completion table
+ * @param[in] message reference message
+ *	@li if a vk2host_msg::msg_id is provided, look for the message
+ *	    matching the provided vk2host_msg::msg_id
+ *	@li otherwise look for the oldest message matching the provided
+ *	    vk2host_msg::function_id and vk2host_msg::context_id
+ * @return node holding the message if found, NULL otherwise
+ */
+static vkil_cmpl_node *cmpl_search(vkil_cmpl_table *table,
+				   const vk2host_msg *message)
+{
+	vkil_cmpl_node *node;
+
+	if (message->msg_id)
+		return table->by_id[message->msg_id];
+
+	node = cmpl_fn_bucket(table, message)->head;
+	while (node && cmp_function(node->msg, message))
+		node = node->fn_next;
+
+	return node;
+}
+
+/**
+ * @brief return all messages held in a completion table to their pool
+ * @param[in,out] table completion table
+ * @param[in,out] pool message pool
+ */
+static void cmpl_flush(vkil_cmpl_table *table, vkil_msg_pool *pool)
+{
+	vkil_cmpl_node *node;
+	int32_t i;
+
+	for (i = 0; i < VKIL_CMPL_FN_BUCKETS; i++) {
+		while ((node = table->by_fn[i].head)) {
+			cmpl_remove(table, node);
+			vkil_pool_put(pool, node);
+		}
+	}
+}
+
+/**
+ * @brief get the size of the buffer to retrieve a response in
+ *
+ * @param  devctx device context
+ * @param  fid    function id of the response
+ * @param  role   role of the context retrieving the response
+ * @param  size   expected response size, in vk2host_msg::size unit
+ * @return the max of the expected size and of the largest response seen
+ */
+int32_t vkil_get_resp_size(vkil_devctx *devctx, const uint32_t fid,
+			   const uint32_t role, const int32_t size)
+{
+	int32_t seen;
+
+	VK_ASSERT((fid < VK_FID_MAX) && (role < VKIL_ROLE_NR));
+
+	seen = atomic_load_explicit(&devctx->resp.size[fid][role],
+				    memory_order_relaxed);
+	return seen > size ? seen : size;
+}
+
+/**
+ * @brief learn the size of a response from its retrieval
+ *
+ * @param  devctx device context
+ * @param  msg    response, as returned by vkil_read
+ * @param  role   role of the context retrieving the response
+ * @param  size   expected response size, in vk2host_msg::size unit
+ * @param  status vkil_read return value
+ */
+void vkil_learn_resp_size(vkil_devctx *devctx, const vk2host_msg *msg,
+			  const uint32_t role, const int32_t size,
+			  const int32_t status)
+{
+	atomic_int *seen;
+	int32_t cur;
+
+	VK_ASSERT((msg->function_id < VK_FID_MAX) && (role < VKIL_ROLE_NR));
+
+	if (status == -EMSGSIZE) {
+		/* msg->size is the size of the response left in the table */
+		seen = &devctx->resp.size[msg->function_id][role];
+		cur = atomic_load_explicit(seen, memory_order_relaxed);
+		while ((cur < msg->size) &&
+		       !atomic_compare_exchange_weak_explicit(
+				seen, &cur, msg->size, memory_order_relaxed,
+				memory_order_relaxed))
+			;
+		VKIL_LOG(VK_LOG_DEBUG, "fid %s role %d: size %d",
+			 vkil_function_id_str(msg->function_id), role,
+			 msg->size);
+	} else if ((status >= 0 || status == -EADV) && (msg->size > size)) {
+		atomic_fetch_add_explicit(&devctx->resp.retries_avoided, 1,
+					  memory_order_relaxed);
+	}
+}
+
+/**
+ * @brief retrieve a message from the completion table of its queue
+ *
+ * @param[in|out] devctx device context
+ * @param[in] where to write the read message,
+ *	@li if a vk2host_msg::msg_id is provided, will extract only a message
+ *	    matching the provided vk2host_msg::msg_id
+ *	@li otherwise return message matching the provided
+ *	    vk2host_msg::function_id
+ * @return 0 if success, -EMSGSIZE if the message is larger than the provided
+ *	   vk2host_msg::size, the message size and msg_id being written in it,
+ *	   other error code otherwise
+ */
+static int32_t retrieve_message(vkil_devctx *devctx, vk2host_msg *message)
+{
+	int msglen;
+	int32_t ret = 0;
+	vk2host_msg *msg;
+	vkil_cmpl_node *node;
+	vkil_cmpl_table *table = &devctx->q[message->queue_id].cmpl;
+
+	/*
+	 * this function need to be called with the lock of the message queue
+	 *
+	 * the caller function is here expected to lock/unlock the mutex
+	 */
+
+	node = cmpl_search(table, message);
+	if (!node) {
+		ret = -EAGAIN; /* message is not there yet */
+		goto out;
+	}
+
+	msg = node->msg;
 	if (message->size >= msg->size) {
 		msglen = sizeof(*msg) * (msg->size + 1);
 		memcpy(message, msg, msglen);
-		vkil_ll_delete(pvk2host_ll, node);
-		vkil_free((void **)&msg);
+		cmpl_remove(table, node);
+		vkil_pool_put(&devctx->pool, node);
 	} else {
 		/* message too long to be copied */
 		message->size = msg->size; /* requested size */
+		/* to get that one, and not a later one, found by function */
+		message->msg_id = msg->msg_id;
 		ret = -EMSGSIZE;
 		goto out;
 	}
 
-	if (message->hw_status == VK_STATE_ERROR) {
-		VKIL_LOG(VK_LOG_DEBUG, "VK_STATE_ERROR => %s",
-			 (!message->arg) ?
-			 "generic error" : strerror(-(message->arg)));
-		VKIL_LOG_VK2HOST_MSG(VK_LOG_DEBUG, message);
-		ret = -EADV;
+	if (message->hw_status == VK_STATE_ERROR) {
+		VKIL_LOG(VK_LOG_DEBUG, "VK_STATE_ERROR => %s",
+			 (!message->arg) ?
+			 "generic error" : strerror(-(message->arg)));
+		VKIL_LOG_VK2HOST_MSG(VK_LOG_DEBUG, message);
+		ret = -EADV;
+	}
+
+out:
+	return ret;
+}
+
+/**
+ * @brief receive a message from the driver
+ *
+ * the driver is read in the device receive buffer, which can get several
+ * messages at once; the messages are then handed out one at a time, the
+ * driver being read again only once all of them have been
+ *
+ * this function need to be called by the driver reader
+ * @param[in] devctx device context
+ * @param[in] q_id queue the message is read for
+ * @param[out] pnode node holding the received message, to be returned to the
+ *		     pool by the caller
+ * @return positive on success, (-ENOMSG) if there is no message, other error
+ *	   code otherwise
+ */
+static int32_t vkil_recv_msg(vkil_devctx *devctx, const int32_t q_id,
+			     vkil_cmpl_node **pnode)
+{
+	vkil_rx_buf *rx = &devctx->rx;
+	vkil_cmpl_node *node;
+	vk2host_msg *msg;
+	int32_t ret, nblks, hint;
+
+	if (rx->pos >= rx->len) {
+		/*
+		 * the buffer being larger than the largest message (its size
+		 * is 8 bits), the driver can't reject it with EMSGSIZE
+		 */
+		rx->pos = 0;
+		rx->len = 0;
+		/* the high priority lane first, while it has messages due */
+		hint = atomic_load_explicit(
+				&devctx->q[VKIL_PRI_HIGH_Q].credit.inflight,
+				memory_order_relaxed) ? VKIL_PRI_HIGH_Q : q_id;
+		ret = devctx->tp->reap(devctx, hint, rx->blk,
+				       sizeof(*rx->blk) * VKIL_RX_BUF_BLKS);
+		if ((ret == -ENOMSG) && (hint != q_id))
+			ret = devctx->tp->reap(devctx, q_id, rx->blk,
+					       sizeof(*rx->blk) *
+					       VKIL_RX_BUF_BLKS);
+		if (ret < 0)
+			return ret;
+		rx->len = ret / sizeof(*rx->blk);
+	}
+
+	msg = &rx->blk[rx->pos];
+	nblks = msg->size + 1;
+	if (rx->pos + nblks > rx->len) {
+		VKIL_LOG(VK_LOG_ERROR,
+			 "truncated message (%d/%d blocks) in devctx %p",
+			 rx->len - rx->pos, nblks, devctx);
+		rx->len = 0;
+		return -EBADMSG;
+	}
+
+	/* on failure, the message is kept for the next call */
+	node = vkil_pool_get(&devctx->pool, msg->size);
+	if (!node)
+		return -ENOMEM;
+	memcpy(node->msg, msg, sizeof(*msg) * nblks);
+	rx->pos += nblks;
+
+	*pnode = node;
+	return sizeof(*msg) * nblks;
+}
+
+/**
+ * @brief check if a waiter is waiting for a message
+ * @param[in] waiter waiter to check
+ * @param[in] msg message to check
+ * @return non zero if the waiter waits for the message
+ */
+static int32_t waiter_match(const vkil_waiter *waiter, const vk2host_msg *msg)
+{
+	const vk2host_msg *ref = waiter->message;
+
+	if (ref->msg_id)
+		return ref->msg_id == msg->msg_id;
+	return !cmp_function(msg, ref);
+}
+
+/**
+ * @brief notify a card context of a response deposited for it
+ * @param[in] devctx device context
+ * @param[in] context_id card context of the response
+ */
+static void vkil_notify(vkil_devctx *devctx, const uint32_t context_id)
+{
+	const uint64_t one = 1;
+	vkil_evt *evt;
+
+	pthread_mutex_lock(&devctx->evt_lock);
+	for (evt = devctx->evt; evt; evt = evt->next)
+		if ((evt->context_id == context_id) &&
+		    (write(evt->fd, &one, sizeof(one)) < 0))
+			VKIL_LOG(VK_LOG_ERROR, "eventfd %d write failure %s",
+				 evt->fd, strerror(errno));
+	pthread_mutex_unlock(&devctx->evt_lock);
+}
+
+/**
+ * @brief wake up the writers waiting for a queue to have room
+ * @param[in] q queue, its lock held
+ */
+static inline void vkil_room_signal(vkil_queue *q)
+{
+	q->room_seq++;
+	pthread_cond_broadcast(&q->room);
+}
+
+/**
+ * @brief deposit a received message in the SW completion tables
+ *
+ * the callers waiting for the message, if any, are woken up
+ *
+ * this function need to be called by the driver reader
+ * @param[in] devctx device context
+ * @param[in] q_id queue the message has been read for
+ * @param[in] node holding the message to deposit, owned by the table
+ */
+static void vkil_deposit_msg(vkil_devctx *devctx, const int32_t q_id,
+			     vkil_cmpl_node *node)
+{
+	vk2host_msg *msg = node->msg;
+	const uint32_t context_id = msg->context_id;
+	const int32_t msg_id = msg->msg_id;
+	vkil_waiter *waiter;
+	vkil_msg_id *entry;
+	vkil_async *async;
+	vkil_queue *q;
+	int32_t acked;
+
+	vkil_lat_update(devctx, msg, vkil_get_time_us());
+	entry = &devctx->msgid_ctx.msg_list[msg->msg_id];
+	acked = (msg->queue_id < VKIL_MSG_Q_MAX) && vkil_msg_uncharge(entry);
+	if (acked) {
+		vkil_credit_ack(&devctx->q[msg->queue_id].credit);
+		/* the low lane can be held back by the high one */
+		if ((msg->queue_id == VKIL_PRI_HIGH_Q) && devctx->pri_backlog) {
+			q = &devctx->q[VKIL_PRI_LOW_Q];
+			pthread_mutex_lock(q->lock);
+			vkil_room_signal(q);
+			pthread_mutex_unlock(q->lock);
+		}
+	}
+	/*
+	 * the message is filed in the queue it has been issued on, which can
+	 * differ from the one we are reading for
+	 */
+	q = &devctx->q[(msg->queue_id < VKIL_MSG_Q_MAX) ? msg->queue_id : q_id];
+
+	pthread_mutex_lock(q->lock);
+	if (acked)
+		vkil_room_signal(q);
+	if (msg->msg_id && entry->abandoned) {
+		pthread_mutex_unlock(q->lock);
+		VKIL_LOG_VK2HOST_MSG(VK_LOG_DEBUG, msg);
+		if (devctx->reaper.reaped)
+			devctx->reaper.reaped(devctx->reaper.opaque,
+					      msg->context_id,
+					      msg->function_id,
+					      entry->user_data);
+		vkil_lose_msg_id(devctx, msg->msg_id);
+		vkil_pool_put(&devctx->pool, node);
+		atomic_fetch_add_explicit(&devctx->reaped, 1,
+					  memory_order_relaxed);
+		return;
+	}
+	/* once handed over, the completion can't be abandoned anymore */
+	async = msg->msg_id ? entry->async : NULL;
+	entry->async = NULL;
+	cmpl_insert(&q->cmpl, node);
+	for (waiter = q->waiters; waiter; waiter = waiter->next)
+		if (waiter_match(waiter, msg))
+			pthread_cond_signal(&waiter->cond);
+	pthread_mutex_unlock(q->lock);
+
+	/* msg is not to be accessed anymore, it can have been retrieved */
+	if (async) {
+		async->done(async, msg_id);
+		return;
+	}
+	if (atomic_load_explicit(&devctx->nevt, memory_order_relaxed))
+		vkil_notify(devctx, context_id);
+	if (msg_id)
+		vkil_tkt_notify(devctx, msg_id);
+}
+
+/**
+ * @brief release the msg_ids given up on whose response never came
+ *
+ * the message is deemed lost by the card, the queue credit it holds is given
+ * back too. Deposits are done by the driver reader as well, so a response
+ * can't come while its msg_id is released
+ *
+ * this function need to be called by the driver reader
+ * @param[in] devctx device context
+ * @param[in] now current time
+ * @return number of msg_ids released
+ */
+static int32_t vkil_reap_abandoned(vkil_devctx *devctx, const int64_t now)
+{
+	const vkil_reaper *reaper = &devctx->reaper;
+	vkil_msg_id *list = devctx->msgid_ctx.msg_list, *entry;
+	uint64_t lost[VKIL_MSG_ID_WORDS] = {0};
+	int32_t i, j, acked, n = 0;
+	vkil_queue *q;
+
+	if (!atomic_load_explicit(&devctx->nabandoned, memory_order_relaxed))
+		return 0;
+
+	/* the abandoned flag is set under the lock of the queue filed in */
+	for (i = 0; i < VKIL_MSG_Q_MAX; i++) {
+		q = &devctx->q[i];
+		pthread_mutex_lock(q->lock);
+		for (j = 1; j < MSG_LIST_SIZE; j++)
+			if (list[j].abandoned && (list[j].queue_id == i) &&
+			    (now >= list[j].deadline_us))
+				lost[j / 64] |= 1ULL << (j % 64);
+		pthread_mutex_unlock(q->lock);
+	}
+
+	for (j = 1; j < MSG_LIST_SIZE; j++) {
+		if (!(lost[j / 64] & (1ULL << (j % 64))))
+			continue;
+		entry = &list[j];
+		q = &devctx->q[entry->queue_id];
+		VKIL_LOG(VK_LOG_DEBUG, "no response to msg_id %d queue %d", j,
+			 entry->queue_id);
+		for (acked = 0; vkil_msg_uncharge(entry); acked++)
+			vkil_credit_ack(&q->credit);
+		if (acked) {
+			pthread_mutex_lock(q->lock);
+			vkil_room_signal(q);
+			pthread_mutex_unlock(q->lock);
+		}
+		if (reaper->reaped)
+			reaper->reaped(reaper->opaque, entry->context_id,
+				       entry->function_id, entry->user_data);
+		vkil_lose_msg_id(devctx, j);
+		n++;
+	}
+
+	if (n) {
+		atomic_fetch_add_explicit(&devctx->reaped, n,
+					  memory_order_relaxed);
+		VKIL_LOG(VK_LOG_WARNING,
+			 "%d msg_ids without response released in devctx %p",
+			 n, devctx);
+	}
+	return n;
+}
+
+/**
+ * @brief discard the responses not retrieved by their deadline
+ *
+ * the completion tables are scanned every VKIL_REAP_PERIOD_MS; a response
+ * a caller waits for is never discarded. The msg_ids given up on are
+ * released by then as well, if their response didn't come in time
+ *
+ * this function need to be called by the driver reader
+ * @param[in] devctx device context
+ * @return number of responses and msg_ids reaped
+ */
+static int32_t vkil_reap(vkil_devctx *devctx)
+{
+	const vkil_reaper *reaper = &devctx->reaper;
+	vkil_msg_id *list = devctx->msgid_ctx.msg_list, *entry;
+	vkil_cmpl_node *node, *next, *stale = NULL;
+	vkil_waiter *waiter;
+	vk2host_msg *msg;
+	int32_t i, j, n = 0, lost;
+	vkil_queue *q;
+	int64_t now;
+
+	now = vkil_get_time_us();
+	if (now < devctx->reap_us)
+		return 0;
+	devctx->reap_us = now + VKIL_REAP_PERIOD_MS * 1000;
+
+	lost = vkil_reap_abandoned(devctx, now);
+	if (!reaper->timeout_ms)
+		return lost;
+
+	for (i = 0; i < VKIL_MSG_Q_MAX; i++) {
+		q = &devctx->q[i];
+		pthread_mutex_lock(q->lock);
+		for (j = 0; j < VKIL_CMPL_FN_BUCKETS; j++) {
+			for (node = q->cmpl.by_fn[j].head; node; node = next) {
+				next = node->fn_next;
+				msg = node->msg;
+				entry = &list[msg->msg_id];
+				if (!msg->msg_id || !entry->deadline_us ||
+				    (now < entry->deadline_us))
+					continue;
+
+				for (waiter = q->waiters; waiter;
+				     waiter = waiter->next)
+					if (waiter_match(waiter, msg))
+						break;
+				if (waiter)
+					continue;
+
+				cmpl_remove(&q->cmpl, node);
+				node->id_next = stale;
+				stale = node;
+			}
+		}
+		pthread_mutex_unlock(q->lock);
+	}
+
+	for (node = stale; node; node = next) {
+		next = node->id_next;
+		msg = node->msg;
+		entry = &list[msg->msg_id];
+		VKIL_LOG_VK2HOST_MSG(VK_LOG_DEBUG, msg);
+		if (reaper->reaped)
+			reaper->reaped(reaper->opaque, msg->context_id,
+				       msg->function_id, entry->user_data);
+		if (vkil_msg_id_used(devctx, msg->msg_id))
+			vkil_lose_msg_id(devctx, msg->msg_id);
+		vkil_pool_put(&devctx->pool, node);
+		n++;
+	}
+
+	if (n) {
+		atomic_fetch_add_explicit(&devctx->reaped, n,
+					  memory_order_relaxed);
+		VKIL_LOG(VK_LOG_WARNING,
+			 "%d stale responses reaped in devctx %p", n, devctx);
+	}
+	return n + lost;
+}
+
+/**
+ * @brief drain the driver into the SW completion tables
+ *
+ * this function need to be called by the driver reader
+ * @param[in] devctx device context
+ * @param[in] q_id queue the messages are read for
+ * @return number of messages deposited if positive, error code otherwise
+ */
+static int32_t vkil_drain(vkil_devctx *devctx, const int32_t q_id)
+{
+	vkil_cmpl_node *node;
+	int32_t ret, n = 0;
+
+	while ((ret = vkil_recv_msg(devctx, q_id, &node)) >= 0) {
+		vkil_deposit_msg(devctx, q_id, node);
+		n++;
+	}
+	vkil_reap(devctx);
+
+	return (n || (ret == -ENOMSG)) ? n : ret;
+}
+
+/**
+ * @brief release the driver reader role
+ *
+ * all the callers waiting for a message, or for a queue to have room, are
+ * woken up, so that one of them takes the role over if still needed
+ * @param[in] devctx device context
+ */
+static void vkil_release_reader(vkil_devctx *devctx)
+{
+	vkil_waiter *waiter;
+	vkil_queue *q;
+	int32_t i;
+
+	pthread_mutex_unlock(&devctx->rx_lock);
+	for (i = 0; i < VKIL_MSG_Q_MAX; i++) {
+		q = &devctx->q[i];
+		pthread_mutex_lock(q->lock);
+		for (waiter = q->waiters; waiter; waiter = waiter->next)
+			pthread_cond_signal(&waiter->cond);
+		vkil_room_signal(q);
+		pthread_mutex_unlock(q->lock);
+	}
+}
+
+/**
+ * @brief read the driver until a message is in its completion table
+ *
+ * this function need to be called by the driver reader. The driver is busy
+ * polled up to spin_end_us, then polled while yielding the cpu up to
+ * yield_end_us; after that the driver fd is waited on
+ * @param[in] devctx device context
+ * @param[in] message message waited for
+ * @param[in] deadline_us time to give up, INT64_MAX for an infinite wait,
+ *	      zero to read the driver only once
+ * @param[in] spin_end_us end of the busy polling, in vkil_get_time_us time
+ * @param[in] yield_end_us end of the yield polling, in vkil_get_time_us time
+ * @return zero on success, error code otherwise
+ */
+static int32_t vkil_lead(vkil_devctx *devctx, const vk2host_msg *message,
+			 const int64_t deadline_us, const int64_t spin_end_us,
+			 const int64_t yield_end_us)
+{
+	vkil_queue *q = &devctx->q[message->queue_id];
+	int32_t ret, found, ready = 0;
+	int64_t now;
+
+	/* the previous reader could have deposited it in the meantime */
+	pthread_mutex_lock(q->lock);
+	found = !!cmpl_search(&q->cmpl, message);
+	pthread_mutex_unlock(q->lock);
+	if (found)
+		return 0;
+
+	do {
+		ret = vkil_drain(devctx, message->queue_id);
+		if (ret < 0)
+			return ret;
+
+		if (ret) {
+			if (ready)
+				devctx->poll_spurious = 0;
+			pthread_mutex_lock(q->lock);
+			found = !!cmpl_search(&q->cmpl, message);
+			pthread_mutex_unlock(q->lock);
+			if (found)
+				return 0;
+		} else if (ready) {
+			vkil_poll_spurious(devctx);
+		}
+
+		if (!deadline_us)
+			return 0;
+
+		now = vkil_get_time_us();
+		if (now >= deadline_us)
+			return -ETIMEDOUT;
+
+		ready = 0;
+		if (now < spin_end_us)
+			continue;
+		if (now < yield_end_us) {
+			sched_yield();
+			continue;
+		}
+		ready = vkil_wait_fd(devctx, (deadline_us == INT64_MAX) ? -1 :
+				     (deadline_us - now + 999) / 1000);
+	} while (1);
+}
+
+/**
+ * @brief discard the stale responses, if there is no driver reader
+ *
+ * the driver is drained first, the responses having possibly not been read
+ * yet; a driver reader does it anyway
+ * @param[in] devctx device context
+ * @return number of responses reaped
+ */
+int32_t vkil_reap_stale(vkil_devctx *devctx)
+{
+	uint64_t reaped;
+
+	if (pthread_mutex_trylock(&devctx->rx_lock))
+		return 0;
+	reaped = atomic_load_explicit(&devctx->reaped, memory_order_relaxed);
+	vkil_drain(devctx, 0);
+	vkil_release_reader(devctx);
+	return atomic_load_explicit(&devctx->reaped, memory_order_relaxed) -
+	       reaped;
+}
+
+/**
+ * @brief completion dispatcher thread
+ *
+ * the dispatcher keeps the driver reader role for its whole life, so it is
+ * the only reader of the driver; the callers just wait for it to deposit
+ * their messages in the completion tables
+ * @param[in] arg device context
+ * @return NULL
+ */
+static void *vkil_dispatcher(void *arg)
+{
+	vkil_devctx *devctx = arg;
+	int32_t ret, ready = 0;
+
+	pthread_mutex_lock(&devctx->rx_lock);
+	while (!atomic_load_explicit(&devctx->dispatcher.stop,
+				     memory_order_acquire)) {
+		ret = vkil_drain(devctx, 0);
+		if (ret < 0) {
+			VKIL_LOG(VK_LOG_ERROR, "read error %s(%d) in devctx %p",
+				 strerror(-ret), ret, devctx);
+			usleep(1000 * VKIL_DISPATCH_POLL_MS);
+			ready = 0;
+			continue;
+		}
+
+		if (ready && ret)
+			devctx->poll_spurious = 0;
+		else if (ready)
+			vkil_poll_spurious(devctx);
+		ready = vkil_wait_fd(devctx, VKIL_DISPATCH_POLL_MS);
+	}
+	vkil_release_reader(devctx);
+
+	return NULL;
+}
+
+/**
+ * @brief give up on the response to a message
+ *
+ * the response is discarded if it ever comes; the msg_id is otherwise
+ * released by the reaper once the reap timeout has elapsed
+ *
+ * the lock of the queue the message is filed in shall be held
+ * @param[in] devctx device context
+ * @param[in] msg response given up on
+ */
+static void abandon_msg_id(vkil_devctx *devctx, const vk2host_msg *msg)
+{
+	vkil_msg_id *entry = &devctx->msgid_ctx.msg_list[msg->msg_id];
+	const int64_t timeout_ms = devctx->reaper.timeout_ms ?
+				   devctx->reaper.timeout_ms :
+				   VKIL_REAP_TIMEOUT_MS;
+
+	entry->context_id = msg->context_id;
+	entry->queue_id = msg->queue_id;
+	entry->deadline_us = vkil_get_time_us() + timeout_ms * 1000;
+	entry->abandoned = 1;
+	atomic_fetch_add_explicit(&devctx->nabandoned, 1, memory_order_relaxed);
+}
+
+/**
+ * @brief give up on the response to an asynchronous command
+ *
+ * its completion is not called anymore, the response being discarded as the
+ * one of a timed out read
+ * @param[in] devctx device context
+ * @param[in] async  completion set by vkil_set_msg_async
+ * @return zero if abandoned, -EINPROGRESS if the response has already been
+ *	   handed over to the completion, which is then to be called
+ */
+int32_t vkil_abandon_msg_async(vkil_devctx *devctx, vkil_async *async)
+{
+	vkil_msg_id *entry = &devctx->msgid_ctx.msg_list[async->msg_id];
+	vkil_queue *q = &devctx->q[async->queue_id];
+	int32_t ret = -EINPROGRESS;
+	vk2host_msg msg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_id = async->msg_id;
+	msg.queue_id = async->queue_id;
+	msg.context_id = async->context_id;
+
+	pthread_mutex_lock(q->lock);
+	if (entry->async == async) {
+		entry->async = NULL;
+		abandon_msg_id(devctx, &msg);
+		ret = 0;
+	}
+	pthread_mutex_unlock(q->lock);
+	return ret;
+}
+
+/**
+ * @brief read a message from the device
+ *
+ * the function will first look if the message has been transferred from the
+ * driver to the SW completion table of its queue. If not, the caller becomes
+ * the driver reader if there is none, and reads the driver until the message
+ * shows up; otherwise it waits for the driver reader to deposit the message.
+ * @param[in] devctx device context
+ * @param[in|out] returned message
+ * @param[in] deadline_us time to give up, in vkil_get_time_us time;
+ *	      INT64_MAX for an infinite wait, zero means no wait. A message
+ *	      given up on is discarded when it shows up
+ * @param[in] policy how to wait for the message, NULL for default
+ * @return 0 on success, -EADV if read message report an error, -EMSGSIZE if
+ *	   it doesn't fit (see retrieve_message), other errors code otherwise
+ */
+int32_t vkil_read(vkil_devctx * const devctx, vk2host_msg * const msg,
+		  const int64_t deadline_us, const vkil_wait_policy *policy)
+{
+	int32_t ret, retm, drained = 0, registered = 0, yield = 0;
+	int64_t spin_end_us, yield_end_us, now;
+	vkil_waiter waiter, **pwaiter;
+	pthread_condattr_t attr;
+	struct timespec ts;
+	vkil_queue *q;
+
+	/* sanity check */
+	VK_ASSERT(msg);
+	VK_ASSERT(devctx);
+	VK_ASSERT(msg->queue_id < VKIL_MSG_Q_MAX);
+
+	q = &devctx->q[msg->queue_id];
+	retm = pthread_mutex_lock(q->lock);
+	if (retm) {
+		VKIL_LOG(VK_LOG_ERROR, "mutex lock error %s(%d) in devctx %p",
+			 strerror(retm), retm, devctx);
+		return -retm; /* force negative error */
+	}
+
+	ret = retrieve_message(devctx, msg);
+	if (ret != -EAGAIN)
+		goto out;
+
+	vkil_wait_budget(devctx, msg, policy, &spin_end_us, &yield_end_us);
+
+	do {
+		if (drained)
+			break;
+
+		if (!pthread_mutex_trylock(&devctx->rx_lock)) {
+			pthread_mutex_unlock(q->lock);
+			ret = vkil_lead(devctx, msg, deadline_us, spin_end_us,
+					yield_end_us);
+			vkil_release_reader(devctx);
+			pthread_mutex_lock(q->lock);
+			if (ret)
+				break;
+			/* a non blocking call reads the driver only once */
+			drained = !deadline_us;
+			continue;
+		}
+
+		if (!deadline_us) {
+			/*
+			 * the caller is likely to poll again, give the
+			 * driver reader a chance to run in between
+			 */
+			yield = 1;
+			break;
+		}
+
+		now = vkil_get_time_us();
+		if (now >= deadline_us) {
+			ret = -ETIMEDOUT;
+			break;
+		}
+
+		/* poll the completion table if requested so */
+		if (now < yield_end_us) {
+			pthread_mutex_unlock(q->lock);
+			if (now >= spin_end_us)
+				sched_yield();
+			pthread_mutex_lock(q->lock);
+			continue;
+		}
+
+		/* then wait to be woken up by the driver reader */
+		if (!registered) {
+			pthread_condattr_init(&attr);
+			pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+			pthread_cond_init(&waiter.cond, &attr);
+			pthread_condattr_destroy(&attr);
+			waiter.message = msg;
+			waiter.next = q->waiters;
+			q->waiters = &waiter;
+			registered = 1;
+		}
+		if (deadline_us == INT64_MAX) {
+			pthread_cond_wait(&waiter.cond, q->lock);
+		} else {
+			ts.tv_sec = deadline_us / 1000000;
+			ts.tv_nsec = (deadline_us % 1000000) * 1000;
+			pthread_cond_timedwait(&waiter.cond, q->lock, &ts);
+		}
+	} while ((ret = retrieve_message(devctx, msg)) == -EAGAIN);
+
+	if (registered) {
+		for (pwaiter = &q->waiters; *pwaiter != &waiter;
+		     pwaiter = &(*pwaiter)->next)
+			;
+		*pwaiter = waiter.next;
+		pthread_cond_destroy(&waiter.cond);
+	}
+
+	/* a driver reader could have deposited it in the meantime */
+	if ((ret == -ETIMEDOUT) && msg->msg_id &&
+	    ((ret = retrieve_message(devctx, msg)) == -EAGAIN)) {
+		VKIL_LOG(VK_LOG_WARNING, "Hit timeout on msg_id %d queue %d",
+			 msg->msg_id, msg->queue_id);
+		abandon_msg_id(devctx, msg);
+		ret = -ETIMEDOUT;
+	} else if (ret == -ETIMEDOUT) {
+		VKIL_LOG(VK_LOG_WARNING, "Hit timeout on queue %d",
+			 msg->queue_id);
+	}
+
+out:
+	if (ret != -EAGAIN)
+		VKIL_LOG_VK2HOST_MSG(VK_LOG_DEBUG, msg);
+	else
+		VKIL_LOG(VK_LOG_DEBUG, "message not retrieved yet");
+
+	retm = pthread_mutex_unlock(q->lock);
+	if (retm) {
+		/* mutex error takes precedence on other error */
+		VKIL_LOG(VK_LOG_ERROR, "mutex unlock error %s(%d) in devctx %p",
+			 strerror(retm), retm, devctx);
+		ret = -retm;
+	}
+	if (yield)
+		sched_yield();
+	return ret;
+}
+
+/**
+ * @brief write a message to the device, waiting for its queue to have room
+ *
+ * credits are given back as the responses are read from the driver; without
+ * driver reader, the caller reads it itself, otherwise it waits for the
+ * reader to give a credit back, or to release its role
+ * @param devctx device context
+ * @param msg message to write
+ * @param deadline_us time to give up, INT64_MAX for an infinite wait
+ * @return 0 on success, -EAGAIN if the queue stayed full up to the deadline,
+ *	   other error code otherwise
+ */
+int32_t vkil_write_wait(vkil_devctx * const devctx, host2vk_msg * const msg,
+			const int64_t deadline_us)
+{
+	vkil_queue *q = &devctx->q[msg->queue_id];
+	int64_t now, wait_us;
+	struct timespec ts;
+	uint32_t seq;
+	int32_t ret;
+
+	ret = vkil_write(devctx, msg);
+	while (ret == -EAGAIN) {
+		/* any room made from now on ends the wait below */
+		pthread_mutex_lock(q->lock);
+		seq = q->room_seq;
+		pthread_mutex_unlock(q->lock);
+
+		ret = vkil_write(devctx, msg);
+		if (ret != -EAGAIN)
+			break;
+
+		now = vkil_get_time_us();
+		if (now >= deadline_us) {
+			VKIL_LOG(VK_LOG_WARNING, "queue %d full up to deadline",
+				 msg->queue_id);
+			break;
+		}
+
+		if (!pthread_mutex_trylock(&devctx->rx_lock)) {
+			if (!vkil_drain(devctx, msg->queue_id))
+				vkil_wait_fd(devctx, VKIL_PROBE_INTERVAL_MS);
+			vkil_release_reader(devctx);
+			continue;
+		}
+
+		/*
+		 * with nothing in flight on the queue, the driver is full of
+		 * messages of others, and no credit is to come back: it is
+		 * just probed again
+		 */
+		wait_us = deadline_us;
+		if (!atomic_load_explicit(&q->credit.inflight,
+					  memory_order_relaxed))
+			wait_us = MIN(deadline_us,
+				      now + 1000 * VKIL_PROBE_INTERVAL_MS);
+		ts.tv_sec = wait_us / 1000000;
+		ts.tv_nsec = (wait_us % 1000000) * 1000;
+
+		pthread_mutex_lock(q->lock);
+		while (q->room_seq == seq) {
+			if (wait_us == INT64_MAX)
+				pthread_cond_wait(&q->room, q->lock);
+			else if (pthread_cond_timedwait(&q->room, q->lock,
+							&ts))
+				break;
+		}
+		pthread_mutex_unlock(q->lock);
+	}
+	return ret;
+}
+
+/**
+ * @brief start the completion dispatcher of a device
+ * @param[in] devctx device context
+ * @return 0 on success, error code otherwise
+ */
+static int32_t vkil_start_dispatcher(vkil_devctx *devctx)
+{
+	int32_t ret;
+
+	atomic_init(&devctx->dispatcher.stop, 0);
+	ret = pthread_create(&devctx->dispatcher.thread, NULL,
+			     vkil_dispatcher, devctx);
+	if (ret) {
+		VKIL_LOG(VK_LOG_ERROR, "failure %s(%d) in devctx %p",
+			 strerror(ret), ret, devctx);
+		return -ret;
 	}
+	devctx->dispatcher.running = 1;
 
-out:
-	return ret;
+	VKIL_LOG(VK_LOG_DEBUG, "dispatcher started on devctx %p", devctx);
+	return 0;
 }
 
 /**
- * @brief flush the driver reading queue into a SW linked list
+ * @brief stop the completion dispatcher of a device
  * @param[in] devctx device context
- * @param[in] message carrying q_id, and field to retrieve (msg_id,...)
- * @param[in] wait for incoming message carrying specific field  (msg_id,...)
- * @return (-ETIMEDOUT) or (-ENOMSG) on flushing completion
  */
-static int32_t vkil_flush_read(vkil_devctx *devctx,
-			       vk2host_msg *message,
-			       int32_t wait)
+static void vkil_stop_dispatcher(vkil_devctx *devctx)
 {
-	int32_t ret, q_id;
-	vk2host_msg *msg;
-	vkil_node *node;
-	int32_t size;
+	if (!devctx->dispatcher.running)
+		return;
 
-	/*
-	 * this function need to be called with
-	 * pthread_mutex_lock(&devctx->mwx);
-	 *
-	 * the caller function is here expected to lock/unlock the mutex
-	 */
+	atomic_store_explicit(&devctx->dispatcher.stop, 1,
+			      memory_order_release);
+	pthread_join(devctx->dispatcher.thread, NULL);
+	devctx->dispatcher.running = 0;
+}
 
-	q_id = message->queue_id;
-	if (q_id >= VKIL_MSG_Q_MAX) {
-		VKIL_LOG(VK_LOG_ERROR, "q_id %d > MAX %d in devctx %p",
-			 q_id, VKIL_MSG_Q_MAX, devctx);
-		ret = -EINVAL;
-		goto fail;
-	}
+/**
+ * @brief have the device driver read by a completion dispatcher
+ *
+ * the dispatcher is started if the device has none, and then runs until the
+ * device is closed
+ * @param[in] devctx device context
+ * @return 0 on success, error code otherwise
+ */
+int32_t vkil_need_dispatcher(vkil_devctx *devctx)
+{
+	int32_t ret = 0;
 
-	do {
-		/* first exhaust the hw pipe */
-		size = 0;
-		msg = NULL;
-		do {
-			if (msg)
-				vkil_free((void **)&msg);
+	pthread_mutex_lock(&devctx->evt_lock);
+	if (!devctx->dispatcher.running)
+		ret = vkil_start_dispatcher(devctx);
+	pthread_mutex_unlock(&devctx->evt_lock);
+	return ret;
+}
 
-			ret = vkil_mallocz((void **)&msg,
-					   sizeof(*msg) * (size + 1));
-			if (ret)
-				goto fail_malloc;
-			msg->size = size;
-			msg->queue_id = q_id;
-			ret = vkil_wait_probe_msg(devctx->fd, msg, wait);
-			if (ret == -ETIMEDOUT)
-				goto fail;
+/**
+ * @brief have a card context notified of the responses deposited for it
+ *
+ * someone has to read the driver for the responses to be deposited, so the
+ * device gets a completion dispatcher if it has none. The eventfd is
+ * signaled once right away, responses being possibly pending already
+ * @param[in]  devctx     device context
+ * @param[in]  context_id card context to notify
+ * @param[out] evt        notification
+ * @return zero on success, error code otherwise
+ */
+int32_t vkil_new_evt(vkil_devctx *devctx, const uint32_t context_id,
+		     vkil_evt **evt)
+{
+	const uint64_t one = 1;
+	int32_t ret;
 
-			/* if the message size is too small, the driver
-			 * should return the required size in
-			 * msg->size field so we run only twice in this loop
-			 */
-			if (msg->size)
-				size =  msg->size;
-			else
-				/* otherwise increase arbitraily the size */
-				size += BIG_MSG_SIZE_INC;
-		} while (ret == -EMSGSIZE);
-
-		if (ret >= 0) {
-			node = vkil_ll_append(&devctx->vk2host[q_id], msg);
-			if (!node) {
-				ret = -ENOMEM;
-				goto fail;
-			}
-			/*
-			 * if no message id specified or message id specified
-			 * has been retrieved no need to wait any longer
-			 */
-			if (message->msg_id == msg->msg_id)
-				wait = 0;
-			else if (!message->msg_id) {
-				int32_t still_wait = cmp_function(msg, message);
+	ret = vkil_mallocz((void **)evt, sizeof(**evt));
+	if (ret)
+		return ret;
 
-				wait = still_wait ? wait : 0;
-			}
-		} else
-			vkil_free((void **)&msg);
-	} while (ret >= 0);
+	(*evt)->context_id = context_id;
+	(*evt)->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if ((*evt)->fd < 0) {
+		ret = -errno;
+		goto fail;
+	}
 
-	/*
-	 * here the return will be negative -ENOMSG, since that is the expected
-	 * result, we return 0 as success
-	 */
+	ret = vkil_need_dispatcher(devctx);
+	if (ret)
+		goto fail_fd;
+
+	pthread_mutex_lock(&devctx->evt_lock);
+	(*evt)->next = devctx->evt;
+	devctx->evt = *evt;
+	atomic_fetch_add_explicit(&devctx->nevt, 1, memory_order_relaxed);
+	pthread_mutex_unlock(&devctx->evt_lock);
+
+	if (write((*evt)->fd, &one, sizeof(one)) < 0)
+		VKIL_LOG(VK_LOG_ERROR, "eventfd %d write failure %s",
+			 (*evt)->fd, strerror(errno));
 	return 0;
 
+fail_fd:
+	close((*evt)->fd);
 fail:
-	vkil_free((void **)&msg);
-fail_malloc:
+	vkil_free((void **)evt);
 	return ret;
 }
 
 /**
- * @brief read a message from the device
+ * @brief stop notifying a card context of its responses
  *
- * the function will first look if the message has been transferred from the
- * driver to the a SW linked list, if not, then it will flush the driver queue
- * into the vkil backend linkd list; then poll the SW linked list again
- * @param[in] devctx device context
- * @param[in|out] returned message
- * @return 0 on success, -EADV if read message report an error, other errors
- *           code otherwise
+ * @param[in]     devctx device context
+ * @param[in,out] evt    notification, NULL on return
  */
-int32_t vkil_read(vkil_devctx * const devctx, vk2host_msg * const msg,
-		  const int32_t wait)
+void vkil_del_evt(vkil_devctx *devctx, vkil_evt **evt)
 {
-	int32_t ret, retm;
+	vkil_evt **pevt;
 
-	/* sanity check */
-	VK_ASSERT(msg);
-	VK_ASSERT(devctx);
-	VK_ASSERT(msg->queue_id < VKIL_MSG_Q_MAX);
+	if (!*evt)
+		return;
 
-	/*
-	 * Thought it is expected concurrent driver access are handled
-	 * by the driver itself, we still need to prevent concurrent access
-	 * to the linked list manipulation
-	 */
-	retm = pthread_mutex_lock(&devctx->mwx);
-	if (retm) {
-		VKIL_LOG(VK_LOG_ERROR, "mutex lock error %s(%d) in devctx %p",
-			 strerror(retm), retm, devctx);
-		return -retm; /* force negative error */
-	}
+	pthread_mutex_lock(&devctx->evt_lock);
+	for (pevt = &devctx->evt; *pevt != *evt; pevt = &(*pevt)->next)
+		;
+	*pevt = (*evt)->next;
+	atomic_fetch_sub_explicit(&devctx->nevt, 1, memory_order_relaxed);
+	pthread_mutex_unlock(&devctx->evt_lock);
 
-	ret = retrieve_message(&devctx->vk2host[msg->queue_id], msg);
+	close((*evt)->fd);
+	vkil_free((void **)evt);
+}
 
-	if (ret != -EAGAIN) {
-		/*
-		 * either message has been retrieved, or some other problem
-		 * has occcured, such has message size bigger than expected
-		 */
-		VKIL_LOG_VK2HOST_MSG(VK_LOG_DEBUG, msg);
-		retm = pthread_mutex_unlock(&(devctx->mwx));
-		if (retm) {
-			/* mutex error takes precedence on other error */
-			VKIL_LOG(VK_LOG_ERROR,
-				 "mutex unlock error %s(%d) in devctx %p",
-				 strerror(retm), retm, devctx);
-			ret = -retm;
+/**
+ * @brief process wide registry of the opened devices
+ *
+ * all the contexts using a card share the same device context, so that a
+ * card is driven by a single fd and completion engine
+ */
+static struct _vkil_dev_registry {
+	pthread_mutex_t lock; /**< protect the list and the device refs */
+	vkil_devctx *head;    /**< opened devices */
+	uint32_t serial;      /**< serial of the last device opened */
+} vkil_devs = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/**
+ * @brief fill the ticket of a message about to be written
+ *
+ * the message holds its msg_id until written, so the generation read here
+ * is the one of the command
+ * @param[in]  devctx device context
+ * @param[in]  msg    message to write
+ * @param[out] ticket ticket of the message
+ */
+void vkil_set_ticket(vkil_devctx *devctx, const host2vk_msg *msg,
+		     vkil_ticket *ticket)
+{
+	ticket->devctx = devctx;
+	ticket->dev_serial = devctx->serial;
+	ticket->queue_id = msg->queue_id;
+	ticket->msg_id = msg->msg_id;
+	ticket->gen = atomic_load_explicit(
+			&devctx->msgid_ctx.msg_list[msg->msg_id].gen,
+			memory_order_relaxed);
+}
+
+/**
+ * @brief get a reference to the device of a ticket
+ *
+ * the ticket only holds the device address: the device is looked up in the
+ * registry, its serial telling it apart from a device opened since at the
+ * same address
+ * @param[in] ticket ticket
+ * @return device, to be released with vkil_deinit_dev; NULL if closed
+ */
+static vkil_devctx *vkil_get_ticket_dev(const vkil_ticket *ticket)
+{
+	vkil_devctx *devctx;
+
+	pthread_mutex_lock(&vkil_devs.lock);
+	for (devctx = vkil_devs.head; devctx; devctx = devctx->next)
+		if ((devctx == ticket->devctx) &&
+		    (devctx->serial == ticket->dev_serial)) {
+			devctx->ref++;
+			break;
 		}
-		return ret;
-	}
+	pthread_mutex_unlock(&vkil_devs.lock);
+	return devctx;
+}
 
-	ret = vkil_flush_read(devctx, msg, wait);
-	if (ret)
+/**
+ * @brief get the status of the command of a ticket, on its device
+ *
+ * the response of the command is told lost as long as its msg_id hasn't
+ * been used VKIL_LOST_GENS - 1 times since
+ * @param[in] devctx device of the ticket, a reference held
+ * @param[in] ticket ticket to check
+ * @return as vkil_ticket_status
+ */
+static int32_t ticket_status(vkil_devctx *devctx, const vkil_ticket *ticket)
+{
+	vkil_msg_id *entry = &devctx->msgid_ctx.msg_list[ticket->msg_id];
+	vkil_queue *q = &devctx->q[ticket->queue_id];
+	int32_t ret = -EINPROGRESS;
+	uint64_t lost;
+	uint32_t gen;
+
+	pthread_mutex_lock(q->lock);
+	gen = atomic_load_explicit(&entry->gen, memory_order_acquire);
+	if (gen == ticket->gen) {
+		if (q->cmpl.by_id[ticket->msg_id])
+			ret = 0;
 		goto out;
+	}
 
-	ret = retrieve_message(&devctx->vk2host[msg->queue_id], msg);
-
-	if (ret != -EAGAIN)
-		VKIL_LOG_VK2HOST_MSG(VK_LOG_DEBUG, msg);
+	/*
+	 * the msg_id has been reused since; the bit of the ticket is recorded
+	 * again once the generation reaches ticket->gen + VKIL_LOST_GENS,
+	 * which is checked after reading it
+	 */
+	lost = atomic_load_explicit(&entry->lost, memory_order_acquire);
+	gen = atomic_load_explicit(&entry->gen, memory_order_relaxed);
+	if (gen - ticket->gen >= VKIL_LOST_GENS)
+		ret = -ESTALE;
 	else
-		VKIL_LOG(VK_LOG_DEBUG, "message not retrieved yet");
-
+		ret = (lost & (1ULL << (ticket->gen % VKIL_LOST_GENS))) ?
+		      -ECANCELED : 0;
 out:
-	retm = pthread_mutex_unlock(&devctx->mwx);
-	if (retm) {
-		/* mutex error takes precedence on other error */
-		VKIL_LOG(VK_LOG_ERROR, "mutex unlock error %s(%d) in devctx %p",
-			 strerror(retm), retm, devctx);
-		ret = -retm;
-	}
+	pthread_mutex_unlock(q->lock);
+	return ret;
+}
+
+/**
+ * @brief get the status of the command of a ticket
+ *
+ * @param[in] ticket ticket to check
+ * @return zero if its response has been deposited, or retrieved already;
+ *	   -EINPROGRESS if not yet, -ECANCELED if it has been discarded
+ *	   (reaped, or given up on) or never came, -ESTALE if too old to
+ *	   tell, -ENODEV if its device has been closed
+ */
+int32_t vkil_ticket_status(const vkil_ticket *ticket)
+{
+	vkil_devctx *devctx = vkil_get_ticket_dev(ticket);
+	int32_t ret;
+
+	if (!devctx)
+		return -ENODEV;
+	ret = ticket_status(devctx, ticket);
+	vkil_deinit_dev((void **)&devctx);
 	return ret;
 }
 
-void vkil_deinit_node_list(vkil_node *ptr)
+/**
+ * @brief wait for tickets, possibly spanning several devices
+ *
+ * the devices get a completion dispatcher if they have none, the waiter
+ * being then woken up by the dispatchers as the responses are deposited.
+ * A ticket is completed once its response can be retrieved without blocking,
+ * or has been retrieved already; or once it is lost, see vkil_ticket_status.
+ * The devices are held open while waiting
+ * @param[in] tickets     tickets to wait for
+ * @param[in] n           number of tickets
+ * @param[in] all         wait for all the tickets, rather than any of them
+ * @param[in] deadline_us time to give up, in vkil_get_time_us time; INT64_MAX
+ *			  for an infinite wait
+ * @return index of a completed ticket, lost or not, zero if all are waited
+ *	   for; -ECANCELED if any of all is lost, -ENODEV if the device of a
+ *	   ticket has been closed, other error code otherwise
+ */
+int32_t vkil_wait_tickets(const vkil_ticket *tickets, const int32_t n,
+			  const int32_t all, const int64_t deadline_us)
 {
-	vkil_node *nxt;
+	vkil_tkt_waiter waiter, **pwaiter;
+	pthread_condattr_t attr;
+	struct timespec ts;
+	vkil_devctx *devctx;
+	int32_t i, ret, status, held, lost = 0, next = 0;
+
+	for (held = 0; held < n; held++)
+		if (!vkil_get_ticket_dev(&tickets[held]))
+			break;
+	ret = (held < n) ? -ENODEV : 0;
+	for (i = 0; !ret && (i < n); i++)
+		ret = vkil_need_dispatcher(tickets[i].devctx);
+	if (ret)
+		goto put;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&waiter.cond, &attr);
+	pthread_condattr_destroy(&attr);
+	waiter.signaled = 0;
+	waiter.tickets = tickets;
+	waiter.n = n;
+
+	pthread_mutex_lock(&vkil_tkt_waiters.lock);
+	waiter.next = vkil_tkt_waiters.head;
+	vkil_tkt_waiters.head = &waiter;
+	atomic_fetch_add_explicit(&vkil_tkt_waiters.n, 1,
+				  memory_order_relaxed);
+	pthread_mutex_unlock(&vkil_tkt_waiters.lock);
+	/* pairs with vkil_tkt_notify: a completion is seen, or notified */
+	atomic_thread_fence(memory_order_seq_cst);
+
+	do {
+		/* the completed tickets stay so, wait_all resumes its scan */
+		for (i = all ? next : 0; i < n; i++) {
+			status = ticket_status(tickets[i].devctx,
+					       &tickets[i]);
+			if (status == -ECANCELED)
+				lost = 1;
+			if (all ? (status == -EINPROGRESS) :
+				  (status != -EINPROGRESS))
+				break;
+		}
+		if (all) {
+			next = i;
+			if (i == n) {
+				ret = lost ? -ECANCELED : 0;
+				break;
+			}
+		} else if (i < n) {
+			ret = i;
+			break;
+		}
 
-	while (ptr) {
-		nxt = ptr->next;
-		if (ptr->data)
-			vkil_free((void **)&ptr->data);
-		vkil_free((void **)&ptr);
-		ptr = nxt;
+		pthread_mutex_lock(&vkil_tkt_waiters.lock);
+		ret = 0;
+		while (!waiter.signaled && (ret != ETIMEDOUT)) {
+			if (deadline_us == INT64_MAX) {
+				pthread_cond_wait(&waiter.cond,
+						  &vkil_tkt_waiters.lock);
+			} else {
+				ts.tv_sec = deadline_us / 1000000;
+				ts.tv_nsec = (deadline_us % 1000000) * 1000;
+				ret = pthread_cond_timedwait(
+						&waiter.cond,
+						&vkil_tkt_waiters.lock, &ts);
+			}
+		}
+		ret = waiter.signaled ? 0 : -ETIMEDOUT;
+		waiter.signaled = 0;
+		pthread_mutex_unlock(&vkil_tkt_waiters.lock);
+	} while (!ret);
+
+	pthread_mutex_lock(&vkil_tkt_waiters.lock);
+	for (pwaiter = &vkil_tkt_waiters.head; *pwaiter != &waiter;
+	     pwaiter = &(*pwaiter)->next)
+		;
+	*pwaiter = waiter.next;
+	atomic_fetch_sub_explicit(&vkil_tkt_waiters.n, 1,
+				  memory_order_relaxed);
+	pthread_mutex_unlock(&vkil_tkt_waiters.lock);
+	pthread_cond_destroy(&waiter.cond);
+
+put:
+	for (i = 0; i < held; i++) {
+		devctx = tickets[i].devctx;
+		vkil_deinit_dev((void **)&devctx);
 	}
+	return ret;
 }
 
 /**
- * @brief denit the device
+ * @brief release all the resources of a device
  *
- * If the caller is the only user, the device is closed
- * @param[in,out] handle handle to the device
- * @return device id if success, error code otherwise
+ * @param devctx device context
  */
-int32_t vkil_deinit_dev(void **handle)
+static void vkil_close_dev(vkil_devctx *devctx)
 {
 	int i;
-	VKIL_LOG(VK_LOG_DEBUG, "");
 
-	if (*handle) {
-		vkil_devctx *devctx = *handle;
+	VKIL_LOG(VK_LOG_DEBUG, "close driver");
+	vkil_stop_dispatcher(devctx);
+	vkil_deinit_msglist(devctx);
+	devctx->tp->close(devctx);
+	pthread_mutex_destroy(&devctx->evt_lock);
+	pthread_mutex_destroy(&devctx->rx_lock);
+	for (i = 0; i < VKIL_MSG_Q_MAX; i++) {
+		pthread_cond_destroy(&devctx->q[i].room);
+		cmpl_flush(&devctx->q[i].cmpl, &devctx->pool);
+	}
+	pthread_mutex_destroy(&devctx->cmpl_lock);
+	vkil_pool_deinit(&devctx->pool);
+	vkil_free((void **)&devctx->rx.blk);
+	vkil_free((void **)&devctx);
+}
 
-		VK_ASSERT(devctx->ref);
+/**
+ * @brief get the ops of a driver transport
+ * @param[in] transport transport, as per vkil_transport
+ * @return transport ops
+ */
+static const vkil_transport_ops *vkil_get_transport_ops(const uint32_t
+							transport)
+{
+	switch (transport) {
+#ifdef VKIL_IO_URING
+	case VKIL_TRANSPORT_URING:
+		return &vkil_uring_ops;
+	case VKIL_TRANSPORT_SQPOLL:
+		return &vkil_sqpoll_ops;
+#endif
+	case VKIL_TRANSPORT_MODEL:
+		return &vkil_model_ops;
+	case VKIL_TRANSPORT_LOOPBACK:
+		return &vkil_loopback_ops;
+	case VKIL_TRANSPORT_MODEL_RING:
+		return &vkil_model_ring_ops;
+	default:
+		return &vkil_kdrv_ops;
+	}
+}
 
-		devctx->ref--;
-		if (!devctx->ref) {
-			VKIL_LOG(VK_LOG_DEBUG, "close driver");
-			vkil_deinit_msglist(devctx);
-			close(devctx->fd);
-			pthread_mutex_destroy(&devctx->mwx);
-			for (i = 0; i < VKIL_MSG_Q_MAX; i++) {
-				vkil_deinit_node_list(devctx->vk2host[i]);
-				devctx->vk2host[i] = NULL;
-			}
-			vkil_free(handle);
+/**
+ * @brief open the driver of a device
+ *
+ * the driver is opened under its name, or its legacy one
+ * @param[in] devctx device context
+ * @param[in] tp     transport to access the driver with
+ * @return zero on success, error code otherwise
+ */
+static int32_t vkil_open_drv(vkil_devctx *devctx, const vkil_transport_ops *tp)
+{
+	static const char * const drv_names[] = {VKIL_DEV_DRV_NAME,
+						 VKIL_DEV_LEGACY_DRV_NAME};
+	char dev_name[30]; /* format: /dev/bcm-vk.x */
+	int32_t ret = -ENODEV;
+	uint32_t i;
+
+	for (i = 0; i < ARRAY_SIZE(drv_names); i++) {
+		snprintf(dev_name, sizeof(dev_name), "%s.%d", drv_names[i],
+			 devctx->id);
+		ret = tp->open(devctx, dev_name);
+		if (!ret) {
+			devctx->tp = tp;
+			VKIL_LOG(VK_LOG_DEBUG, "devctx=%p: %s via %s", devctx,
+				 dev_name, tp->name);
+			return 0;
 		}
 	}
-	return 0;
+	return ret;
 }
 
 /**
- * @brief init the device
+ * @brief open a device
  *
- * open a device if not yet done, otherwise add a reference to
- * existing device
- * @param[in,out] handle handle to the device
- * @return device id if positive, error code otherwise
+ * @param[in]  id      card id
+ * @param[out] handle  handle to the device
+ * @return zero on success, error code otherwise
  */
-int32_t vkil_init_dev(void **handle)
+static int32_t vkil_open_dev(const int32_t id, void **handle)
 {
+	const vkil_transport_ops *tp;
+	pthread_condattr_t attr;
 	vkil_devctx *devctx;
-	int32_t ret;
-	char dev_name[30]; /* format: /dev/bcm-vk.x */
-	const char *p_aff_dev;
+	int32_t i, ret;
 
-	if (!(*handle)) {
-		VKIL_LOG(VK_LOG_DEBUG, "init a new device");
+	VKIL_LOG(VK_LOG_DEBUG, "init a new device %d", id);
+
+	ret = vkil_mallocz(handle, sizeof(*devctx));
+	if (ret)
+		return ret;
+
+	devctx = *handle;
+	devctx->id = id;
+	devctx->reaper = *vkil_get_reaper();
+	devctx->pri_backlog = vkil_get_pri_backlog();
+
+	ret = vkil_init_msglist(devctx);
+	if (ret)
+		goto fail_msglist;
+
+	ret = vkil_pool_init(&devctx->pool);
+	if (ret)
+		goto fail_pool;
+
+	ret = vkil_malloc((void **)&devctx->rx.blk,
+			  sizeof(vk2host_msg) * VKIL_RX_BUF_BLKS);
+	if (ret) {
+		ret = -ENOMEM;
+		goto fail_rx;
+	}
+
+	ret = pthread_mutex_init(&devctx->rx_lock, NULL);
+	if (ret)
+		goto fail_lock;
+	ret = pthread_mutex_init(&devctx->evt_lock, NULL);
+	if (ret)
+		goto fail_evt_lock;
+	ret = pthread_mutex_init(&devctx->cmpl_lock, NULL);
+	if (ret)
+		goto fail_cmpl_lock;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	for (i = 0; i < VKIL_MSG_Q_MAX; i++) {
+		atomic_init(&devctx->q[i].credit.limit, VKIL_CREDIT_MAX);
+		devctx->q[i].lock = &devctx->cmpl_lock;
+		ret = pthread_cond_init(&devctx->q[i].room, &attr);
+		if (ret)
+			break;
+	}
+	pthread_condattr_destroy(&attr);
+	if (ret)
+		goto fail_q_room;
+
+	/* the receive buffer is registered to the io_uring transport */
+	tp = vkil_get_transport_ops(vkil_get_transport());
+	ret = vkil_open_drv(devctx, tp);
+	if (ret && tp->fallback) {
+		VKIL_LOG(VK_LOG_WARNING, "%s unavailable %s(%d), use %s",
+			 tp->name, strerror(-ret), ret, tp->fallback->name);
+		ret = vkil_open_drv(devctx, tp->fallback);
+	}
+	if (ret) {
+		ret = -ENODEV;
+		goto fail_open;
+	}
 
-		ret = vkil_mallocz(handle, sizeof(*devctx));
+	if (vkil_get_completion_mode() == VKIL_CMPL_DISPATCHER) {
+		ret = vkil_start_dispatcher(devctx);
 		if (ret)
-			goto fail;
+			goto fail_dispatcher;
+	}
+	return 0;
 
-		devctx = *handle;
-		devctx->ref++;
-		ret = -ENODEV; /* value to be used for below fails */
+fail_dispatcher:
+	devctx->tp->close(devctx);
+fail_open:
+	i = VKIL_MSG_Q_MAX;
+fail_q_room:
+	while (i--)
+		pthread_cond_destroy(&devctx->q[i].room);
+	pthread_mutex_destroy(&devctx->cmpl_lock);
+fail_cmpl_lock:
+	pthread_mutex_destroy(&devctx->evt_lock);
+fail_evt_lock:
+	pthread_mutex_destroy(&devctx->rx_lock);
+fail_lock:
+	ret = ret < 0 ? ret : -ret; /* error are forced to be negative */
+	vkil_free((void **)&devctx->rx.blk);
+fail_rx:
+	vkil_pool_deinit(&devctx->pool);
+fail_pool:
+	vkil_deinit_msglist(devctx);
+fail_msglist:
+	vkil_free(handle);
+	return ret;
+}
 
-		p_aff_dev = vkil_get_affinity();
-		devctx->id = p_aff_dev ? atoi(p_aff_dev) : 0;
-		if (devctx->id < 0)
-			goto fail;
+/**
+ * @brief deinit the device
+ *
+ * remove a reference to the device, the device being closed once not used
+ * anymore
+ * @param[in,out] handle handle to the device
+ * @return zero
+ */
+int32_t vkil_deinit_dev(void **handle)
+{
+	vkil_devctx *devctx = *handle;
+	vkil_devctx **cursor;
+	int32_t ref;
 
-		if (!snprintf(dev_name, sizeof(dev_name),
-			      VKIL_DEV_DRV_NAME ".%d", devctx->id))
-			goto fail;
+	VKIL_LOG(VK_LOG_DEBUG, "");
 
-		devctx->fd = open(dev_name, O_RDWR);
-		if (devctx->fd < 0) {
-			/* Try legacy name */
-			snprintf(dev_name, sizeof(dev_name),
-				 VKIL_DEV_LEGACY_DRV_NAME ".%d", devctx->id);
+	if (!devctx)
+		return 0;
 
-			devctx->fd = open(dev_name, O_RDWR);
-			if (devctx->fd < 0)
-				goto fail;
+	pthread_mutex_lock(&vkil_devs.lock);
+	VK_ASSERT(devctx->ref);
+	ref = --devctx->ref;
+	if (!ref) {
+		for (cursor = &vkil_devs.head; *cursor != devctx;
+		     cursor = &(*cursor)->next)
+			VK_ASSERT(*cursor);
+		*cursor = devctx->next;
+	}
+	pthread_mutex_unlock(&vkil_devs.lock);
+
+	if (!ref)
+		vkil_close_dev(devctx);
+	*handle = NULL;
+	return 0;
+}
+
+/**
+ * @brief get the number of contexts of the process using a device
+ * @param[in] id card id
+ * @return number of contexts, zero if the device is not opened
+ */
+int32_t vkil_dev_refs(const int32_t id)
+{
+	vkil_devctx *devctx;
+	int32_t ref = 0;
+
+	pthread_mutex_lock(&vkil_devs.lock);
+	for (devctx = vkil_devs.head; devctx; devctx = devctx->next)
+		if (devctx->id == id) {
+			ref = devctx->ref;
+			break;
 		}
+	pthread_mutex_unlock(&vkil_devs.lock);
+	return ref;
+}
 
-		ret = vkil_init_msglist(devctx);
-		if (ret)
-			goto fail;
+/**
+ * @brief init the device
+ *
+ * open the device if not yet done in the process, otherwise add a reference
+ * to the already opened one
+ * @param[in,out] handle handle to the device
+ * @param[in] id card id, used if the handle is not set yet
+ * @return device id if positive, error code otherwise
+ */
+int32_t vkil_init_dev(void **handle, const int32_t id)
+{
+	vkil_devctx *devctx;
+	int32_t ret = 0;
 
-		ret = pthread_mutex_init(&devctx->mwx, NULL);
-		if (ret) {
-			ret = -ret; /* error are forced to be negative */
+	pthread_mutex_lock(&vkil_devs.lock);
+	if (!(*handle)) {
+		if (id < 0) {
+			ret = -ENODEV;
 			goto fail;
 		}
-	} else {
-		devctx = *handle;
-		devctx->ref++;
-	}
 
+		for (devctx = vkil_devs.head; devctx; devctx = devctx->next)
+			if (devctx->id == id)
+				break;
+		if (!devctx) {
+			ret = vkil_open_dev(id, (void **)&devctx);
+			if (ret)
+				goto fail;
+			devctx->serial = ++vkil_devs.serial;
+			devctx->next = vkil_devs.head;
+			vkil_devs.head = devctx;
+		}
+		*handle = devctx;
+	}
+	devctx = *handle;
+	devctx->ref++;
 	VKIL_LOG(VK_LOG_DEBUG, "devctx->fd: %i\n devctx->ref = %i",
 				devctx->fd, devctx->ref);
+	pthread_mutex_unlock(&vkil_devs.lock);
+
 	return devctx->id;
 
 fail:
-	vkil_deinit_dev(handle);
+	pthread_mutex_unlock(&vkil_devs.lock);
 	VKIL_LOG(VK_LOG_ERROR, "device initialization failure %s(%d)",
 		 strerror(-ret), ret);
 	return ret;
@@ -13,17 +13,56 @@
 #ifndef VKIL_INTERNAL_H
 #define VKIL_INTERNAL_H
 
+#include <errno.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <pthread.h>
+#include <sys/uio.h>
+#include "vkil_api.h"
+#include "vkil_backend.h"
 #include "vkil_utils.h"
 
 /** max number of message queues used shall not be gretaer than VK_MSG_Q_NR */
 #define VKIL_MSG_Q_MAX 3
 
+/*
+ * processing priority lanes: once a processing priority has been set, a
+ * context gets by default the queue of its priority, high (0), med (1) or
+ * low (2), otherwise it stays on queue 0; the high lane is the one drained
+ * first, as the kernel driver does
+ */
+/** queue of the high priority lane */
+#define VKIL_PRI_HIGH_Q 0
+/** queue of the low priority lane, deferred on a high lane backlog */
+#define VKIL_PRI_LOW_Q  2
+
 /* name of driver dev node */
 #define VKIL_DEV_DRV_NAME		"/dev/bcm_vk"
 #define VKIL_DEV_LEGACY_DRV_NAME	"/dev/bcm-vk"
 
+/** number of msg_id which can be encoded in a message */
+#define VKIL_MSG_ID_MAX (1 << MSG_ID_BIT_WIDTH)
+/** number of 64 bits words in the msg_id allocation bitmap */
+#define VKIL_MSG_ID_WORDS (VKIL_MSG_ID_MAX / 64)
+/** number of generations of a msg_id whose lost responses are recorded */
+#define VKIL_LOST_GENS 64
+
+/**
+ * @brief completion of a command issued asynchronously
+ *
+ * embedded in the API level state of the command
+ */
+typedef struct _vkil_async {
+	/**
+	 * called by the driver reader once the response is deposited in the
+	 * completion table, for it to be retrieved by msg_id
+	 */
+	void (*done)(struct _vkil_async *async, const int32_t msg_id);
+	int32_t msg_id;      /**< msg_id of the command */
+	uint32_t queue_id;   /**< queue of the command */
+	uint32_t context_id; /**< context of the command */
+} vkil_async;
+
 /**
  * Each emitted message is associated to an unique message id, which can as
  * well carries user_data.
@@ -31,53 +70,505 @@
  * same _vkil_msg_id (hence the same user data)
  */
 typedef struct _vkil_msg_id {
-	int16_t used;         /**< indicte a associated intransit message */
-	int16_t reserved[3];  /**< byte alignment purpose */
 	int64_t user_data;    /**< associated sw data */
+	int64_t submit_us;    /**< time the message has been written */
+	int64_t deadline_us;  /**< time its response is reaped, 0 for never */
+	uint32_t function_id; /**< function of the written message */
+	int32_t shared;       /**< taken from the msg_ids shared by contexts */
+	int32_t abandoned;    /**< given up on, the response is discarded */
+	uint32_t context_id;  /**< context of an abandoned message */
+	uint32_t queue_id;    /**< queue an abandoned message is filed in */
+	/** queue credits held by the messages written, response not read */
+	atomic_int credits;
+	vkil_async *async;    /**< completion of an asynchronous command */
+	atomic_uint gen;      /**< bumped each time the msg_id is returned */
+	/**
+	 * lost responses of the last VKIL_LOST_GENS generations, the bit
+	 * gen % VKIL_LOST_GENS telling if the response of the command of
+	 * generation gen was lost
+	 */
+	atomic_ullong lost;
+	struct _vkil_msg_account *owner; /**< context holding the msg_id */
 } vkil_msg_id;
 
+/**
+ * @brief msg_id accounting of a context
+ *
+ * the first reserved in flight messages of a context use msg_ids set aside
+ * for it; the next ones, up to max, are taken from the msg_ids shared by all
+ * the contexts of the device. The account outlives its context until all its
+ * msg_ids are returned
+ */
+typedef struct _vkil_msg_account {
+	pthread_mutex_t lock;
+	int32_t inflight; /**< msg_ids held by the context */
+	int32_t held;     /**< msg_ids held, among the ones set aside */
+	int32_t charged;  /**< max(reserved, held), set aside on the device */
+	int32_t max;      /**< max in flight messages, 0 for no limit */
+	int32_t reserved; /**< msg_ids set aside for the context */
+	int32_t detached; /**< the context is gone */
+} vkil_msg_account;
+
+/**
+ * @brief notification of the responses deposited for a card context
+ *
+ * the eventfd counts the responses deposited in the completion tables since
+ * it was last read
+ */
+typedef struct _vkil_evt {
+	uint32_t context_id; /**< card context notified */
+	int fd; /**< eventfd */
+	struct _vkil_evt *next;
+} vkil_evt;
+
 /**
  * @brief message list context keeping track of all intransit messages
+ *
+ * the in transit state of a msg_id is held in a bitmap, a set bit indicating
+ * an associated intransit message. The bitmap is only accessed via atomic
+ * operations so that no lock is required to get or return a msg_id
  */
 typedef struct _vkil_msgid_ctx {
 	vkil_msg_id *msg_list; /**< outgoing message list */
+	/** intransit msg_id bitmap */
+	_Atomic uint64_t used[VKIL_MSG_ID_WORDS];
+	atomic_uint hint; /**< bitmap word to start the next search from */
 	/**
-	 * all writing operation on the list are accessed thru the mwx mutex
-	 * (memory barrier)
+	 * (msg_ids set aside for the contexts << 32) | shared msg_ids in use,
+	 * the sum never exceeding the number of msg_ids
 	 */
-	pthread_mutex_t mwx;
+	_Atomic uint64_t budget;
 } vkil_msgid_ctx;
 
+/** number of buckets in the (context_id, function_id) completion index */
+#define VKIL_CMPL_FN_BUCKETS 256
+
+/** max expected return message size, can be locally overidden */
+#define VKIL_RET_MSG_MAX_SIZE 16
+
+/**
+ * @brief a message dequeued from the driver, waiting to be retrieved
+ *
+ * the message is stored right after the node, both coming from the device
+ * message pool
+ */
+typedef struct _vkil_cmpl_node {
+	vk2host_msg *msg;
+	struct _vkil_cmpl_node *id_next; /**< next node with the same msg_id */
+	struct _vkil_cmpl_node *fn_prev; /**< previous node in the fn bucket */
+	struct _vkil_cmpl_node *fn_next; /**< next node in the fn bucket */
+	_Atomic uint32_t pool_next; /**< next free node (index + 1) */
+	int32_t pool_cls; /**< size class, VKIL_POOL_HEAP if not pooled */
+} vkil_cmpl_node;
+
+/** number of message size classes in a message pool */
+#define VKIL_POOL_CLASSES 3
+/** size class of a node allocated on the heap */
+#define VKIL_POOL_HEAP (-1)
+
+/**
+ * @brief fixed size node+message objects of a message pool
+ *
+ * the free objects are kept in a lock-free LIFO; the head holds the index of
+ * the first free object, tagged with a counter incremented at each update so
+ * that a concurrent pop/push sequence can't be mistaken for no change
+ */
+typedef struct _vkil_pool_class {
+	_Atomic uint64_t head; /**< (tag << 32) | (index + 1), 0 if empty */
+	uint8_t *slab; /**< the class objects, cache line aligned */
+	uint32_t obj_size; /**< multiple of a cache line */
+	int32_t max_size; /**< max vk2host_msg::size held in the class */
+} vkil_pool_class;
+
+/**
+ * @brief per device pool of messages dequeued from the driver
+ */
+typedef struct _vkil_msg_pool {
+	vkil_pool_class cls[VKIL_POOL_CLASSES]; /**< by increasing size */
+} vkil_msg_pool;
+
+/**
+ * @brief FIFO of the nodes hashed in a (context_id, function_id) bucket
+ */
+typedef struct _vkil_cmpl_bucket {
+	vkil_cmpl_node *head;
+	vkil_cmpl_node *tail;
+} vkil_cmpl_bucket;
+
+/**
+ * @brief completion table holding the dequeued messages of a queue
+ *
+ * messages are directly indexed by msg_id; they are also hashed on
+ * (context_id, function_id) for retrieval by callers not knowing the msg_id
+ * (VK_CMD_OPT_CB calls). In both cases deposit and retrieval are done in
+ * constant time
+ */
+typedef struct _vkil_cmpl_table {
+	vkil_cmpl_node *by_id[VKIL_MSG_ID_MAX];
+	vkil_cmpl_bucket by_fn[VKIL_CMPL_FN_BUCKETS];
+} vkil_cmpl_table;
+
+/**
+ * @brief support of poll by the driver, to wait for incoming messages
+ */
+typedef enum _vkil_poll_mode {
+	VKIL_POLL_SUPPORTED   = 0, /**< assumed until proven otherwise */
+	VKIL_POLL_UNSUPPORTED = 1, /**< driver is periodically probed */
+} vkil_poll_mode;
+
+/** size of the device receive buffer, in vk2host_msg blocks */
+#define VKIL_RX_BUF_BLKS 1024
+
+/**
+ * @brief messages read from the driver at once, not yet dequeued
+ *
+ * the messages are stored back to back, each one spanning
+ * (vk2host_msg::size + 1) blocks
+ */
+typedef struct _vkil_rx_buf {
+	vk2host_msg *blk;
+	int32_t len; /**< number of blocks read */
+	int32_t pos; /**< first block not yet dequeued */
+} vkil_rx_buf;
+
+/**
+ * @brief who reads the completions from the driver
+ */
+typedef enum _vkil_cmpl_mode {
+	VKIL_CMPL_CALLER     = 0, /**< the waiting caller reads the driver */
+	VKIL_CMPL_DISPATCHER = 1, /**< a per device thread reads the driver */
+} vkil_cmpl_mode;
+
+/**
+ * @brief how the driver is accessed
+ */
+typedef enum _vkil_transport {
+	VKIL_TRANSPORT_SYNC     = 0, /**< direct read and write calls */
+	VKIL_TRANSPORT_URING    = 1, /**< io_uring rings */
+	VKIL_TRANSPORT_SQPOLL   = 2, /**< io_uring, kernel thread submission */
+	VKIL_TRANSPORT_MODEL    = 3, /**< user space driver model */
+	VKIL_TRANSPORT_LOOPBACK = 4, /**< in process card, doing nothing */
+	VKIL_TRANSPORT_MODEL_RING = 5, /**< driver model shared memory rings */
+} vkil_transport;
+
+/* the io_uring transports, if built, are only used on request */
+#if defined(VKDRV_USERMODEL)
+#define VKIL_DEF_TRANSPORT VKIL_TRANSPORT_MODEL
+#else
+#define VKIL_DEF_TRANSPORT VKIL_TRANSPORT_SYNC
+#endif
+
+/** io_uring transport of a device */
+typedef struct _vkil_uring vkil_uring;
+
+struct _vkil_devctx;
+
+/**
+ * @brief driver transport of a device
+ *
+ * the functions are called with the device context, and return a negative
+ * error code on failure
+ */
+typedef struct _vkil_transport_ops {
+	const char *name;
+	/** open the driver of the dev_name card */
+	int32_t (*open)(struct _vkil_devctx *devctx, const char *dev_name);
+	void (*close)(struct _vkil_devctx *devctx);
+	/**
+	 * write messages, one per vector; return the number of bytes
+	 * written, a short write stopping on a message boundary
+	 */
+	ssize_t (*submit)(struct _vkil_devctx *devctx,
+			  const struct iovec *iov, const int iovcnt);
+	/**
+	 * read messages back to back, without waiting, for q_id preferably;
+	 * return the number of bytes read, -ENOMSG if there is none, or
+	 * -EMSGSIZE if the first one doesn't fit in nbytes
+	 */
+	ssize_t (*reap)(struct _vkil_devctx *devctx, const int32_t q_id,
+			void *buf, const size_t nbytes);
+	/**
+	 * wait up to timeout_ms (infinite if negative) for messages to
+	 * read; return 1 if there are, 0 otherwise
+	 */
+	int32_t (*poll)(struct _vkil_devctx *devctx, const int timeout_ms);
+	/** stop reading ahead, poll being unreliable; optional */
+	void (*rx_stop)(struct _vkil_devctx *devctx);
+	/** transport to use if this one can't be opened; optional */
+	const struct _vkil_transport_ops *fallback;
+} vkil_transport_ops;
+
+extern const vkil_transport_ops vkil_kdrv_ops;
+extern const vkil_transport_ops vkil_model_ops;
+extern const vkil_transport_ops vkil_loopback_ops;
+extern const vkil_transport_ops vkil_model_ring_ops;
+#ifdef VKIL_IO_URING
+extern const vkil_transport_ops vkil_uring_ops;
+extern const vkil_transport_ops vkil_sqpoll_ops;
+#endif
+
+/**
+ * @brief caller waiting for the driver reader to deposit a message
+ */
+typedef struct _vkil_waiter {
+	pthread_cond_t cond; /**< signaled when the message is deposited */
+	const vk2host_msg *message; /**< message waited for */
+	struct _vkil_waiter *next;
+} vkil_waiter;
+
+/**
+ * @brief caller waiting for tickets, possibly spanning several devices
+ */
+typedef struct _vkil_tkt_waiter {
+	pthread_cond_t cond; /**< signaled when a ticket command completes */
+	int32_t signaled; /**< a ticket command completed since last checked */
+	const vkil_ticket *tickets; /**< tickets waited for */
+	int32_t n; /**< number of tickets */
+	struct _vkil_tkt_waiter *next;
+} vkil_tkt_waiter;
+
+/** max credits of a queue, as many as the messages which can be in flight */
+#define VKIL_CREDIT_MAX VKIL_MSG_ID_MAX
+/** min credits of a queue, whatever the driver queue depth observed */
+#define VKIL_CREDIT_MIN 1
+
+/**
+ * @brief flow control of the messages written to a driver queue
+ *
+ * a message takes a credit when written, and gives it back once its
+ * response has been read from the driver; its msg_id entry keeps count of
+ * the credits, so that a response without one gives none back. The limit
+ * starts at VKIL_CREDIT_MAX; it is cut down to the messages in flight each
+ * time the driver reports the queue full, and grows back by one credit each
+ * time as many responses as the limit have been read
+ */
+typedef struct _vkil_credit {
+	atomic_int inflight; /**< messages written, response not read yet */
+	atomic_int limit;    /**< max messages in flight */
+	atomic_int acked;    /**< responses read since the last increase */
+} vkil_credit;
+
+/**
+ * @brief completion state of a queue
+ */
+typedef struct _vkil_queue {
+	/** protect the completion table and waiters, the device cmpl_lock */
+	pthread_mutex_t *lock;
+	vkil_cmpl_table cmpl; /**< dequeued messages */
+	vkil_waiter *waiters; /**< callers waiting for a message */
+	vkil_credit credit; /**< flow control, lock free */
+	/** signaled when a credit is given back, or the reader role released */
+	pthread_cond_t room;
+	uint32_t room_seq; /**< bumped each time room is signaled */
+} vkil_queue;
+
+/**
+ * @brief per device completion dispatcher
+ */
+typedef struct _vkil_dispatcher_ctx {
+	pthread_t thread;
+	atomic_int stop; /**< request the thread to exit */
+	int32_t running; /**< the thread is the driver reader */
+} vkil_dispatcher_ctx;
+
+/**
+ * @brief response latency statistic of a function
+ *
+ * exponentially weighted moving average of the latency and of its mean
+ * deviation; updated by the driver reader only, but read by any waiter
+ */
+typedef struct _vkil_lat_stat {
+	atomic_llong mean_us;
+	atomic_llong dev_us;
+} vkil_lat_stat;
+
+/**
+ * default time a blocking call waits for; long enough to allow for non real
+ * time transcoding scheme, short enough to bail-out quickly on unresponsive
+ * card. If set to zero, the wait can then be infinite
+ */
+#define VKIL_TIMEOUT_MS  (30 * 1000)
+
+/** default time a response is kept, waiting to be retrieved */
+#define VKIL_REAP_TIMEOUT_MS (120 * 1000)
+
+/** number of context roles, the role being encoded on 4 bits */
+#define VKIL_ROLE_NR (VK_ROLE_MAX + 1)
+
+/** max number of cards tracked by the shared load table */
+#define VKIL_LOAD_CARDS_MAX 16
+
+/**
+ * @brief largest response seen per (function_id, context role)
+ *
+ * used to size the response buffers, so that a response larger than
+ * expected is retrieved in a single pass once its size has been seen
+ */
+typedef struct _vkil_resp_size_cache {
+	atomic_int size[VK_FID_MAX][VKIL_ROLE_NR];
+	/** responses larger than expected retrieved in a single pass */
+	atomic_ullong retries_avoided;
+} vkil_resp_size_cache;
+
 /**
  * @brief The device context
+ *
+ * a device context is shared by all the vkil contexts of the process using
+ * the same card
  */
 typedef struct _vkil_devctx {
-	int fd;      /**< driver */
-	int32_t ref; /**< number of vkilctx instance using the device */
+	int fd;      /**< driver, if accessed via a file descriptor */
+	const vkil_transport_ops *tp; /**< how the driver is accessed */
+	void *tp_priv; /**< transport private data */
+	int32_t ref; /**< number of vkilctx using the device, registry locked */
 	int32_t id;  /**< card id */
-	vkil_node *vk2host[VKIL_MSG_Q_MAX]; /**< dequeued messages */
-	pthread_mutex_t mwx; /** protect concurrent access to the msg queue */
+	uint32_t serial; /**< tells apart the openings, for the tickets */
+	struct _vkil_devctx *next; /**< next opened device */
+	/**
+	 * single lock of the completion state of all the queues: splitting it
+	 * per queue has shown no gain so far (see bench_vkil_queues)
+	 */
+	pthread_mutex_t cmpl_lock;
+	vkil_queue q[VKIL_MSG_Q_MAX]; /**< per queue completion state */
+	vkil_msg_pool pool; /**< storage of the dequeued messages */
+	/**
+	 * held by the driver reader, the only thread accessing the fields
+	 * below up to lat, and the only one updating lat
+	 */
+	pthread_mutex_t rx_lock;
+	vkil_rx_buf rx;
+	vkil_poll_mode poll_mode; /**< how to wait for incoming messages */
+	int32_t poll_spurious; /**< consecutive poll wake ups without message */
+	int64_t reap_us; /**< next scan for stale responses */
+	vkil_lat_stat lat[VK_FID_MAX]; /**< response latency per function */
 	vkil_msgid_ctx msgid_ctx;
+	vkil_resp_size_cache resp; /**< response sizes seen */
+	vkil_reaper reaper; /**< how stale responses are reaped */
+	/** high lane messages in flight deferring the low lane, 0 for never */
+	int32_t pri_backlog;
+	atomic_ullong reaped; /**< stale responses reaped */
+	atomic_int nabandoned; /**< msg_ids given up on, not returned yet */
+	vkil_dispatcher_ctx dispatcher; /**< completion dispatcher, if any */
+	/** protect evt and the dispatcher start */
+	pthread_mutex_t evt_lock;
+	vkil_evt *evt; /**< contexts notified of their responses */
+	atomic_int nevt; /**< number of contexts notified */
+	vkil_uring *uring; /**< io_uring rings, NULL if not used */
 } vkil_devctx;
 
+/** max number of blocks staged in a submission batch */
+#define VKIL_BATCH_MAX_BLKS 64
+
+/**
+ * @brief messages staged in a context, to be written at once
+ *
+ * the messages are stored back to back, each one spanning
+ * (host2vk_msg::size + 1) blocks
+ */
+typedef struct _vkil_batch {
+	int32_t open; /**< the deferrable messages are staged */
+	int32_t nmsgs;
+	int32_t nblks;
+	host2vk_msg blk[VKIL_BATCH_MAX_BLKS];
+} vkil_batch;
+
 typedef struct _vkil_context_internal {
-	int32_t reserved;
+	vkil_wait_policy wait_policy; /**< how to wait for card responses */
+	int64_t deadline_us; /**< blocking calls give up time, 0 for none */
+	vkil_batch batch; /**< submission batch */
+	vkil_msg_account *msg_account; /**< msg_ids held by the context */
+	vkil_evt *evt; /**< pending responses notification, if requested */
+	pthread_mutex_t async_lock; /**< protect async_list */
+	/** signaled once the last asynchronous command is completed */
+	pthread_cond_t async_idle;
+	/** asynchronous commands not completed */
+	struct _vkil_async_cmd *async_list;
+	vkil_ticket ticket; /**< ticket of the last command written */
+	int32_t load_card; /**< card the load is published on, -1 if none */
+	int64_t load_rate; /**< estimated pixel rate published */
 } vkil_context_internal;
 
+/**
+ * @brief asynchronous command
+ *
+ * the command completes once both its submission has returned and its
+ * response has been deposited, whichever comes last
+ */
+typedef struct _vkil_async_cmd {
+	vkil_async async;
+	atomic_int pending; /**< submission and response to come */
+	/** in the async_list of the context, until completed */
+	struct _vkil_async_cmd *next, **pprev;
+	int32_t msg_id; /**< msg_id of the deposited response */
+	const vkil_context *ilctx;
+	vkil_buffer *buffer;
+	vkil_command_t cmd; /**< command and options */
+	uint32_t fid; /**< function of the command */
+	vkil_done_cb cb;
+	void *cookie; /**< passed to cb */
+} vkil_async_cmd;
+
+struct _vkil_prepared_cmd {
+	const vkil_context *ilctx;
+	vkil_command_t cmd; /**< command and options */
+	uint32_t type; /**< type of the buffers to submit */
+	uint32_t nbuf; /**< number of handles carried by the message */
+	host2vk_msg msg[]; /**< template, msg_id left unset */
+};
+
 int32_t vkil_write(vkil_devctx * const devctx, host2vk_msg * const msg);
+int32_t vkil_write_wait(vkil_devctx * const devctx, host2vk_msg * const msg,
+			const int64_t deadline_us);
+int32_t vkil_reap_stale(vkil_devctx *devctx);
+int32_t vkil_writev(vkil_devctx * const devctx, host2vk_msg * const blk,
+		    const int32_t nmsgs);
 int32_t vkil_read(vkil_devctx * const devctx, vk2host_msg * const msg,
-		  const int32_t wait);
-int32_t vkil_init_dev(void **handle);
+		  const int64_t deadline_us, const vkil_wait_policy *policy);
+int32_t vkil_get_resp_size(vkil_devctx *devctx, const uint32_t fid,
+			   const uint32_t role, const int32_t size);
+void vkil_learn_resp_size(vkil_devctx *devctx, const vk2host_msg *msg,
+			  const uint32_t role, const int32_t size,
+			  const int32_t status);
+int32_t vkil_init_dev(void **handle, const int32_t id);
+int32_t vkil_dev_refs(const int32_t id);
+
 int32_t vkil_deinit_dev(void **handle);
 
-int32_t vkil_get_msg_id(vkil_devctx *devctx);
+int32_t vkil_get_msg_id(vkil_devctx *devctx, vkil_msg_account *acct);
 int32_t vkil_return_msg_id(vkil_devctx *devctx, const int32_t msg_id);
+int32_t vkil_new_msg_account(vkil_msg_account **acct);
+int32_t vkil_set_msg_account(vkil_devctx *devctx, vkil_msg_account *acct,
+			     const int32_t max, const int32_t reserved);
+void vkil_detach_msg_account(vkil_devctx *devctx, vkil_msg_account *acct);
+int32_t vkil_set_msg_async(vkil_devctx *devctx, const host2vk_msg *msg,
+			   vkil_async *async);
+int32_t vkil_abandon_msg_async(vkil_devctx *devctx, vkil_async *async);
+int32_t vkil_need_dispatcher(vkil_devctx *devctx);
+int32_t vkil_new_evt(vkil_devctx *devctx, const uint32_t context_id,
+		     vkil_evt **evt);
+void vkil_del_evt(vkil_devctx *devctx, vkil_evt **evt);
+void vkil_set_ticket(vkil_devctx *devctx, const host2vk_msg *msg,
+		     vkil_ticket *ticket);
+int32_t vkil_ticket_status(const vkil_ticket *ticket);
+int32_t vkil_wait_tickets(const vkil_ticket *tickets, const int32_t n,
+			  const int32_t all, const int64_t deadline_us);
 
 int32_t vkil_set_msg_user_data(vkil_devctx *devctx, const int32_t msg_id,
 			       const uint64_t user_data);
 int32_t vkil_get_msg_user_data(vkil_devctx *devctx, const int32_t msg_id,
 			       uint64_t *user_data);
 
+void vkil_load_add(const int32_t card, const uint32_t role,
+		   const int32_t nctx, const int64_t rate);
+int32_t vkil_load_scan(void);
+int32_t vkil_load_set_name(const char *name);
+int32_t vkil_load_get(const int32_t card, uint64_t *rate, uint32_t *nctx);
+
+int32_t vkil_get_parameter(void *handle, const vkil_parameter_t field,
+			   void *value, const vkil_command_t cmd);
+int32_t vkil_place_pick(const int32_t *id, const uint32_t *load,
+			const int32_t n);
+
 const char *vkil_function_id_str(uint32_t function_id);
 const char *vkil_cmd_str(uint32_t cmd);
 const char *vkil_cmd_opts_str(uint32_t cmd);
@@ -0,0 +1,438 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+ * Copyright 2018-2020 Broadcom.
+ */
+
+/**
+ * @file
+ * @brief card load table shared by the vkil processes of a user
+ *
+ * each process publishes, in a slot of a shared memory segment, the number of
+ * contexts it has open per card and role, along with their estimated pixel
+ * rate; so that the automatic placement balances the cards across the
+ * processes without querying them.
+ *
+ * the table is lock free: a slot is only written by its owner, the counters
+ * being atomics, and claimed by a compare and swap of its pid. A process
+ * dying without cleaning up leaves its slot behind; the slot is ignored once
+ * its owner is found dead, and recycled by the next process claiming one.
+ * The owner start time tells apart a recycled pid.
+ *
+ * the segment is private to the user, and the slots of the other processes
+ * are checked for sane values before being accounted
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "vkil_internal.h"
+#include "vkil_utils.h"
+
+/** name of the shared memory segment, as found in /dev/shm, per user id */
+#define VKIL_LOAD_SHM_NAME "/vkil-load-%u"
+/** "VKL1", to be bumped on any layout change */
+#define VKIL_LOAD_MAGIC 0x314c4b56
+/** max number of processes publishing their load */
+#define VKIL_LOAD_SLOTS 256
+/** max contexts per role a process may have on a card, beyond is garbage */
+#define VKIL_LOAD_NCTX_MAX 4096
+/** max pixel rate a process may have on a card, beyond is garbage */
+#define VKIL_LOAD_RATE_MAX (1ULL << 40)
+
+/**
+ * @brief load of a process on a card
+ */
+typedef struct _vkil_load_card {
+	atomic_uint nctx[VKIL_ROLE_NR]; /**< open contexts per role */
+	atomic_ullong rate; /**< estimated pixels per second */
+} vkil_load_card;
+
+/**
+ * @brief slot of a process
+ */
+typedef struct _vkil_load_slot {
+	/** owner, 0 if free, negated while being claimed */
+	atomic_int pid;
+	/** owner start time, in clock ticks since boot, 0 if unknown */
+	atomic_ullong start;
+	vkil_load_card card[VKIL_LOAD_CARDS_MAX];
+} vkil_load_slot;
+
+/**
+ * @brief shared table, zero filled on creation
+ */
+typedef struct _vkil_load_table {
+	atomic_uint magic; /**< set by the first process mapping the table */
+	vkil_load_slot slot[VKIL_LOAD_SLOTS];
+} vkil_load_table;
+
+/**
+ * @brief process view of the shared table
+ */
+static struct _vkil_load {
+	pthread_mutex_t lock; /**< serialize the mapping and the slot claim */
+	int32_t failed;  /**< the table can't be used, not to be retried */
+	vkil_load_table *table; /**< NULL until mapped */
+	vkil_load_slot *slot; /**< slot of the process, NULL until claimed */
+	pid_t pid; /**< slot owner, a forked child claiming its own slot */
+	char name[32]; /**< segment name, the per user one if empty */
+	/** slot owners alive at the last scan, 0 for none */
+	pid_t live[VKIL_LOAD_SLOTS];
+} vkil_load = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/**
+ * @brief get the start time of a process
+ *
+ * as found in the 22nd field of /proc/<pid>/stat
+ * @param pid process id
+ * @return start time in clock ticks since boot, 0 if unknown
+ */
+static uint64_t load_start_time(const pid_t pid)
+{
+	char path[32], buf[512], *p;
+	ssize_t len;
+	int32_t i;
+	int fd;
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0)
+		return 0;
+	buf[len] = '\0';
+
+	/* the command name may hold spaces, the fields are counted after it */
+	p = strrchr(buf, ')');
+	for (i = 2; p && (i < 22); i++)
+		p = strchr(p + 1, ' ');
+	return p ? strtoull(p + 1, NULL, 10) : 0;
+}
+
+/**
+ * @brief tell if the owner of a slot is alive
+ * @param slot slot
+ * @param pid  owner pid, as read from the slot
+ * @return non zero if alive
+ */
+static int32_t load_alive(vkil_load_slot *slot, const pid_t pid)
+{
+	const pid_t owner = (pid < 0) ? -pid : pid;
+	uint64_t start, now;
+
+	/* a process of another user exists, even if not to be signaled */
+	if (kill(owner, 0) && (errno != EPERM))
+		return 0;
+	/* a claim in progress hasn't recorded the start time yet */
+	if (pid < 0)
+		return 1;
+
+	start = atomic_load_explicit(&slot->start, memory_order_relaxed);
+	now = load_start_time(owner);
+	return !start || !now || (start == now);
+}
+
+/**
+ * @brief map the shared table
+ *
+ * the first process to get the segment sizes it; the table is left unused
+ * if the segment has a foreign layout, or could be written by another user
+ * @return zero on success, error code otherwise
+ * @pre vkil_load.lock is held
+ */
+static int32_t load_map(void)
+{
+	const size_t size = sizeof(vkil_load_table);
+	const uid_t uid = geteuid();
+	vkil_load_table *table;
+	uint32_t magic = 0;
+	struct stat st;
+	char name[32];
+	int32_t ret;
+	int fd;
+
+	if (vkil_load.table)
+		return 0;
+	if (vkil_load.failed)
+		return -ENOENT;
+
+	if (vkil_load.name[0])
+		snprintf(name, sizeof(name), "%s", vkil_load.name);
+	else
+		snprintf(name, sizeof(name), VKIL_LOAD_SHM_NAME,
+			 (unsigned int)uid);
+	fd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		ret = -errno;
+		goto fail;
+	}
+	if (fstat(fd, &st)) {
+		ret = -errno;
+		goto fail_fd;
+	}
+	/* a segment created beforehand by someone else is not trusted */
+	if ((st.st_uid != uid) || (st.st_mode & (S_IRWXG | S_IRWXO))) {
+		ret = -EPERM;
+		goto fail_fd;
+	}
+	if (!st.st_size && ftruncate(fd, size)) {
+		ret = -errno;
+		goto fail_fd;
+	}
+	if (st.st_size && (st.st_size != (off_t)size)) {
+		ret = -EPROTO;
+		goto fail_fd;
+	}
+
+	table = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (table == MAP_FAILED) {
+		ret = -errno;
+		goto fail;
+	}
+	if (!atomic_compare_exchange_strong(&table->magic, &magic,
+					    VKIL_LOAD_MAGIC) &&
+	    (magic != VKIL_LOAD_MAGIC)) {
+		munmap(table, size);
+		ret = -EPROTO;
+		goto fail;
+	}
+
+	vkil_load.table = table;
+	return 0;
+
+fail_fd:
+	close(fd);
+fail:
+	vkil_load.failed = 1;
+	VKIL_LOG(VK_LOG_WARNING, "no shared load table %s(%d)",
+		 strerror(-ret), ret);
+	return ret;
+}
+
+/**
+ * @brief use a segment of the given name instead of the per user one
+ *
+ * meant for the tests, which are not to publish their fake loads to the
+ * other processes of the user; to be called before the table is mapped
+ * @param name segment name, starting with a '/'
+ * @return zero on success, error code otherwise
+ */
+int32_t vkil_load_set_name(const char *name)
+{
+	int32_t ret = 0;
+
+	if (!name || (name[0] != '/') ||
+	    (strlen(name) >= sizeof(vkil_load.name)))
+		return -EINVAL;
+
+	pthread_mutex_lock(&vkil_load.lock);
+	if (vkil_load.table) {
+		ret = -EBUSY;
+		goto out;
+	}
+	snprintf(vkil_load.name, sizeof(vkil_load.name), "%s", name);
+	/* the per user segment having failed says nothing of this one */
+	vkil_load.failed = 0;
+out:
+	pthread_mutex_unlock(&vkil_load.lock);
+	return ret;
+}
+
+/**
+ * @brief claim a slot for the process
+ *
+ * a free slot, or one whose owner is dead, is taken over; the counters are
+ * cleared before the slot is published under the process pid
+ * @return zero on success, error code otherwise
+ * @pre vkil_load.lock is held, and the table mapped
+ */
+static int32_t load_claim(void)
+{
+	const pid_t pid = getpid();
+	vkil_load_slot *slot;
+	int32_t i, j, k;
+	int owner;
+
+	for (i = 0; i < VKIL_LOAD_SLOTS; i++) {
+		slot = &vkil_load.table->slot[i];
+		owner = atomic_load(&slot->pid);
+		if (owner && load_alive(slot, owner))
+			continue;
+		if (!atomic_compare_exchange_strong(&slot->pid, &owner, -pid))
+			continue;
+
+		atomic_store_explicit(&slot->start, load_start_time(pid),
+				      memory_order_relaxed);
+		for (j = 0; j < VKIL_LOAD_CARDS_MAX; j++) {
+			for (k = 0; k < VKIL_ROLE_NR; k++)
+				atomic_store_explicit(&slot->card[j].nctx[k],
+						      0, memory_order_relaxed);
+			atomic_store_explicit(&slot->card[j].rate, 0,
+					      memory_order_relaxed);
+		}
+		atomic_store_explicit(&slot->pid, pid, memory_order_release);
+
+		vkil_load.slot = slot;
+		vkil_load.pid = pid;
+		return 0;
+	}
+
+	VKIL_LOG(VK_LOG_WARNING, "shared load table full");
+	return -ENOSPC;
+}
+
+/**
+ * @brief publish a load variation of the process
+ *
+ * the table is mapped, and the process slot claimed, on first use; the
+ * variation is dropped if the table can't be used
+ * @param card card id
+ * @param role role of the context
+ * @param nctx variation of the number of contexts
+ * @param rate variation of the pixel rate
+ */
+void vkil_load_add(const int32_t card, const uint32_t role,
+		   const int32_t nctx, const int64_t rate)
+{
+	vkil_load_card *load;
+
+	if ((card < 0) || (card >= VKIL_LOAD_CARDS_MAX) ||
+	    (role >= VKIL_ROLE_NR))
+		return;
+
+	pthread_mutex_lock(&vkil_load.lock);
+	if (load_map() ||
+	    ((!vkil_load.slot || (vkil_load.pid != getpid())) &&
+	     load_claim())) {
+		pthread_mutex_unlock(&vkil_load.lock);
+		return;
+	}
+
+	/* unsigned arithmetic, a negative variation wraps as expected */
+	load = &vkil_load.slot->card[card];
+	atomic_fetch_add_explicit(&load->nctx[role], nctx,
+				  memory_order_relaxed);
+	atomic_fetch_add_explicit(&load->rate, rate, memory_order_relaxed);
+	pthread_mutex_unlock(&vkil_load.lock);
+}
+
+/**
+ * @brief read the load of a slot on a card, checking it is sane
+ *
+ * the table can be written by any process of the user, so a slot holding
+ * out of range values is taken as garbage rather than trusted
+ * @param[in]  load load of the slot on the card
+ * @param[out] rate estimated pixels per second
+ * @param[out] nctx number of contexts open
+ * @return zero if sane, -EINVAL otherwise
+ */
+static int32_t load_read(const vkil_load_card *load, uint64_t *rate,
+			 uint32_t *nctx)
+{
+	uint32_t n;
+	int32_t i;
+
+	*rate = atomic_load_explicit(&load->rate, memory_order_relaxed);
+	if (*rate > VKIL_LOAD_RATE_MAX)
+		return -EINVAL;
+	*nctx = 0;
+	for (i = 0; i < VKIL_ROLE_NR; i++) {
+		n = atomic_load_explicit(&load->nctx[i], memory_order_relaxed);
+		if (n > VKIL_LOAD_NCTX_MAX)
+			return -EINVAL;
+		*nctx += n;
+	}
+	return 0;
+}
+
+/**
+ * @brief find out the processes alive in the shared table
+ *
+ * their loads are the ones accounted by vkil_load_get, until the next scan;
+ * a slot with an insane load on any card is left out
+ * @return zero on success, error code if the table can't be used
+ */
+int32_t vkil_load_scan(void)
+{
+	vkil_load_slot *slot;
+	int32_t i, j, ret;
+	uint64_t rate;
+	uint32_t nctx;
+	int pid;
+
+	pthread_mutex_lock(&vkil_load.lock);
+	ret = load_map();
+	for (i = 0; !ret && (i < VKIL_LOAD_SLOTS); i++) {
+		slot = &vkil_load.table->slot[i];
+		vkil_load.live[i] = 0;
+		pid = atomic_load_explicit(&slot->pid, memory_order_acquire);
+		if ((pid <= 0) || !load_alive(slot, pid))
+			continue;
+		for (j = 0; j < VKIL_LOAD_CARDS_MAX; j++)
+			if (load_read(&slot->card[j], &rate, &nctx))
+				break;
+		if (j < VKIL_LOAD_CARDS_MAX) {
+			VKIL_LOG(VK_LOG_WARNING,
+				 "load slot %d of pid %d ignored", i, pid);
+			continue;
+		}
+		vkil_load.live[i] = pid;
+	}
+	pthread_mutex_unlock(&vkil_load.lock);
+	return ret;
+}
+
+/**
+ * @brief get the load of a card, summed over the processes of the host
+ *
+ * a slot is accounted if its owner was alive at the last scan, or if it is
+ * the one of the process, and if its load is still sane
+ * @param[in]  card card id
+ * @param[out] rate estimated pixels per second
+ * @param[out] nctx number of contexts open
+ * @return zero on success, error code otherwise
+ */
+int32_t vkil_load_get(const int32_t card, uint64_t *rate, uint32_t *nctx)
+{
+	vkil_load_slot *slot;
+	uint64_t slot_rate;
+	uint32_t slot_nctx;
+	int32_t i;
+	int pid;
+
+	if ((card < 0) || (card >= VKIL_LOAD_CARDS_MAX))
+		return -EINVAL;
+
+	*rate = 0;
+	*nctx = 0;
+	pthread_mutex_lock(&vkil_load.lock);
+	if (!vkil_load.table) {
+		pthread_mutex_unlock(&vkil_load.lock);
+		return -ENOENT;
+	}
+	for (i = 0; i < VKIL_LOAD_SLOTS; i++) {
+		slot = &vkil_load.table->slot[i];
+		pid = atomic_load_explicit(&slot->pid, memory_order_acquire);
+		if ((pid <= 0) ||
+		    ((pid != vkil_load.live[i]) && (slot != vkil_load.slot)))
+			continue;
+
+		if (load_read(&slot->card[card], &slot_rate, &slot_nctx))
+			continue;
+		*rate += slot_rate;
+		*nctx += slot_nctx;
+	}
+	pthread_mutex_unlock(&vkil_load.lock);
+	return 0;
+}
@@ -0,0 +1,641 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+ * Copyright 2018-2020 Broadcom.
+ */
+
+/**
+ * @file
+ * @brief driver transports
+ *
+ * a device accesses its driver through one of the transports below, chosen
+ * when it is opened:
+ * @li the kernel driver, via its file descriptor
+ * @li the user space driver model, libvksim.so, loaded at run time; see
+ * drv_model/vkdrv_access.h for the functions it has to implement
+ * @li the shared memory rings of the driver model, the messages being copied
+ * in and out of them without any system call; see drv_model/vkdrv_ring.h
+ * @li an in process card completing all the commands right away, allowing to
+ * benchmark or test the library without any driver
+ */
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include "vkdrv_ring.h"
+#include "vkil_backend.h"
+#include "vkil_internal.h"
+#include "vkil_utils.h"
+
+/** name of the user space driver model library */
+#define VKIL_MODEL_LIB "libvksim.so"
+
+/** number of response blocks the loopback card can hold */
+#define VKIL_LOOPBACK_BLKS 4096
+
+/**
+ * @brief open the kernel driver
+ * @param devctx   device context
+ * @param dev_name driver name
+ * @return zero on success, error code otherwise
+ */
+static int32_t kdrv_open(vkil_devctx *devctx, const char *dev_name)
+{
+	devctx->fd = open(dev_name, O_RDWR);
+	return (devctx->fd < 0) ? -errno : 0;
+}
+
+static void kdrv_close(vkil_devctx *devctx)
+{
+	close(devctx->fd);
+}
+
+static ssize_t kdrv_submit(vkil_devctx *devctx, const struct iovec *iov,
+			   const int iovcnt)
+{
+	ssize_t ret = writev(devctx->fd, iov, iovcnt);
+
+	/* on error, driver returns -1 and sets errno */
+	return (ret < 0) ? -errno : ret;
+}
+
+static ssize_t kdrv_reap(vkil_devctx *devctx, const int32_t q_id, void *buf,
+			 const size_t nbytes)
+{
+	ssize_t ret;
+
+	/* the driver reads the queue hinted in the first block */
+	((vk2host_msg *)buf)->queue_id = q_id;
+	ret = read(devctx->fd, buf, nbytes);
+	if (ret > 0)
+		return ret;
+	if ((ret < 0) && (errno == EMSGSIZE))
+		return -EMSGSIZE;
+	return -ENOMSG;
+}
+
+static int32_t kdrv_poll(vkil_devctx *devctx, const int timeout_ms)
+{
+	struct pollfd pfd = {.fd = devctx->fd, .events = POLLIN};
+	int32_t ret;
+
+	ret = poll(&pfd, 1, timeout_ms);
+	return (ret < 0) ? -errno : ret;
+}
+
+const vkil_transport_ops vkil_kdrv_ops = {
+	.name = "sync",
+	.open = kdrv_open,
+	.close = kdrv_close,
+	.submit = kdrv_submit,
+	.reap = kdrv_reap,
+	.poll = kdrv_poll,
+};
+
+/**
+ * @brief user space driver model of a device
+ *
+ * the model functions return a negative error code rather than setting errno
+ */
+typedef struct _vkil_model {
+	void *lib_handle;
+	int (*vkdrv_open)(const char *dev_name, int flags);
+	int (*vkdrv_close)(int fd);
+	ssize_t (*vkdrv_write)(int fd, const void *buf, size_t nbytes);
+	ssize_t (*vkdrv_read)(int fd, void *buf, size_t nbytes);
+	/** optional, a model without it gets its messages probed */
+	int (*vkdrv_poll)(struct pollfd *fds, unsigned long nfds, int timeout);
+	/** optional, a model without it gets one write per message */
+	ssize_t (*vkdrv_writev)(int fd, const struct iovec *iov, int iovcnt);
+} vkil_model;
+
+/**
+ * @brief load the driver model, and open it
+ * @param devctx   device context
+ * @param dev_name driver name
+ * @return zero on success, error code otherwise
+ */
+static int32_t model_open(vkil_devctx *devctx, const char *dev_name)
+{
+	vkil_model *model;
+	int32_t ret;
+
+	ret = vkil_mallocz((void **)&model, sizeof(*model));
+	if (ret)
+		return ret;
+
+	ret = -ENODEV;
+	model->lib_handle = dlopen(VKIL_MODEL_LIB, RTLD_LAZY);
+	if (!model->lib_handle) {
+		VKIL_LOG(VK_LOG_ERROR, "%s", dlerror());
+		goto fail;
+	}
+
+	model->vkdrv_open = dlsym(model->lib_handle, "vkdrv_open");
+	model->vkdrv_close = dlsym(model->lib_handle, "vkdrv_close");
+	model->vkdrv_read = dlsym(model->lib_handle, "vkdrv_read");
+	model->vkdrv_write = dlsym(model->lib_handle, "vkdrv_write");
+	model->vkdrv_poll = dlsym(model->lib_handle, "vkdrv_poll");
+	model->vkdrv_writev = dlsym(model->lib_handle, "vkdrv_writev");
+	if (!model->vkdrv_open || !model->vkdrv_close || !model->vkdrv_read ||
+	    !model->vkdrv_write) {
+		ret = -EINVAL;
+		goto fail_lib;
+	}
+
+	devctx->fd = model->vkdrv_open(dev_name, O_RDWR);
+	if (devctx->fd < 0) {
+		ret = devctx->fd;
+		goto fail_lib;
+	}
+
+	devctx->tp_priv = model;
+	return 0;
+
+fail_lib:
+	dlclose(model->lib_handle);
+fail:
+	vkil_free((void **)&model);
+	return ret;
+}
+
+static void model_close(vkil_devctx *devctx)
+{
+	vkil_model *model = devctx->tp_priv;
+
+	model->vkdrv_close(devctx->fd);
+	dlclose(model->lib_handle);
+	vkil_free(&devctx->tp_priv);
+}
+
+static ssize_t model_submit(vkil_devctx *devctx, const struct iovec *iov,
+			    const int iovcnt)
+{
+	vkil_model *model = devctx->tp_priv;
+	ssize_t ret, nbytes = 0;
+	int i;
+
+	if (model->vkdrv_writev)
+		return model->vkdrv_writev(devctx->fd, iov, iovcnt);
+
+	for (i = 0; i < iovcnt; i++) {
+		ret = model->vkdrv_write(devctx->fd, iov[i].iov_base,
+					 iov[i].iov_len);
+		if (ret < 0)
+			return nbytes ? nbytes : ret;
+		nbytes += ret;
+	}
+	return nbytes;
+}
+
+static ssize_t model_reap(vkil_devctx *devctx, const int32_t q_id, void *buf,
+			  const size_t nbytes)
+{
+	vkil_model *model = devctx->tp_priv;
+	ssize_t ret;
+
+	((vk2host_msg *)buf)->queue_id = q_id;
+	ret = model->vkdrv_read(devctx->fd, buf, nbytes);
+	if (ret > 0)
+		return ret;
+	return (ret == -EMSGSIZE) ? ret : -ENOMSG;
+}
+
+static int32_t model_poll(vkil_devctx *devctx, const int timeout_ms)
+{
+	vkil_model *model = devctx->tp_priv;
+	struct pollfd pfd = {.fd = devctx->fd, .events = POLLIN};
+
+	if (!model->vkdrv_poll)
+		return -ENOSYS;
+	return model->vkdrv_poll(&pfd, 1, timeout_ms);
+}
+
+const vkil_transport_ops vkil_model_ops = {
+	.name = "model",
+	.open = model_open,
+	.close = model_close,
+	.submit = model_submit,
+	.reap = model_reap,
+	.poll = model_poll,
+};
+
+/**
+ * @brief shared memory rings of the driver model of a device
+ */
+typedef struct _vkil_model_ring {
+	vkil_model *model; /**< model the rings belong to */
+	struct vkdrv_ring_hdr *hdr; /**< mapped memory file */
+	size_t size; /**< size of the mapping */
+	int doorbell_fd;
+	int cmpl_fd;
+	/** serialize the producers of each host2vk ring */
+	pthread_mutex_t lock[VKIL_MSG_Q_MAX];
+} vkil_model_ring;
+
+/**
+ * @brief check a ring lies within the memory file
+ * @param mr   rings
+ * @param ring ring to check
+ * @return zero if valid, error code otherwise
+ */
+static int32_t ring_check(const vkil_model_ring *mr,
+			  const struct vkdrv_ring *ring)
+{
+	/* the largest message, spanning 1 + UINT8_MAX blocks, has to fit */
+	if ((ring->nblks <= UINT8_MAX) || (ring->nblks & (ring->nblks - 1)) ||
+	    (ring->offset < sizeof(*mr->hdr)) ||
+	    (ring->offset + (size_t)ring->nblks * VKDRV_RING_BLK_SIZE >
+	     mr->size))
+		return -EPROTO;
+	return 0;
+}
+
+/**
+ * @brief load the driver model, and map its rings
+ * @param devctx   device context
+ * @param dev_name driver name
+ * @return zero on success, error code otherwise
+ */
+static int32_t model_ring_open(vkil_devctx *devctx, const char *dev_name)
+{
+	int (*setup)(int fd, struct vkdrv_ring_info *info);
+	struct vkdrv_ring_info info;
+	vkil_model_ring *mr;
+	int32_t i, ret;
+
+	ret = vkil_mallocz((void **)&mr, sizeof(*mr));
+	if (ret)
+		return ret;
+
+	ret = model_open(devctx, dev_name);
+	if (ret)
+		goto fail;
+	mr->model = devctx->tp_priv;
+
+	setup = dlsym(mr->model->lib_handle, "vkdrv_ring_setup");
+	if (!setup) {
+		ret = -ENOTSUP;
+		goto fail_model;
+	}
+	ret = setup(devctx->fd, &info);
+	if (ret)
+		goto fail_model;
+
+	mr->size = info.size;
+	mr->doorbell_fd = info.doorbell_fd;
+	mr->cmpl_fd = info.cmpl_fd;
+	mr->hdr = mmap(NULL, mr->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		       info.mem_fd, 0);
+	if (mr->hdr == MAP_FAILED) {
+		ret = -errno;
+		goto fail_model;
+	}
+
+	ret = -EPROTO;
+	if ((mr->size < sizeof(*mr->hdr)) ||
+	    (mr->hdr->magic != VKDRV_RING_MAGIC) ||
+	    (mr->hdr->version != VKDRV_RING_VERSION) ||
+	    (mr->hdr->nq < VKIL_MSG_Q_MAX) ||
+	    (mr->hdr->nq > VKDRV_RING_Q_MAX))
+		goto fail_map;
+	for (i = 0; i < VKIL_MSG_Q_MAX; i++) {
+		if (ring_check(mr, &mr->hdr->host2vk[i]) ||
+		    ring_check(mr, &mr->hdr->vk2host[i]))
+			goto fail_map;
+	}
+
+	for (i = 0; i < VKIL_MSG_Q_MAX; i++)
+		pthread_mutex_init(&mr->lock[i], NULL);
+	devctx->tp_priv = mr;
+	return 0;
+
+fail_map:
+	munmap(mr->hdr, mr->size);
+fail_model:
+	model_close(devctx);
+fail:
+	vkil_free((void **)&mr);
+	return ret;
+}
+
+static void model_ring_close(vkil_devctx *devctx)
+{
+	vkil_model_ring *mr = devctx->tp_priv;
+	int32_t i;
+
+	for (i = 0; i < VKIL_MSG_Q_MAX; i++)
+		pthread_mutex_destroy(&mr->lock[i]);
+	munmap(mr->hdr, mr->size);
+	devctx->tp_priv = mr->model;
+	vkil_free((void **)&mr);
+	model_close(devctx);
+}
+
+/**
+ * @brief queue messages in the host2vk rings
+ *
+ * the model is rung only if it sleeps
+ * @param devctx device context
+ * @param iov    messages, one per vector
+ * @param iovcnt number of messages
+ * @return number of bytes queued, -EAGAIN if the first message doesn't fit
+ */
+static ssize_t model_ring_submit(vkil_devctx *devctx, const struct iovec *iov,
+				 const int iovcnt)
+{
+	const uint64_t one = 1;
+	vkil_model_ring *mr = devctx->tp_priv;
+	const host2vk_msg *msg;
+	ssize_t nbytes = 0;
+	int i, ret;
+
+	for (i = 0; i < iovcnt; i++) {
+		msg = iov[i].iov_base;
+		pthread_mutex_lock(&mr->lock[msg->queue_id]);
+		ret = vkdrv_ring_put(mr->hdr, &mr->hdr->host2vk[msg->queue_id],
+				     msg, iov[i].iov_len / sizeof(*msg));
+		pthread_mutex_unlock(&mr->lock[msg->queue_id]);
+		if (ret)
+			break;
+		nbytes += iov[i].iov_len;
+	}
+
+	if (i && atomic_load(&mr->hdr->card_sleeping) &&
+	    (write(mr->doorbell_fd, &one, sizeof(one)) < 0))
+		VKIL_LOG(VK_LOG_ERROR, "devctx=%p: doorbell failure %s",
+			 devctx, strerror(errno));
+	return (i || !iovcnt) ? nbytes : -EAGAIN;
+}
+
+static ssize_t model_ring_reap(vkil_devctx *devctx, const int32_t q_id,
+			       void *buf, const size_t nbytes)
+{
+	vkil_model_ring *mr = devctx->tp_priv;
+	int32_t i, ret = -ENOMSG;
+
+	/* q_id first, and then the other queues; only the reader consumes */
+	for (i = 0; (i < VKIL_MSG_Q_MAX) && (ret == -ENOMSG); i++)
+		ret = vkdrv_ring_get(mr->hdr,
+				     &mr->hdr->vk2host[(q_id + i) %
+						       VKIL_MSG_Q_MAX],
+				     buf, nbytes / sizeof(vk2host_msg));
+	return (ret > 0) ? ret * (ssize_t)sizeof(vk2host_msg) : ret;
+}
+
+/**
+ * @brief check if a vk2host ring has messages
+ * @param mr rings
+ * @return 1 if there are messages to read, 0 otherwise
+ */
+static int32_t ring_pending(const vkil_model_ring *mr)
+{
+	const struct vkdrv_ring *r;
+	int32_t i;
+
+	for (i = 0; i < VKIL_MSG_Q_MAX; i++) {
+		r = &mr->hdr->vk2host[i];
+		if (atomic_load(&r->head) != atomic_load(&r->tail))
+			return 1;
+	}
+	return 0;
+}
+
+static int32_t model_ring_poll(vkil_devctx *devctx, const int timeout_ms)
+{
+	vkil_model_ring *mr = devctx->tp_priv;
+	struct pollfd pfd = {.fd = mr->cmpl_fd, .events = POLLIN};
+	uint64_t cnt;
+	int32_t ret;
+
+	ret = ring_pending(mr);
+	if (ret || !timeout_ms)
+		return ret;
+
+	atomic_fetch_add(&mr->hdr->host_waiters, 1);
+	/* drop the stale notifications, before checking the rings again */
+	if ((read(mr->cmpl_fd, &cnt, sizeof(cnt)) < 0) && (errno != EAGAIN))
+		VKIL_LOG(VK_LOG_WARNING, "devctx=%p: cmpl_fd read failure %s",
+			 devctx, strerror(errno));
+	ret = ring_pending(mr);
+	if (!ret) {
+		ret = poll(&pfd, 1, timeout_ms);
+		if (ret < 0)
+			ret = -errno;
+	}
+	atomic_fetch_sub(&mr->hdr->host_waiters, 1);
+	return ret;
+}
+
+const vkil_transport_ops vkil_model_ring_ops = {
+	.name = "model_ring",
+	.open = model_ring_open,
+	.close = model_ring_close,
+	.submit = model_ring_submit,
+	.reap = model_ring_reap,
+	.poll = model_ring_poll,
+	.fallback = &vkil_model_ops,
+};
+
+/**
+ * @brief in process card
+ *
+ * each command gets its response queued right away, with a success status,
+ * in the response queue of its queue_id; the queue hinted by the reader is
+ * read first. A private command gets its payload echoed back, so that its
+ * response spans as many blocks as the command.
+ *
+ * as many whole responses as fit are reaped at once, per the batched read
+ * contract of vkdrv_access.h
+ */
+typedef struct _vkil_loopback {
+	pthread_mutex_t lock;
+	pthread_cond_t cond; /**< signaled on queued responses */
+	uint32_t ctx_id; /**< number of card contexts created */
+	uint32_t len; /**< number of blocks queued, in all the queues */
+	struct {
+		uint32_t head; /**< first block queued */
+		uint32_t len; /**< number of blocks queued */
+		vk2host_msg blk[VKIL_LOOPBACK_BLKS];
+	} q[VKIL_MSG_Q_MAX];
+} vkil_loopback;
+
+static int32_t loopback_open(vkil_devctx *devctx, const char *dev_name)
+{
+	vkil_loopback *lb;
+	pthread_condattr_t attr;
+	int32_t ret;
+
+	ret = vkil_mallocz((void **)&lb, sizeof(*lb));
+	if (ret)
+		return ret;
+
+	pthread_mutex_init(&lb->lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&lb->cond, &attr);
+	pthread_condattr_destroy(&attr);
+	devctx->fd = -1;
+	devctx->tp_priv = lb;
+	return 0;
+}
+
+static void loopback_close(vkil_devctx *devctx)
+{
+	vkil_loopback *lb = devctx->tp_priv;
+
+	pthread_cond_destroy(&lb->cond);
+	pthread_mutex_destroy(&lb->lock);
+	vkil_free(&devctx->tp_priv);
+}
+
+/**
+ * @brief build the response header of a command
+ * @param lb  loopback card
+ * @param cmd command
+ * @param rsp response
+ * @return zero if the command has a response, -ENOMSG otherwise
+ */
+static int32_t loopback_respond(vkil_loopback *lb, const host2vk_msg *cmd,
+				vk2host_msg *rsp)
+{
+	memset(rsp, 0, sizeof(*rsp));
+	switch (cmd->function_id) {
+	case VK_FID_TRANS_BUF:
+		rsp->function_id = VK_FID_TRANS_BUF_DONE;
+		rsp->arg = cmd->msg_id; /* any non zero buffer handle */
+		break;
+	case VK_FID_PROC_BUF:
+		rsp->function_id = VK_FID_PROC_BUF_DONE;
+		rsp->arg = VKMSG_CMD_ARG(cmd);
+		break;
+	case VK_FID_PRIVATE:
+		rsp->function_id = VK_FID_PRIVATE_DONE;
+		rsp->size = cmd->size;
+		rsp->arg = cmd->args[0];
+		break;
+	default:
+		if ((cmd->function_id < VK_FID_INIT) ||
+		    (cmd->function_id > VK_FID_PRIVATE))
+			return -ENOMSG;
+		rsp->function_id = cmd->function_id - VK_FID_INIT +
+				   VK_FID_INIT_DONE;
+		break;
+	}
+	rsp->queue_id = cmd->queue_id;
+	rsp->msg_id = cmd->msg_id;
+	rsp->context_id = cmd->context_id;
+	if ((cmd->function_id == VK_FID_INIT) && !cmd->context_id)
+		rsp->context_id = VK_START_VALID_HANDLE + lb->ctx_id++;
+	return 0;
+}
+
+static ssize_t loopback_submit(vkil_devctx *devctx, const struct iovec *iov,
+			       const int iovcnt)
+{
+	vkil_loopback *lb = devctx->tp_priv;
+	const host2vk_msg *cmd;
+	ssize_t nbytes = 0;
+	vk2host_msg *rsp;
+	int i, j, q, tail;
+
+	pthread_mutex_lock(&lb->lock);
+	for (i = 0; i < iovcnt; i++) {
+		cmd = iov[i].iov_base;
+		q = cmd->queue_id;
+		if (lb->q[q].len + cmd->size + 1 > VKIL_LOOPBACK_BLKS)
+			break;
+		tail = lb->q[q].head + lb->q[q].len;
+		rsp = &lb->q[q].blk[tail % VKIL_LOOPBACK_BLKS];
+		if (!loopback_respond(lb, cmd, rsp)) {
+			/* the payload blocks, if any, may wrap around */
+			for (j = 1; j <= rsp->size; j++)
+				memcpy(&lb->q[q].blk[(tail + j) %
+						     VKIL_LOOPBACK_BLKS],
+				       &cmd[j], sizeof(*rsp));
+			lb->q[q].len += rsp->size + 1;
+			lb->len += rsp->size + 1;
+		}
+		nbytes += iov[i].iov_len;
+	}
+	if (lb->len)
+		pthread_cond_broadcast(&lb->cond);
+	pthread_mutex_unlock(&lb->lock);
+	return (i || !iovcnt) ? nbytes : -EAGAIN;
+}
+
+static ssize_t loopback_reap(vkil_devctx *devctx, const int32_t q_id,
+			     void *buf, const size_t nbytes)
+{
+	vkil_loopback *lb = devctx->tp_priv;
+	vk2host_msg *blk = buf;
+	ssize_t ret = -ENOMSG;
+	size_t n = 0;
+	int i, j, q, nblks;
+
+	pthread_mutex_lock(&lb->lock);
+	/* q_id first, and then the other queues */
+	for (i = 0; (i < VKIL_MSG_Q_MAX) && !n; i++) {
+		q = (q_id + i) % VKIL_MSG_Q_MAX;
+		/* whole responses only */
+		while (lb->q[q].len) {
+			nblks = lb->q[q].blk[lb->q[q].head].size + 1;
+			if ((n + nblks) * sizeof(*blk) > nbytes) {
+				/* the first one tells the size it needs */
+				if (!n && (nbytes >= sizeof(*blk))) {
+					blk[0] = lb->q[q].blk[lb->q[q].head];
+					ret = -EMSGSIZE;
+				}
+				break;
+			}
+			for (j = 0; j < nblks; j++) {
+				blk[n++] = lb->q[q].blk[lb->q[q].head];
+				lb->q[q].head = (lb->q[q].head + 1) %
+						VKIL_LOOPBACK_BLKS;
+			}
+			lb->q[q].len -= nblks;
+			lb->len -= nblks;
+		}
+	}
+	pthread_mutex_unlock(&lb->lock);
+	return n ? (ssize_t)(n * sizeof(*blk)) : ret;
+}
+
+static int32_t loopback_poll(vkil_devctx *devctx, const int timeout_ms)
+{
+	vkil_loopback *lb = devctx->tp_priv;
+	struct timespec ts;
+	int64_t end_us;
+	int32_t ret;
+
+	pthread_mutex_lock(&lb->lock);
+	if (!lb->len && timeout_ms) {
+		if (timeout_ms < 0) {
+			pthread_cond_wait(&lb->cond, &lb->lock);
+		} else {
+			end_us = vkil_get_time_us() + timeout_ms * 1000LL;
+			ts.tv_sec = end_us / 1000000;
+			ts.tv_nsec = (end_us % 1000000) * 1000;
+			pthread_cond_timedwait(&lb->cond, &lb->lock, &ts);
+		}
+	}
+	ret = !!lb->len;
+	pthread_mutex_unlock(&lb->lock);
+	return ret;
+}
+
+const vkil_transport_ops vkil_loopback_ops = {
+	.name = "loopback",
+	.open = loopback_open,
+	.close = loopback_close,
+	.submit = loopback_submit,
+	.reap = loopback_reap,
+	.poll = loopback_poll,
+};
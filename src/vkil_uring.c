@@ -0,0 +1,732 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+ * Copyright 2018-2020 Broadcom.
+ */
+
+/**
+ * @file
+ * @brief io_uring transport of the driver messages
+ *
+ * the driver fd is registered to two rings:
+ * @li the rx ring is only used by the driver reader. A poll of the fd is kept
+ * queued, linked to a read of the registered device receive buffer, so that
+ * the messages are read as soon as the driver has some, and the reader just
+ * reaps the read completion. Each queued pair is tagged with a generation,
+ * so that a completion left over from a previous pair is never mistaken for
+ * the one of the current pair
+ * @li the tx ring queues the writes; with the SQPOLL option, a kernel thread
+ * picks them up, so that no system call is needed to submit them
+ *
+ * the rings are driven by the raw system calls, so that there is no
+ * dependency on liburing
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include "vkil_internal.h"
+#include "vkil_utils.h"
+
+/** number of entries of each ring, more than the requests in flight */
+#define VKIL_URING_ENTRIES 8
+/** idle time before the SQPOLL kernel thread goes to sleep */
+#define VKIL_URING_SQ_IDLE_MS 100
+/** max number of times the tx completion is polled, in SQPOLL mode */
+#define VKIL_URING_TX_SPIN 1000
+
+/* kind of the requests, in the low byte of their user_data */
+#define URING_POLL   1 /**< wait for the driver to have messages */
+#define URING_READ   2 /**< read of the device receive buffer */
+#define URING_CANCEL 3 /**< cancellation of the queued poll */
+#define URING_WRITE  4 /**< write of messages */
+
+/** user_data of a request of the rx pair of generation gen */
+#define URING_TAG(kind, gen) (((uint64_t)(gen) << 8) | (kind))
+#define URING_KIND(user_data) ((user_data) & 0xff)
+#define URING_GEN(user_data)  ((uint32_t)((user_data) >> 8))
+
+/**
+ * @brief mapping of an io_uring instance
+ */
+typedef struct _vkil_ring {
+	int fd;
+	uint32_t flags;  /**< setup flags */
+	uint32_t *sq_head;
+	uint32_t *sq_tail;
+	uint32_t *sq_mask;
+	uint32_t *sq_flags;
+	uint32_t *sq_array;
+	uint32_t sq_local; /**< tail of the entries got, up to the committed */
+	uint32_t *cq_head;
+	uint32_t *cq_tail;
+	uint32_t *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ptr;
+	void *cq_ptr;
+	size_t sq_len;
+	size_t cq_len;
+	size_t sqes_len;
+} vkil_ring;
+
+/**
+ * @brief io_uring transport of a device
+ */
+struct _vkil_uring {
+	vkil_ring rx; /**< accessed by the driver reader only */
+	int32_t rx_on;    /**< the rx ring is used */
+	/** a poll linked to a read is queued, until the pair completes */
+	int32_t rx_armed;
+	uint32_t rx_gen;  /**< generation of the last pair queued */
+	int32_t rx_res; /**< result of the pair, -EINPROGRESS if none */
+	int32_t rx_hint; /**< queue the driver is hinted to read first */
+	vkil_ring tx;
+	pthread_mutex_t tx_lock; /**< protect the tx ring */
+};
+
+/*
+ * the ring indexes are shared with the kernel; the ring owner loads the
+ * kernel updated index with acquire semantic, and stores its own one with
+ * release semantic
+ */
+#define ring_load(p)     __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define ring_store(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+static int ring_enter(const vkil_ring *ring, const uint32_t to_submit,
+		      const uint32_t min_complete, const uint32_t flags,
+		      const void *arg, const size_t argsz)
+{
+	int ret;
+
+	ret = syscall(__NR_io_uring_enter, ring->fd, to_submit, min_complete,
+		      flags, arg, argsz);
+	return (ret < 0) ? -errno : ret;
+}
+
+/**
+ * @brief unmap and close a ring
+ * @param ring ring to release
+ */
+static void vkil_ring_deinit(vkil_ring *ring)
+{
+	if (ring->sqes)
+		munmap(ring->sqes, ring->sqes_len);
+	if (ring->cq_ptr && (ring->cq_ptr != ring->sq_ptr))
+		munmap(ring->cq_ptr, ring->cq_len);
+	if (ring->sq_ptr)
+		munmap(ring->sq_ptr, ring->sq_len);
+	if (ring->fd >= 0)
+		close(ring->fd);
+	memset(ring, 0, sizeof(*ring));
+	ring->fd = -1;
+}
+
+/**
+ * @brief create and map a ring, and register the driver fd to it
+ * @param ring  ring to initialize
+ * @param drv   driver fd
+ * @param flags setup flags
+ * @return zero on success, error code otherwise
+ */
+static int32_t vkil_ring_init(vkil_ring *ring, const int drv,
+			      const uint32_t flags)
+{
+	struct io_uring_params p;
+	uint8_t *sq, *cq;
+	int32_t ret;
+
+	memset(ring, 0, sizeof(*ring));
+	memset(&p, 0, sizeof(p));
+	p.flags = flags;
+	p.sq_thread_idle = VKIL_URING_SQ_IDLE_MS;
+	ring->fd = syscall(__NR_io_uring_setup, VKIL_URING_ENTRIES, &p);
+	if (ring->fd < 0)
+		return -errno;
+	ring->flags = flags;
+
+	/* timed waits, and no completion for the poll of a successful pair */
+	if (!(p.features & IORING_FEAT_EXT_ARG) ||
+	    !(p.features & IORING_FEAT_CQE_SKIP)) {
+		ret = -ENOTSUP;
+		goto fail;
+	}
+
+	ring->sq_len = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+	ring->cq_len = p.cq_off.cqes +
+		       p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		ring->sq_len = ring->cq_len = MAX(ring->sq_len, ring->cq_len);
+
+	ret = -ENOMEM;
+	sq = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE,
+		  MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (sq == MAP_FAILED)
+		goto fail;
+	ring->sq_ptr = sq;
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		cq = sq;
+	} else {
+		cq = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, ring->fd,
+			  IORING_OFF_CQ_RING);
+		if (cq == MAP_FAILED)
+			goto fail;
+	}
+	ring->cq_ptr = cq;
+
+	ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, ring->fd,
+			  IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		ring->sqes = NULL;
+		goto fail;
+	}
+
+	ring->sq_head  = (uint32_t *)(sq + p.sq_off.head);
+	ring->sq_tail  = (uint32_t *)(sq + p.sq_off.tail);
+	ring->sq_mask  = (uint32_t *)(sq + p.sq_off.ring_mask);
+	ring->sq_flags = (uint32_t *)(sq + p.sq_off.flags);
+	ring->sq_array = (uint32_t *)(sq + p.sq_off.array);
+	ring->cq_head  = (uint32_t *)(cq + p.cq_off.head);
+	ring->cq_tail  = (uint32_t *)(cq + p.cq_off.tail);
+	ring->cq_mask  = (uint32_t *)(cq + p.cq_off.ring_mask);
+	ring->cqes     = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	ring->sq_local = *ring->sq_tail;
+
+	ret = syscall(__NR_io_uring_register, ring->fd,
+		      IORING_REGISTER_FILES, &drv, 1);
+	if (ret < 0) {
+		ret = -errno;
+		goto fail;
+	}
+	return 0;
+
+fail:
+	vkil_ring_deinit(ring);
+	return ret;
+}
+
+/**
+ * @brief get the next free submission entry
+ *
+ * the entry is only reserved: the kernel doesn't see it until committed,
+ * once filled in. The number of requests in flight being bounded by design,
+ * the ring is never full
+ * @param ring ring
+ * @return cleared submission entry, targeting the registered driver fd
+ */
+static struct io_uring_sqe *vkil_ring_get_sqe(vkil_ring *ring)
+{
+	uint32_t tail = ring->sq_local;
+	struct io_uring_sqe *sqe = &ring->sqes[tail & *ring->sq_mask];
+
+	VK_ASSERT(tail - ring_load(ring->sq_head) <= *ring->sq_mask);
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->fd = 0; /* index of the registered driver fd */
+	sqe->flags = IOSQE_FIXED_FILE;
+	ring->sq_local = tail + 1;
+	return sqe;
+}
+
+/**
+ * @brief hand the entries got so far over to the kernel
+ *
+ * the tail is stored with release semantic, so that the entries are seen
+ * filled in, by the SQPOLL kernel thread as well
+ * @param ring ring
+ */
+static void vkil_ring_commit(vkil_ring *ring)
+{
+	uint32_t tail, idx;
+
+	for (tail = *ring->sq_tail; tail != ring->sq_local; tail++) {
+		idx = tail & *ring->sq_mask;
+		ring->sq_array[idx] = idx;
+	}
+	ring_store(ring->sq_tail, ring->sq_local);
+}
+
+/**
+ * @brief commit and submit the queued entries
+ * @param ring  ring
+ * @param nsqes number of queued entries
+ * @return zero on success, error code otherwise
+ */
+static int32_t vkil_ring_submit(vkil_ring *ring, const uint32_t nsqes)
+{
+	int32_t ret;
+
+	vkil_ring_commit(ring);
+	if (!(ring->flags & IORING_SETUP_SQPOLL)) {
+		ret = ring_enter(ring, nsqes, 0, 0, NULL, 0);
+		return (ret < 0) ? ret : 0;
+	}
+
+	/* the kernel thread picks up the entries, unless asleep */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (ring_load(ring->sq_flags) & IORING_SQ_NEED_WAKEUP) {
+		ret = ring_enter(ring, 0, 0, IORING_ENTER_SQ_WAKEUP, NULL, 0);
+		if (ret < 0)
+			return ret;
+	}
+	return 0;
+}
+
+/**
+ * @brief get the oldest completion not yet seen
+ * @param ring ring
+ * @return completion entry, NULL if none
+ */
+static struct io_uring_cqe *vkil_ring_peek_cqe(vkil_ring *ring)
+{
+	uint32_t head = *ring->cq_head;
+
+	if (head == ring_load(ring->cq_tail))
+		return NULL;
+	return &ring->cqes[head & *ring->cq_mask];
+}
+
+/**
+ * @brief mark the oldest completion as seen
+ * @param ring ring
+ */
+static void vkil_ring_cqe_seen(vkil_ring *ring)
+{
+	ring_store(ring->cq_head, *ring->cq_head + 1);
+}
+
+/**
+ * @brief wait for a completion
+ * @param ring       ring
+ * @param timeout_ms max wait in ms, negative means infinite wait
+ * @return zero on success or timeout, error code otherwise
+ */
+static int32_t vkil_ring_wait(vkil_ring *ring, const int64_t timeout_ms)
+{
+	struct __kernel_timespec ts;
+	struct io_uring_getevents_arg arg;
+	int32_t ret;
+
+	memset(&arg, 0, sizeof(arg));
+	if (timeout_ms >= 0) {
+		ts.tv_sec = timeout_ms / 1000;
+		ts.tv_nsec = (timeout_ms % 1000) * 1000000;
+		arg.ts = (uint64_t)(uintptr_t)&ts;
+	}
+	ret = ring_enter(ring, 0, 1,
+			 IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+			 &arg, sizeof(arg));
+	if ((ret == -ETIME) || (ret == -EINTR))
+		return 0;
+	return (ret < 0) ? ret : 0;
+}
+
+/**
+ * @brief queue a poll of the driver, linked to a read of the receive buffer
+ * @param uring io_uring transport
+ * @param buf   registered receive buffer
+ * @param len   size of the receive buffer
+ * @return zero on success, error code otherwise
+ */
+static int32_t vkil_uring_arm(vkil_uring *uring, void *buf, const size_t len)
+{
+	struct io_uring_sqe *sqe;
+	int32_t ret;
+
+	uring->rx_gen++;
+	/* the driver reads the queue hinted in the first block */
+	((vk2host_msg *)buf)->queue_id = uring->rx_hint;
+
+	sqe = vkil_ring_get_sqe(&uring->rx);
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->flags |= IOSQE_IO_LINK | IOSQE_CQE_SKIP_SUCCESS;
+	sqe->poll32_events = POLLIN;
+	sqe->user_data = URING_TAG(URING_POLL, uring->rx_gen);
+
+	sqe = vkil_ring_get_sqe(&uring->rx);
+	sqe->opcode = IORING_OP_READ_FIXED;
+	sqe->addr = (uintptr_t)buf;
+	sqe->len = len;
+	sqe->buf_index = 0;
+	sqe->user_data = URING_TAG(URING_READ, uring->rx_gen);
+
+	ret = vkil_ring_submit(&uring->rx, 2);
+	if (!ret)
+		uring->rx_armed = 1;
+	return ret;
+}
+
+/**
+ * @brief reap the rx completions, up to the one of the queued pair
+ *
+ * a pair posts a single completion: a successful poll posts none, and a
+ * failed one posts its own but none for the linked read, cancelled with it.
+ * The completions of an older pair, or of a cancellation, are just consumed
+ * @param uring io_uring transport
+ * @return result of the read, or of the failed poll, if completed and not
+ *	   taken yet; -EINPROGRESS otherwise
+ */
+static int32_t vkil_uring_reap_rx(vkil_uring *uring)
+{
+	struct io_uring_cqe *cqe;
+
+	while ((uring->rx_res == -EINPROGRESS) &&
+	       (cqe = vkil_ring_peek_cqe(&uring->rx))) {
+		if (URING_GEN(cqe->user_data) != uring->rx_gen) {
+			vkil_ring_cqe_seen(&uring->rx);
+			continue;
+		}
+
+		switch (URING_KIND(cqe->user_data)) {
+		case URING_POLL:
+		case URING_READ:
+			uring->rx_armed = 0;
+			uring->rx_res = cqe->res;
+			break;
+		default:
+			break;
+		}
+		vkil_ring_cqe_seen(&uring->rx);
+	}
+	return uring->rx_res;
+}
+
+/**
+ * @brief take the result of the completed read
+ * @param uring io_uring transport
+ * @return result of the read, -EINPROGRESS if none has completed
+ */
+static int32_t vkil_uring_take_rx(vkil_uring *uring)
+{
+	int32_t ret = vkil_uring_reap_rx(uring);
+
+	uring->rx_res = -EINPROGRESS;
+	return ret;
+}
+
+/**
+ * @brief read the driver, without waiting for a message
+ *
+ * this function need to be called by the driver reader. The queue hint
+ * applies to the next read queued, the one queued already having its own
+ * @param devctx device context
+ * @param q_id   queue the driver is hinted to read first
+ * @param buf    device receive buffer
+ * @param nbytes size of the buffer
+ * @return number of bytes read if success, (-ENOMSG) if there is no message,
+ *	   (-ENOTSUP) if the rx ring is not used, other error code otherwise
+ */
+static ssize_t vkil_uring_read(vkil_devctx *devctx, const int32_t q_id,
+			       void *buf, const size_t nbytes)
+{
+	vkil_uring *uring = devctx->uring;
+	int32_t ret;
+
+	if (!uring->rx_on)
+		return -ENOTSUP;
+
+	VK_ASSERT(buf == devctx->rx.blk);
+	VK_ASSERT(nbytes <= sizeof(vk2host_msg) * VKIL_RX_BUF_BLKS);
+
+	uring->rx_hint = q_id;
+	if (!uring->rx_armed && (uring->rx_res == -EINPROGRESS)) {
+		ret = vkil_uring_arm(uring, buf, nbytes);
+		if (ret)
+			return ret;
+	}
+
+	ret = vkil_uring_take_rx(uring);
+	if (ret > 0)
+		return ret;
+	if (ret == -EMSGSIZE)
+		return ret;
+	return -ENOMSG;
+}
+
+/**
+ * @brief wait for the driver to have a message to read
+ *
+ * this function need to be called by the driver reader
+ * @param devctx     device context
+ * @param timeout_ms max wait in ms, negative means infinite wait
+ * @return 1 if a read has completed, 0 otherwise, (-ENOTSUP) if the rx ring
+ *	   is not used
+ */
+static int32_t vkil_uring_wait(vkil_devctx *devctx, const int64_t timeout_ms)
+{
+	vkil_uring *uring = devctx->uring;
+	int32_t ret;
+
+	if (!uring->rx_on)
+		return -ENOTSUP;
+
+	/* the receive buffer is only read again once emptied */
+	if (devctx->rx.pos < devctx->rx.len)
+		return 1;
+
+	if (!uring->rx_armed && (uring->rx_res == -EINPROGRESS)) {
+		ret = vkil_uring_arm(uring, devctx->rx.blk,
+				     sizeof(vk2host_msg) * VKIL_RX_BUF_BLKS);
+		if (ret)
+			return -ENOTSUP;
+	}
+
+	if (vkil_uring_reap_rx(uring) == -EINPROGRESS) {
+		vkil_ring_wait(&uring->rx, timeout_ms);
+		vkil_uring_reap_rx(uring);
+	}
+	return uring->rx_res != -EINPROGRESS;
+}
+
+/**
+ * @brief stop using the rx ring, the driver being read directly afterward
+ *
+ * a queued read is cancelled, and waited for so that the receive buffer is
+ * not written anymore; this function need to be called by the driver
+ * reader, with the receive buffer emptied
+ * @param devctx device context
+ */
+static void vkil_uring_rx_stop(vkil_devctx *devctx)
+{
+	vkil_uring *uring = devctx->uring;
+	struct io_uring_sqe *sqe;
+	int32_t ret;
+
+	if (!uring || !uring->rx_on)
+		return;
+
+	uring->rx_on = 0;
+	if (uring->rx_armed) {
+		sqe = vkil_ring_get_sqe(&uring->rx);
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->flags = 0;
+		sqe->fd = -1;
+		sqe->addr = URING_TAG(URING_POLL, uring->rx_gen);
+		sqe->user_data = URING_TAG(URING_CANCEL, uring->rx_gen);
+		vkil_ring_submit(&uring->rx, 1);
+		/* wait for the read to complete, or to be cancelled */
+		while (vkil_uring_reap_rx(uring) == -EINPROGRESS)
+			vkil_ring_wait(&uring->rx, -1);
+	}
+	/* messages read before the cancellation are kept */
+	ret = vkil_uring_take_rx(uring);
+	if (ret > 0) {
+		devctx->rx.pos = 0;
+		devctx->rx.len = ret / sizeof(vk2host_msg);
+	}
+	VKIL_LOG(VK_LOG_DEBUG, "devctx=%p: rx ring stopped", devctx);
+}
+
+/**
+ * @brief write messages to the driver
+ * @param devctx device context
+ * @param iov    messages, one per vector
+ * @param iovcnt number of messages
+ * @return number of bytes written if success, error code otherwise
+ */
+static ssize_t vkil_uring_writev(vkil_devctx *devctx,
+				 const struct iovec *iov, const int iovcnt)
+{
+	vkil_uring *uring = devctx->uring;
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	int32_t i, ret;
+
+	pthread_mutex_lock(&uring->tx_lock);
+	sqe = vkil_ring_get_sqe(&uring->tx);
+	sqe->opcode = IORING_OP_WRITEV;
+	sqe->addr = (uintptr_t)iov;
+	sqe->len = iovcnt;
+	sqe->user_data = URING_WRITE;
+
+	if (uring->tx.flags & IORING_SETUP_SQPOLL) {
+		ret = vkil_ring_submit(&uring->tx, 1);
+		for (i = 0; !ret && (i < VKIL_URING_TX_SPIN); i++)
+			if (vkil_ring_peek_cqe(&uring->tx))
+				break;
+	} else {
+		/* submit and wait for the completion at once */
+		vkil_ring_commit(&uring->tx);
+		ret = ring_enter(&uring->tx, 1, 1, IORING_ENTER_GETEVENTS,
+				 NULL, 0);
+		ret = (ret < 0) ? ret : 0;
+	}
+
+	/* the write is the single request in flight */
+	while (!ret && !(cqe = vkil_ring_peek_cqe(&uring->tx)))
+		ret = vkil_ring_wait(&uring->tx, -1);
+	if (!ret) {
+		ret = cqe->res;
+		vkil_ring_cqe_seen(&uring->tx);
+	}
+	pthread_mutex_unlock(&uring->tx_lock);
+	return ret;
+}
+
+/**
+ * @brief set up the io_uring transport of a device
+ *
+ * the device receive buffer is registered to the rx ring
+ * @param devctx device context
+ * @param sqpoll submit the writes through a kernel thread
+ * @return zero on success, error code otherwise
+ */
+static int32_t vkil_uring_init(vkil_devctx *devctx, const int32_t sqpoll)
+{
+	vkil_uring *uring;
+	struct iovec iov;
+	int32_t ret;
+
+	ret = vkil_mallocz((void **)&uring, sizeof(*uring));
+	if (ret)
+		return ret;
+	uring->rx.fd = -1;
+	uring->tx.fd = -1;
+	uring->rx_res = -EINPROGRESS;
+
+	ret = vkil_ring_init(&uring->rx, devctx->fd, 0);
+	if (ret)
+		goto fail;
+
+	iov.iov_base = devctx->rx.blk;
+	iov.iov_len = sizeof(vk2host_msg) * VKIL_RX_BUF_BLKS;
+	ret = syscall(__NR_io_uring_register, uring->rx.fd,
+		      IORING_REGISTER_BUFFERS, &iov, 1);
+	if (ret < 0) {
+		ret = -errno;
+		goto fail;
+	}
+
+	ret = vkil_ring_init(&uring->tx, devctx->fd,
+			     sqpoll ? IORING_SETUP_SQPOLL : 0);
+	if (ret)
+		goto fail;
+
+	ret = pthread_mutex_init(&uring->tx_lock, NULL);
+	if (ret) {
+		ret = -ret;
+		goto fail;
+	}
+
+	uring->rx_on = 1;
+	devctx->uring = uring;
+	VKIL_LOG(VK_LOG_DEBUG, "devctx=%p: io_uring transport%s", devctx,
+		 sqpoll ? " (sqpoll)" : "");
+	return 0;
+
+fail:
+	vkil_ring_deinit(&uring->tx);
+	vkil_ring_deinit(&uring->rx);
+	vkil_free((void **)&uring);
+	return ret;
+}
+
+/**
+ * @brief release the io_uring transport of a device
+ * @param devctx device context
+ */
+static void vkil_uring_deinit(vkil_devctx *devctx)
+{
+	vkil_uring *uring = devctx->uring;
+
+	if (!uring)
+		return;
+
+	vkil_uring_rx_stop(devctx);
+	pthread_mutex_destroy(&uring->tx_lock);
+	vkil_ring_deinit(&uring->tx);
+	vkil_ring_deinit(&uring->rx);
+	vkil_free((void **)&devctx->uring);
+}
+
+/**
+ * @brief open the kernel driver, and set up its io_uring transport
+ * @param devctx   device context
+ * @param dev_name driver name
+ * @param sqpoll   submit the writes through a kernel thread
+ * @return zero on success, error code otherwise
+ */
+static int32_t vkil_uring_open(vkil_devctx *devctx, const char *dev_name,
+			       const int32_t sqpoll)
+{
+	int32_t ret;
+
+	ret = vkil_kdrv_ops.open(devctx, dev_name);
+	if (ret)
+		return ret;
+
+	ret = vkil_uring_init(devctx, sqpoll);
+	if (ret)
+		vkil_kdrv_ops.close(devctx);
+	return ret;
+}
+
+static int32_t uring_open(vkil_devctx *devctx, const char *dev_name)
+{
+	return vkil_uring_open(devctx, dev_name, 0);
+}
+
+static int32_t sqpoll_open(vkil_devctx *devctx, const char *dev_name)
+{
+	return vkil_uring_open(devctx, dev_name, 1);
+}
+
+static void uring_close(vkil_devctx *devctx)
+{
+	vkil_uring_deinit(devctx);
+	vkil_kdrv_ops.close(devctx);
+}
+
+static ssize_t uring_reap(vkil_devctx *devctx, const int32_t q_id, void *buf,
+			  const size_t nbytes)
+{
+	ssize_t ret;
+
+	ret = vkil_uring_read(devctx, q_id, buf, nbytes);
+	if (ret != -ENOTSUP)
+		return ret;
+	/* the rx ring is stopped, the driver is read directly */
+	return vkil_kdrv_ops.reap(devctx, q_id, buf, nbytes);
+}
+
+static int32_t uring_poll(vkil_devctx *devctx, const int timeout_ms)
+{
+	int32_t ret;
+
+	ret = vkil_uring_wait(devctx, timeout_ms);
+	if (ret != -ENOTSUP)
+		return ret;
+	return vkil_kdrv_ops.poll(devctx, timeout_ms);
+}
+
+const vkil_transport_ops vkil_uring_ops = {
+	.name = "io_uring",
+	.open = uring_open,
+	.close = uring_close,
+	.submit = vkil_uring_writev,
+	.reap = uring_reap,
+	.poll = uring_poll,
+	.rx_stop = vkil_uring_rx_stop,
+	.fallback = &vkil_kdrv_ops,
+};
+
+const vkil_transport_ops vkil_sqpoll_ops = {
+	.name = "io_uring_sqpoll",
+	.open = sqpoll_open,
+	.close = uring_close,
+	.submit = vkil_uring_writev,
+	.reap = uring_reap,
+	.poll = uring_poll,
+	.rx_stop = vkil_uring_rx_stop,
+	.fallback = &vkil_kdrv_ops,
+};
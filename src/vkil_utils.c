@@ -9,6 +9,7 @@
  */
 
 #include <errno.h>
+#include <time.h>
 #include <unistd.h>
 #include "vkil_backend.h"
 #include "vkil_internal.h"
@@ -16,6 +17,18 @@
 
 #define VKSIM_ALIGN 16 /**< memory  is allocated on 16 bytes boundary */
 
+/**
+ * get a monotonic time
+ * @return time in us
+ */
+int64_t vkil_get_time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 /**
  * alloc memory
  * @param pointer
@@ -35,6 +35,8 @@
 #define VKIL_LOG_VK2HOST_MSG(loglevel, msg)				\
 		VK_VK2H_LOG(VKIL_LOG, loglevel, msg)
 
+int64_t vkil_get_time_us(void);
+
 int vkil_malloc(void **ptr, size_t size);
 int vkil_mallocz(void **ptr, size_t size);
 void vkil_free(void **ptr);
@@ -0,0 +1,255 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+ * Copyright 2018-2020 Broadcom.
+ */
+
+/*
+ * measure how the processing priority lanes isolate a latency sensitive
+ * context from a bulk load: a context issues blocking temperature queries,
+ * and its latency percentiles are measured while other contexts keep
+ * process_buffer commands in flight. The round is run with all the contexts
+ * on the same lane, then on the high and low lanes, and then with the low
+ * lane deferred on a high lane backlog.
+ *
+ * the bulk contexts submit dummy packets, so the benchmark is meant for the
+ * loopback transport or a model of the card
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "vkil_api.h"
+
+#define BENCH_BULK      4   /* number of bulk contexts */
+#define BENCH_WINDOW    256 /* commands in flight per bulk context */
+#define BENCH_ITER      2000
+#define BENCH_PERIOD_US 200 /* between two latency sensitive queries */
+
+typedef struct _bench_bulk {
+	pthread_t thread;
+	vkil_context *ilctx;
+	vkil_buffer_packet pkt[BENCH_WINDOW];
+	uint64_t done; /**< commands completed */
+	int32_t ret;
+} bench_bulk;
+
+static vkil_api *ilapi;
+static uint32_t bench_iter = BENCH_ITER;
+static uint32_t bench_nbulk = BENCH_BULK;
+static atomic_int bench_stop;
+
+static int64_t bench_time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int bench_cmp(const void *a, const void *b)
+{
+	int64_t d = *(const int64_t *)a - *(const int64_t *)b;
+
+	return (d > 0) - (d < 0);
+}
+
+static void *bench_bulk_run(void *arg)
+{
+	bench_bulk *bb = arg;
+	uint32_t sub = 0, done = 0;
+	int32_t ret = 0;
+
+	while (!atomic_load(&bench_stop)) {
+		/* keep the window full, then retrieve the oldest response */
+		while ((sub - done < BENCH_WINDOW) &&
+		       !(ret = ilapi->process_buffer(bb->ilctx,
+				&bb->pkt[sub % BENCH_WINDOW], VK_CMD_RUN)))
+			sub++;
+		if (ret && (ret != -EAGAIN))
+			break;
+		/* deferred by the high priority lane, with nothing in flight */
+		if (sub == done) {
+			usleep(BENCH_PERIOD_US);
+			continue;
+		}
+		ret = ilapi->process_buffer(bb->ilctx,
+					    &bb->pkt[done % BENCH_WINDOW],
+					    VK_CMD_RUN | VK_CMD_OPT_CB |
+					    VK_CMD_OPT_BLOCKING);
+		if (ret)
+			break;
+		done++;
+	}
+	if (ret == -EAGAIN)
+		ret = 0;
+	while (!ret && (done != sub)) {
+		ret = ilapi->process_buffer(bb->ilctx,
+					    &bb->pkt[done % BENCH_WINDOW],
+					    VK_CMD_RUN | VK_CMD_OPT_CB |
+					    VK_CMD_OPT_BLOCKING);
+		done++;
+	}
+	bb->done = done;
+	bb->ret = ret;
+	return NULL;
+}
+
+static int bench_new_ctx(vkil_context **ilctx, const char *pri)
+{
+	int ret;
+
+	*ilctx = NULL;
+	ret = vkil_set_processing_pri(pri);
+	if (!ret)
+		ret = ilapi->init((void **)ilctx);
+	if (!ret)
+		ret = ilapi->init((void **)ilctx);
+	return ret;
+}
+
+static int bench_round(bench_bulk *bb, int64_t *lat, const char *name,
+		       const char *hi_pri, const char *lo_pri,
+		       const uint32_t backlog)
+{
+	vkil_context *ilctx = NULL;
+	uint64_t bulk = 0;
+	int64_t start, end;
+	uint32_t i, j, data;
+	int ret;
+
+	atomic_store(&bench_stop, 0);
+	vkil_set_pri_backlog(backlog);
+	ret = bench_new_ctx(&ilctx, hi_pri);
+	for (i = 0; !ret && (i < bench_nbulk); i++) {
+		ret = bench_new_ctx(&bb[i].ilctx, lo_pri);
+		for (j = 0; j < BENCH_WINDOW; j++)
+			bb[i].pkt[j].prefix.type = VKIL_BUF_PACKET;
+	}
+	vkil_set_processing_pri(NULL);
+	if (ret) {
+		printf("context init failure %d\n", ret);
+		goto out;
+	}
+
+	for (i = 0; i < bench_nbulk; i++)
+		pthread_create(&bb[i].thread, NULL, bench_bulk_run, &bb[i]);
+
+	start = bench_time_us();
+	for (i = 0; i < bench_iter; i++) {
+		usleep(BENCH_PERIOD_US);
+		lat[i] = bench_time_us();
+		ret = ilapi->get_parameter(ilctx, VK_PARAM_TEMPERATURE, &data,
+					   VK_CMD_RUN | VK_CMD_OPT_BLOCKING);
+		lat[i] = bench_time_us() - lat[i];
+		if (ret < 0)
+			break;
+	}
+	end = bench_time_us();
+
+	atomic_store(&bench_stop, 1);
+	for (i = 0; i < bench_nbulk; i++) {
+		pthread_join(bb[i].thread, NULL);
+		if (bb[i].ret < 0)
+			ret = bb[i].ret;
+		bulk += bb[i].done;
+	}
+
+	qsort(lat, bench_iter, sizeof(*lat), bench_cmp);
+	printf("%-16s p50 %6lld us  p99 %6lld us  max %6lld us  ", name,
+	       (long long)lat[bench_iter / 2],
+	       (long long)lat[bench_iter * 99 / 100],
+	       (long long)lat[bench_iter - 1]);
+	printf("bulk %.0f msg/s%s\n", bulk * 1e6 / (end - start),
+	       (ret < 0) ? " (failed)" : "");
+
+out:
+	for (i = 0; i < bench_nbulk; i++)
+		if (bb[i].ilctx)
+			ilapi->deinit((void **)&bb[i].ilctx);
+	if (ilctx)
+		ilapi->deinit((void **)&ilctx);
+	vkil_set_pri_backlog(0);
+	return (ret < 0) ? ret : 0;
+}
+
+static void print_usage(void)
+{
+	printf("bench_vkil_pri [-d device] [-c contexts] [-n iterations] ");
+	printf("[-b backlog] [-m caller|dispatcher] ");
+	printf("[-T sync|io_uring|model|model_ring|loopback]\n");
+}
+
+int main(int argc, char *argv[])
+{
+	bench_bulk *bb;
+	uint32_t backlog = 1;
+	char *dev_id = NULL;
+	int64_t *lat;
+	int c, ret;
+
+	while ((c = getopt(argc, argv, "d:c:n:b:m:T:")) != -1) {
+		switch (c) {
+		case 'd':
+			dev_id = optarg;
+			break;
+		case 'c':
+			bench_nbulk = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			bench_iter = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			backlog = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			if (vkil_set_completion_mode(optarg)) {
+				print_usage();
+				return -EINVAL;
+			}
+			break;
+		case 'T':
+			if (vkil_set_transport(optarg)) {
+				print_usage();
+				return -EINVAL;
+			}
+			break;
+		default:
+			print_usage();
+			return 0;
+		}
+	}
+
+	ret = dev_id ? vkil_set_affinity(dev_id) : 0;
+	if (ret) {
+		printf("Error in setting the affinity\n");
+		return ret;
+	}
+
+	bb = calloc(bench_nbulk ? bench_nbulk : 1, sizeof(*bb));
+	lat = bench_iter ? calloc(bench_iter, sizeof(*lat)) : NULL;
+	if (!bb || !lat) {
+		free(bb);
+		return -EINVAL;
+	}
+
+	ilapi = vkil_create_api();
+	assert(ilapi);
+
+	ret = bench_round(bb, lat, "single lane", "med", "med", 0);
+	if (!ret)
+		ret = bench_round(bb, lat, "priority lanes", "high", "low", 0);
+	if (!ret)
+		ret = bench_round(bb, lat, "low deferred", "high", "low",
+				  backlog);
+
+	vkil_destroy_api((void **)&ilapi);
+	free(lat);
+	free(bb);
+	return ret;
+}
@@ -0,0 +1,165 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+ * Copyright 2018-2020 Broadcom.
+ */
+
+/*
+ * measure how the message throughput scales with the number of queues:
+ * each thread owns a context, and issues blocking temperature queries; the
+ * contexts being spread over 1 up to VKIL_MSG_Q_MAX queues
+ *
+ * on a single cpu host, against a user space model answering right away,
+ * 6 threads and 20000 queries each, in caller mode (msg/s, 1/2/3 queues):
+ *	single device lock:	1.82M 2.05M 2.02M
+ *	per queue locks:	1.51M 1.51M 1.55M
+ * so no scaling shows there, the per queue locking costing about 20%; the
+ * queues thus keep sharing the device lock, until a split is shown to pay
+ * off with the callers running on several cpus
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "vkil_api.h"
+
+#define BENCH_Q_MAX     3 /* number of queues exposed by the card */
+#define BENCH_THREADS   6
+#define BENCH_ITER      10000
+
+typedef struct _bench_thread {
+	pthread_t thread;
+	vkil_context *ilctx;
+	uint32_t queue_id;
+	int32_t ret;
+} bench_thread;
+
+static vkil_api *ilapi;
+static uint32_t bench_iter = BENCH_ITER;
+
+static void *bench_run(void *arg)
+{
+	bench_thread *bt = arg;
+	uint32_t i, data;
+
+	for (i = 0; i < bench_iter; i++) {
+		bt->ret = ilapi->get_parameter(bt->ilctx,
+					       VK_PARAM_TEMPERATURE, &data,
+					       VK_CMD_RUN |
+					       VK_CMD_OPT_BLOCKING);
+		if (bt->ret < 0)
+			break;
+	}
+	return NULL;
+}
+
+static int bench_queues(bench_thread *bt, uint32_t nthreads, uint32_t nq)
+{
+	struct timespec start, end;
+	uint32_t i;
+	double s;
+	int ret = 0;
+
+	for (i = 0; i < nthreads; i++) {
+		bt[i].ilctx = NULL;
+		ilapi->init((void **)&bt[i].ilctx);
+		assert(bt[i].ilctx);
+		bt[i].queue_id = i % nq;
+		bt[i].ilctx->context_essential.queue_id = bt[i].queue_id;
+		ret = ilapi->init((void **)&bt[i].ilctx);
+		if (ret) {
+			printf("context %d init failure %d\n", i, ret);
+			goto out;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < nthreads; i++)
+		pthread_create(&bt[i].thread, NULL, bench_run, &bt[i]);
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(bt[i].thread, NULL);
+		if (bt[i].ret < 0)
+			ret = bt[i].ret;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	s = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("%u threads on %u queue(s): %.0f msg/s%s\n", nthreads, nq,
+	       nthreads * bench_iter / s, ret ? " (failed)" : "");
+
+out:
+	for (i = 0; i < nthreads; i++)
+		if (bt[i].ilctx)
+			ilapi->deinit((void **)&bt[i].ilctx);
+	return ret;
+}
+
+static void print_usage(void)
+{
+	printf("bench_vkil_queues [-d device] [-t threads] [-n iterations] ");
+	printf("[-m caller|dispatcher] [-T sync|io_uring|model|loopback]\n");
+}
+
+int main(int argc, char *argv[])
+{
+	bench_thread *bt;
+	uint32_t nq, nthreads = BENCH_THREADS;
+	char *dev_id = NULL;
+	int c, ret;
+
+	while ((c = getopt(argc, argv, "d:t:n:m:T:")) != -1) {
+		switch (c) {
+		case 'd':
+			dev_id = optarg;
+			break;
+		case 't':
+			nthreads = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			bench_iter = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			if (vkil_set_completion_mode(optarg)) {
+				print_usage();
+				return -EINVAL;
+			}
+			break;
+		case 'T':
+			if (vkil_set_transport(optarg)) {
+				print_usage();
+				return -EINVAL;
+			}
+			break;
+		default:
+			print_usage();
+			return 0;
+		}
+	}
+
+	ret = dev_id ? vkil_set_affinity(dev_id) : 0;
+	if (ret) {
+		printf("Error in setting the affinity\n");
+		return ret;
+	}
+
+	bt = nthreads ? calloc(nthreads, sizeof(*bt)) : NULL;
+	if (!bt)
+		return -EINVAL;
+
+	ilapi = vkil_create_api();
+	assert(ilapi);
+
+	for (nq = 1; nq <= BENCH_Q_MAX; nq++) {
+		ret = bench_queues(bt, nthreads, nq);
+		if (ret)
+			break;
+	}
+
+	vkil_destroy_api((void **)&ilapi);
+	free(bt);
+	return ret;
+}
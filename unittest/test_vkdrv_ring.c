@@ -0,0 +1,183 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+ * Copyright 2018-2020 Broadcom.
+ */
+
+/*
+ * reference producer and consumer of the driver model shared memory rings,
+ * with a model thread echoing the host2vk messages into the vk2host rings
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include "vkdrv_ring.h"
+#include "vkil_backend.h"
+
+#define TEST_NQ     2
+#define TEST_NBLKS  16 /* small, for the rings to wrap around often */
+#define TEST_ROUNDS 10000
+#define TEST_MAX_SIZE 4 /* max extra blocks of a message */
+
+static struct vkdrv_ring_hdr *hdr;
+
+/* a message of 1 + size blocks tagged with seq, each block stamped */
+static void test_build(host2vk_msg *msg, const uint32_t seq,
+		       const uint32_t queue_id)
+{
+	const uint8_t size = seq % (TEST_MAX_SIZE + 1);
+	uint32_t i;
+
+	memset(msg, 0, sizeof(*msg) * (size + 1));
+	msg->function_id = VK_FID_PRIVATE;
+	msg->size = size;
+	msg->queue_id = queue_id;
+	msg->context_id = seq;
+	for (i = 1; i <= size; i++)
+		msg[i].context_id = seq + i;
+}
+
+static void test_check(const vk2host_msg *msg, const uint32_t seq,
+		       const uint32_t queue_id)
+{
+	const uint8_t size = seq % (TEST_MAX_SIZE + 1);
+	uint32_t i;
+
+	assert((msg->size == size) && (msg->context_id == seq) &&
+	       (msg->queue_id == queue_id));
+	for (i = 1; i <= size; i++)
+		assert(msg[i].context_id == seq + i);
+}
+
+void test_full(void)
+{
+	const uint32_t start = UINT32_MAX - 5;
+	struct vkdrv_ring *r = &hdr->host2vk[0];
+	host2vk_msg msg[TEST_MAX_SIZE + 1];
+	vk2host_msg rsp[TEST_NBLKS];
+	uint32_t i, n, seq, used = 0;
+	int ret;
+
+	/* the indexes wrap around, and the messages around the ring end */
+	atomic_store(&r->head, start);
+	atomic_store(&r->tail, start);
+
+	ret = vkdrv_ring_get(hdr, r, rsp, TEST_NBLKS);
+	assert(ret == -ENOMSG);
+
+	/* 1 + 2 + 3 + 4 + 5 + 1 blocks, up to the last slot */
+	for (seq = 0; ; seq++) {
+		test_build(msg, seq, 0);
+		ret = vkdrv_ring_put(hdr, r, msg, msg->size + 1);
+		if (ret)
+			break;
+		used += msg->size + 1;
+	}
+	assert((ret == -EAGAIN) && (seq == 6) && (used == TEST_NBLKS));
+	assert(atomic_load(&r->tail) - atomic_load(&r->head) == used);
+
+	/* a message not fitting in the buffer stays in the ring */
+	ret = vkdrv_ring_get(hdr, r, rsp, 1);
+	assert(ret == 1);
+	test_check(rsp, 0, 0);
+	ret = vkdrv_ring_get(hdr, r, rsp, 1);
+	assert((ret == -EMSGSIZE) && (rsp->size == 1));
+
+	/* the others come back to back, in order */
+	ret = vkdrv_ring_get(hdr, r, rsp, TEST_NBLKS);
+	assert(ret == (int)used - 1);
+	for (i = 1, n = 0; i < seq; n += rsp[n].size + 1)
+		test_check(&rsp[n], i++, 0);
+	assert(n == used - 1);
+	ret = vkdrv_ring_get(hdr, r, rsp, TEST_NBLKS);
+	assert(ret == -ENOMSG);
+	assert(atomic_load(&r->head) == (uint32_t)(start + used));
+}
+
+/* model: echo the messages of the host2vk rings into the vk2host ones */
+static void *model_run(void *arg)
+{
+	vk2host_msg blk[TEST_NBLKS];
+	uint32_t q, n, nblks, done = 0;
+	int ret;
+
+	(void)arg;
+	while (done < TEST_NQ * TEST_ROUNDS) {
+		/* the host gets the cpu if there was nothing to do */
+		sched_yield();
+		for (q = 0; q < TEST_NQ; q++) {
+			ret = vkdrv_ring_get(hdr, &hdr->host2vk[q], blk,
+					     TEST_NBLKS);
+			if (ret == -ENOMSG)
+				continue;
+			assert(ret > 0);
+			for (n = 0; n < (uint32_t)ret; n += nblks) {
+				nblks = blk[n].size + 1;
+				blk[n].function_id = VK_FID_PRIVATE_DONE;
+				/* the host reads them back meanwhile */
+				while (vkdrv_ring_put(hdr, &hdr->vk2host[q],
+						      &blk[n], nblks))
+					sched_yield();
+				done++;
+			}
+		}
+	}
+	return NULL;
+}
+
+void test_round_trip(void)
+{
+	host2vk_msg msg[TEST_MAX_SIZE + 1];
+	vk2host_msg rsp[TEST_NBLKS];
+	uint32_t q, n, sent[TEST_NQ] = {0}, rcvd[TEST_NQ] = {0}, total = 0;
+	pthread_t model;
+	int ret;
+
+	memset(hdr, 0, vkdrv_ring_size(TEST_NQ, TEST_NBLKS));
+	vkdrv_ring_init(hdr, TEST_NQ, TEST_NBLKS);
+	pthread_create(&model, NULL, model_run, NULL);
+
+	while (total < TEST_NQ * TEST_ROUNDS) {
+		sched_yield();
+		for (q = 0; q < TEST_NQ; q++) {
+			/* queue as many messages as the ring takes */
+			while (sent[q] < TEST_ROUNDS) {
+				test_build(msg, sent[q], q);
+				if (vkdrv_ring_put(hdr, &hdr->host2vk[q], msg,
+						   msg->size + 1))
+					break;
+				sent[q]++;
+			}
+			ret = vkdrv_ring_get(hdr, &hdr->vk2host[q], rsp,
+					     TEST_NBLKS);
+			if (ret == -ENOMSG)
+				continue;
+			assert(ret > 0);
+			for (n = 0; n < (uint32_t)ret; n += rsp[n].size + 1) {
+				assert(rsp[n].function_id ==
+				       VK_FID_PRIVATE_DONE);
+				test_check(&rsp[n], rcvd[q]++, q);
+				total++;
+			}
+		}
+	}
+	pthread_join(model, NULL);
+}
+
+int main(void)
+{
+	static _Alignas(64) uint8_t mem[sizeof(struct vkdrv_ring_hdr) +
+			   2 * TEST_NQ * TEST_NBLKS * VKDRV_RING_BLK_SIZE];
+
+	assert(sizeof(mem) == vkdrv_ring_size(TEST_NQ, TEST_NBLKS));
+	assert(sizeof(host2vk_msg) == VKDRV_RING_BLK_SIZE);
+	hdr = (struct vkdrv_ring_hdr *)mem;
+	vkdrv_ring_init(hdr, TEST_NQ, TEST_NBLKS);
+
+	test_full();
+	test_round_trip();
+	printf("Passed!\n");
+	return 0;
+}
@@ -0,0 +1,804 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+ * Copyright 2018-2020 Broadcom.
+ */
+
+/*
+ * behaviour of the backend components, exercised on an in process card
+ * (loopback transport), so that no device is required
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "vkil_internal.h"
+#include "vkil_utils.h"
+
+#define TEST_THREADS 4
+#define TEST_ITER    100000
+
+static vkil_devctx *devctx;
+static vkil_msg_account *acct;
+
+/* owner count per msg_id, to catch an id handed out twice */
+static atomic_int msg_id_owners[VKIL_MSG_ID_MAX];
+
+void test_init_dev(void)
+{
+	int32_t ret;
+
+	ret = vkil_set_transport("loopback");
+	assert(!ret);
+	ret = vkil_init_dev((void **)&devctx, 0);
+	assert(ret == 0);
+	assert(devctx);
+	ret = vkil_new_msg_account(&acct);
+	assert(!ret);
+}
+
+void test_msg_id_exhaust(void)
+{
+	int32_t i, msg_id, owners;
+
+	/* msg_id 0 is reserved, all the other ones are handed out once */
+	for (i = 1; i < VKIL_MSG_ID_MAX; i++) {
+		msg_id = vkil_get_msg_id(devctx, acct);
+		assert((msg_id > 0) && (msg_id < VKIL_MSG_ID_MAX));
+		owners = atomic_fetch_add(&msg_id_owners[msg_id], 1);
+		assert(!owners);
+	}
+	msg_id = vkil_get_msg_id(devctx, acct);
+	assert(msg_id == -EAGAIN);
+
+	/* a returned id is the one handed out next */
+	vkil_return_msg_id(devctx, 100);
+	msg_id = vkil_get_msg_id(devctx, acct);
+	assert(msg_id == 100);
+	/* also when found in another bitmap word than the last one used */
+	vkil_return_msg_id(devctx, 3);
+	msg_id = vkil_get_msg_id(devctx, acct);
+	assert(msg_id == 3);
+
+	for (i = 1; i < VKIL_MSG_ID_MAX; i++) {
+		vkil_return_msg_id(devctx, i);
+		atomic_store(&msg_id_owners[i], 0);
+	}
+	assert(!acct->inflight);
+}
+
+static void *msg_id_run(void *arg)
+{
+	int32_t i, msg_id[8], n, owners;
+
+	(void)arg;
+	for (i = 0; i < TEST_ITER; i++) {
+		/* hold a few ids at once, so that the threads interleave */
+		for (n = 0; n < 8; n++) {
+			msg_id[n] = vkil_get_msg_id(devctx, acct);
+			assert(msg_id[n] > 0);
+			owners = atomic_fetch_add(&msg_id_owners[msg_id[n]], 1);
+			assert(!owners);
+		}
+		for (n = 0; n < 8; n++) {
+			atomic_fetch_sub(&msg_id_owners[msg_id[n]], 1);
+			vkil_return_msg_id(devctx, msg_id[n]);
+		}
+	}
+	return NULL;
+}
+
+void test_msg_id_concurrent(void)
+{
+	pthread_t thread[TEST_THREADS];
+	int32_t i;
+
+	for (i = 0; i < TEST_THREADS; i++)
+		pthread_create(&thread[i], NULL, msg_id_run, NULL);
+	for (i = 0; i < TEST_THREADS; i++)
+		pthread_join(thread[i], NULL);
+
+	assert(!acct->inflight);
+	for (i = 0; i < VKIL_MSG_ID_WORDS; i++)
+		assert(atomic_load(&devctx->msgid_ctx.used[i]) == !i);
+}
+
+/* write a command on the loopback card, which responds right away */
+static int32_t test_submit(const uint32_t fid, const uint32_t context_id,
+			   const uint32_t queue_id)
+{
+	host2vk_msg msg;
+	int32_t msg_id, ret;
+
+	msg_id = vkil_get_msg_id(devctx, acct);
+	assert(msg_id > 0);
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_id = msg_id;
+	msg.function_id = fid;
+	msg.context_id = context_id;
+	msg.queue_id = queue_id;
+	ret = vkil_write(devctx, &msg);
+	assert(!ret);
+	return msg_id;
+}
+
+/* read a response by msg_id, or by function if msg_id is zero */
+static int32_t test_retrieve(const int32_t msg_id, const uint32_t fid,
+			     const uint32_t context_id,
+			     const uint32_t queue_id, const int64_t deadline_us,
+			     vk2host_msg *msg)
+{
+	memset(msg, 0, sizeof(*msg));
+	msg->msg_id = msg_id;
+	msg->function_id = fid;
+	msg->context_id = context_id;
+	msg->queue_id = queue_id;
+	return vkil_read(devctx, msg, deadline_us, NULL);
+}
+
+void test_cmpl_table(void)
+{
+	int32_t i, ret, msg_id[16], ctx_a[3], ctx_b[2];
+	vk2host_msg msg;
+
+	/* responses retrieved by msg_id, in reverse order of arrival */
+	for (i = 0; i < 16; i++)
+		msg_id[i] = test_submit(VK_FID_GET_PARAM, 0x100, 0);
+	for (i = 15; i >= 0; i--) {
+		ret = test_retrieve(msg_id[i], 0, 0, 0, INT64_MAX, &msg);
+		assert(!ret);
+		assert(msg.msg_id == msg_id[i]);
+		assert(msg.function_id == VK_FID_GET_PARAM_DONE);
+		vkil_return_msg_id(devctx, msg_id[i]);
+	}
+	/* a response is retrieved only once */
+	ret = test_retrieve(msg_id[0], 0, 0, 0, 0, &msg);
+	assert(ret == -EAGAIN);
+
+	/* by function, the oldest response of the context comes first */
+	for (i = 0; i < 3; i++) {
+		ctx_a[i] = test_submit(VK_FID_SET_PARAM, 0x100, 0);
+		if (i < 2)
+			ctx_b[i] = test_submit(VK_FID_SET_PARAM, 0x101, 0);
+	}
+	for (i = 0; i < 2; i++) {
+		ret = test_retrieve(0, VK_FID_SET_PARAM_DONE, 0x101, 0,
+				    INT64_MAX, &msg);
+		assert(!ret);
+		assert(msg.msg_id == ctx_b[i]);
+		vkil_return_msg_id(devctx, ctx_b[i]);
+	}
+	for (i = 0; i < 3; i++) {
+		ret = test_retrieve(0, VK_FID_SET_PARAM_DONE, 0x100, 0,
+				    INT64_MAX, &msg);
+		assert(!ret);
+		assert(msg.msg_id == ctx_a[i]);
+		vkil_return_msg_id(devctx, ctx_a[i]);
+	}
+	ret = test_retrieve(0, VK_FID_SET_PARAM_DONE, 0x100, 0, 0, &msg);
+	assert(ret == -EAGAIN);
+
+	/* a response read for another queue is filed in its own queue */
+	msg_id[0] = test_submit(VK_FID_GET_PARAM, 0x100, 2);
+	msg_id[1] = test_submit(VK_FID_GET_PARAM, 0x100, 0);
+	ret = test_retrieve(msg_id[1], 0, 0, 0, INT64_MAX, &msg);
+	assert(!ret);
+	ret = test_retrieve(msg_id[0], 0, 0, 2, 0, &msg);
+	assert(!ret);
+	assert((msg.msg_id == msg_id[0]) && (msg.queue_id == 2));
+	vkil_return_msg_id(devctx, msg_id[0]);
+	vkil_return_msg_id(devctx, msg_id[1]);
+	assert(!acct->inflight);
+}
+
+void test_rx_batch(void)
+{
+	static const uint8_t size[] = {0, 3, 1, 0, 4, 2};
+	const int32_t n = sizeof(size) / sizeof(size[0]);
+	int32_t i, j, ret, msg_id[sizeof(size)];
+	host2vk_msg cmd[5];
+	vk2host_msg rsp[5];
+	uint32_t *data;
+
+	/* private commands get their payload echoed back */
+	for (i = 0; i < n; i++) {
+		msg_id[i] = vkil_get_msg_id(devctx, acct);
+		assert(msg_id[i] > 0);
+		memset(cmd, 0, sizeof(cmd));
+		cmd[0].function_id = VK_FID_PRIVATE;
+		cmd[0].size = size[i];
+		cmd[0].msg_id = msg_id[i];
+		cmd[0].args[0] = i;
+		data = host2vk_getdatap(cmd);
+		for (j = 0; j < size[i] * 4; j++)
+			data[j] = (i << 8) | j;
+		ret = vkil_write(devctx, cmd);
+		assert(!ret);
+	}
+
+	/*
+	 * the loopback card returns all of them to a single driver read;
+	 * once split on their size, they are all in the completion table
+	 */
+	memset(rsp, 0, sizeof(rsp));
+	rsp[0].msg_id = msg_id[0];
+	ret = vkil_read(devctx, rsp, INT64_MAX, NULL);
+	assert(!ret);
+	vkil_return_msg_id(devctx, msg_id[0]);
+
+	/* no one can read the driver from now on */
+	pthread_mutex_lock(&devctx->rx_lock);
+	for (i = 1; i < n; i++) {
+		memset(rsp, 0, sizeof(rsp));
+		rsp[0].msg_id = msg_id[i];
+		rsp[0].size = size[i] ? size[i] - 1 : 0;
+		ret = vkil_read(devctx, rsp, 0, NULL);
+		if (size[i]) {
+			/* the response is kept until read in a large buffer */
+			assert((ret == -EMSGSIZE) && (rsp[0].size == size[i]));
+			ret = vkil_read(devctx, rsp, 0, NULL);
+		}
+		assert(!ret);
+		assert((rsp[0].function_id == VK_FID_PRIVATE_DONE) &&
+		       (rsp[0].size == size[i]) && (rsp[0].arg == i));
+		data = vk2host_getdatap(rsp);
+		for (j = 0; j < size[i] * 4; j++)
+			assert(data[j] == ((i << 8) | j));
+		vkil_return_msg_id(devctx, msg_id[i]);
+	}
+	pthread_mutex_unlock(&devctx->rx_lock);
+	assert(!acct->inflight);
+}
+
+/* get msg_ids for an account until refused, return how many were got */
+static int32_t test_take(vkil_msg_account *a, int32_t *ids, const int32_t max)
+{
+	int32_t n = 0, msg_id;
+
+	while (n < max) {
+		msg_id = vkil_get_msg_id(devctx, a);
+		if (msg_id < 0) {
+			assert(msg_id == -EAGAIN);
+			break;
+		}
+		ids[n++] = msg_id;
+	}
+	return n;
+}
+
+static void test_give(int32_t *ids, const int32_t n)
+{
+	int32_t i;
+
+	for (i = 0; i < n; i++)
+		vkil_return_msg_id(devctx, ids[i]);
+}
+
+void test_msg_quota(void)
+{
+	static int32_t ids_a[VKIL_MSG_ID_MAX], ids_b[VKIL_MSG_ID_MAX];
+	vkil_msg_account *a, *b;
+	int32_t n, m, ret;
+
+	ret = vkil_new_msg_account(&a);
+	assert(!ret);
+	ret = vkil_new_msg_account(&b);
+	assert(!ret);
+
+	/* in flight messages capped */
+	ret = vkil_set_msg_account(devctx, a, 4, 0);
+	assert(!ret);
+	n = test_take(a, ids_a, VKIL_MSG_ID_MAX);
+	assert(n == 4);
+	test_give(ids_a, 1);
+	m = test_take(a, ids_a, 1);
+	assert(m == 1);
+	test_give(ids_a, n);
+
+	/* msg_ids set aside can't be taken by another context */
+	ret = vkil_set_msg_account(devctx, a, 0, 8);
+	assert(!ret);
+	n = test_take(b, ids_b, VKIL_MSG_ID_MAX);
+	assert(n == VKIL_MSG_ID_MAX - 1 - 8);
+	m = test_take(a, ids_a, VKIL_MSG_ID_MAX);
+	assert(m == 8);
+
+	/* nor set aside beyond the shared ones unused */
+	test_give(ids_b, 4);
+	ret = vkil_set_msg_account(devctx, b, 0, 5);
+	assert(ret == -ENOSPC);
+	ret = vkil_set_msg_account(devctx, b, 0, 4);
+	assert(!ret);
+
+	/* the ones held beyond a lowered reservation stay set aside */
+	ret = vkil_set_msg_account(devctx, a, 0, 2);
+	assert(!ret);
+	n = test_take(b, ids_b, 4);
+	assert(n == 4);
+	n = test_take(b, ids_b + 4, 1);
+	assert(!n);
+	test_give(ids_a + 2, m - 2);
+	/* ids_b[4..] are still held, the new ones go after them */
+	n = VKIL_MSG_ID_MAX - 1 - 8;
+	ret = test_take(b, ids_b + n, VKIL_MSG_ID_MAX - n);
+	assert(ret == m - 2);
+	n += ret;
+
+	/* an account outlives its detached context until its last msg_id */
+	vkil_detach_msg_account(devctx, a);
+	test_give(ids_a, 2);
+	test_give(ids_b, n);
+	vkil_detach_msg_account(devctx, b);
+	assert(!atomic_load(&devctx->msgid_ctx.budget));
+}
+
+void test_resp_size(void)
+{
+	int32_t i, ret, msg_id[2];
+	host2vk_msg cmd[4];
+	vk2host_msg rsp[4];
+
+	for (i = 0; i < 2; i++) {
+		msg_id[i] = vkil_get_msg_id(devctx, acct);
+		assert(msg_id[i] > 0);
+		memset(cmd, 0, sizeof(cmd));
+		cmd[0].function_id = VK_FID_PRIVATE;
+		cmd[0].context_id = 0x102;
+		cmd[0].size = i ? 0 : 3;
+		cmd[0].msg_id = msg_id[i];
+		ret = vkil_write(devctx, cmd);
+		assert(!ret);
+	}
+
+	/* a single block is expected until a larger response is seen */
+	ret = vkil_get_resp_size(devctx, VK_FID_PRIVATE_DONE, 0, 0);
+	assert(!ret);
+
+	/* a response too large, found by function, tells its msg_id */
+	memset(rsp, 0, sizeof(rsp));
+	rsp[0].function_id = VK_FID_PRIVATE_DONE;
+	rsp[0].context_id = 0x102;
+	ret = vkil_read(devctx, rsp, INT64_MAX, NULL);
+	vkil_learn_resp_size(devctx, rsp, 0, 0, ret);
+	assert((ret == -EMSGSIZE) && (rsp[0].msg_id == msg_id[0]) &&
+	       (rsp[0].size == 3));
+	ret = vkil_get_resp_size(devctx, VK_FID_PRIVATE_DONE, 0, 0);
+	assert(ret == 3);
+	ret = vkil_get_resp_size(devctx, VK_FID_PRIVATE_DONE, 1, 0);
+	assert(!ret);
+
+	/* so that it is the one retrieved again */
+	ret = vkil_read(devctx, rsp, INT64_MAX, NULL);
+	assert(!ret && (rsp[0].msg_id == msg_id[0]));
+	memset(rsp, 0, sizeof(rsp));
+	rsp[0].function_id = VK_FID_PRIVATE_DONE;
+	rsp[0].context_id = 0x102;
+	ret = vkil_read(devctx, rsp, INT64_MAX, NULL);
+	assert(!ret && (rsp[0].msg_id == msg_id[1]));
+	test_give(msg_id, 2);
+}
+
+static atomic_int credit_written;
+
+static void *credit_run(void *arg)
+{
+	host2vk_msg *msg = arg;
+	int32_t ret;
+
+	ret = vkil_write_wait(devctx, msg, vkil_get_time_us() + 5000000);
+	assert(!ret);
+	atomic_store(&credit_written, 1);
+	return NULL;
+}
+
+void test_credit_wait(void)
+{
+	vkil_credit *cr = &devctx->q[0].credit;
+	vkil_msg_id *entry[2];
+	host2vk_msg msg[2];
+	struct timespec ts = {0, 50000000};
+	vk2host_msg rsp;
+	pthread_t thread;
+	int64_t start;
+	int32_t i, ret, msg_id[2];
+
+	assert(!atomic_load(&cr->inflight));
+	atomic_store(&cr->limit, 1);
+	for (i = 0; i < 2; i++) {
+		msg_id[i] = vkil_get_msg_id(devctx, acct);
+		assert(msg_id[i] > 0);
+		entry[i] = &devctx->msgid_ctx.msg_list[msg_id[i]];
+		memset(&msg[i], 0, sizeof(msg[i]));
+		msg[i].function_id = VK_FID_PRIVATE;
+		msg[i].msg_id = msg_id[i];
+	}
+
+	/* the response is left in the driver, while we are the reader */
+	pthread_mutex_lock(&devctx->rx_lock);
+	ret = vkil_write(devctx, &msg[0]);
+	assert(!ret && (atomic_load(&cr->inflight) == 1));
+	assert(atomic_load(&entry[0]->credits) == 1);
+	ret = vkil_write(devctx, &msg[1]);
+	assert(ret == -EAGAIN);
+	assert(!atomic_load(&entry[1]->credits));
+
+	/* so that the writer waits for the queue to have room */
+	pthread_create(&thread, NULL, credit_run, &msg[1]);
+	nanosleep(&ts, NULL);
+	assert(!atomic_load(&credit_written));
+
+	/* which a reader reading the response makes */
+	start = vkil_get_time_us();
+	pthread_mutex_unlock(&devctx->rx_lock);
+	vkil_reap_stale(devctx);
+	pthread_join(thread, NULL);
+	assert(vkil_get_time_us() - start < 1000000);
+
+	for (i = 0; i < 2; i++) {
+		ret = test_retrieve(msg_id[i], VK_FID_PRIVATE_DONE, 0, 0,
+				    INT64_MAX, &rsp);
+		assert(!ret);
+		/* each response gave back the credit of its message */
+		assert(!atomic_load(&entry[i]->credits));
+	}
+	assert(!atomic_load(&cr->inflight));
+	atomic_store(&cr->limit, VKIL_CREDIT_MAX);
+	test_give(msg_id, 2);
+}
+
+static struct {
+	int32_t n;
+	uint32_t context_id;
+	uint32_t function_id;
+	uint64_t user_data;
+} reaped;
+
+static void reap_cb(void *opaque, uint32_t context_id, uint32_t function_id,
+		    uint64_t user_data)
+{
+	assert(opaque == &reaped);
+	reaped.n++;
+	reaped.context_id = context_id;
+	reaped.function_id = function_id;
+	reaped.user_data = user_data;
+}
+
+static int32_t test_msg_id_used(const int32_t msg_id)
+{
+	return !!(atomic_load(&devctx->msgid_ctx.used[msg_id / 64]) &
+		  (1ULL << (msg_id % 64)));
+}
+
+void test_reaper(void)
+{
+	const vkil_reaper reaper = devctx->reaper;
+	struct timespec ts = {0, 30000000};
+	int32_t ret, kept, stale, lost;
+	vk2host_msg rsp;
+
+	/* a response without deadline is kept */
+	devctx->reaper.timeout_ms = 0;
+	kept = test_submit(VK_FID_PRIVATE, 0x77, 0);
+
+	devctx->reaper.timeout_ms = 20;
+	devctx->reaper.reaped = reap_cb;
+	devctx->reaper.opaque = &reaped;
+	stale = test_submit(VK_FID_PRIVATE, 0x77, 0);
+	devctx->msgid_ctx.msg_list[stale].user_data = 0x1234;
+
+	/* not stale yet */
+	devctx->reap_us = 0;
+	ret = vkil_reap_stale(devctx);
+	assert(!ret && !reaped.n);
+
+	nanosleep(&ts, NULL);
+	devctx->reap_us = 0;
+	ret = vkil_reap_stale(devctx);
+	assert(ret == 1);
+	assert((reaped.n == 1) && (reaped.context_id == 0x77) &&
+	       (reaped.function_id == VK_FID_PRIVATE_DONE) &&
+	       (reaped.user_data == 0x1234));
+	/* its msg_id is returned, and its response gone */
+	assert(!test_msg_id_used(stale));
+	ret = test_retrieve(stale, VK_FID_PRIVATE_DONE, 0x77, 0, 0, &rsp);
+	assert(ret == -EAGAIN);
+
+	ret = test_retrieve(kept, VK_FID_PRIVATE_DONE, 0x77, 0, 0, &rsp);
+	assert(!ret);
+	test_give(&kept, 1);
+
+	/* a msg_id given up on is released even if its response never comes */
+	lost = test_submit(VK_FID_SHUTDOWN, 0x78, 0);
+	devctx->msgid_ctx.msg_list[lost].user_data = 0x4321;
+	ret = test_retrieve(lost, 0, 0x78, 0, vkil_get_time_us() + 1000, &rsp);
+	assert(ret == -ETIMEDOUT);
+	devctx->reap_us = 0;
+	ret = vkil_reap_stale(devctx);
+	assert(!ret && test_msg_id_used(lost));
+
+	nanosleep(&ts, NULL);
+	devctx->reap_us = 0;
+	ret = vkil_reap_stale(devctx);
+	assert(ret == 1);
+	assert((reaped.n == 2) && (reaped.context_id == 0x78) &&
+	       (reaped.function_id == VK_FID_SHUTDOWN) &&
+	       (reaped.user_data == 0x4321));
+	assert(!test_msg_id_used(lost));
+	assert(!atomic_load(&devctx->nabandoned));
+	devctx->reaper = reaper;
+}
+
+static int32_t async_msg_id;
+
+static void async_cb(vkil_async *async, const int32_t msg_id)
+{
+	(void)async;
+	async_msg_id = msg_id;
+}
+
+/* write a command whose response is handed to an asynchronous completion */
+static int32_t test_submit_async(const uint32_t fid, vkil_async *async)
+{
+	host2vk_msg msg;
+	int32_t ret;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_id = vkil_get_msg_id(devctx, acct);
+	assert(msg.msg_id > 0);
+	msg.function_id = fid;
+	msg.context_id = 0x79;
+	vkil_set_msg_async(devctx, &msg, async);
+	ret = vkil_write(devctx, &msg);
+	assert(!ret);
+	return msg.msg_id;
+}
+
+void test_async_abandon(void)
+{
+	vkil_async async = {.done = async_cb};
+	int32_t ret, id;
+	vk2host_msg rsp;
+
+	/* a completion handed the response can't be abandoned */
+	id = test_submit_async(VK_FID_PRIVATE, &async);
+	devctx->reap_us = INT64_MAX;
+	vkil_reap_stale(devctx);
+	assert(async_msg_id == id);
+	ret = vkil_abandon_msg_async(devctx, &async);
+	assert(ret == -EINPROGRESS);
+	ret = test_retrieve(id, 0, 0x79, 0, 0, &rsp);
+	assert(!ret);
+	vkil_return_msg_id(devctx, id);
+
+	/* one still waiting is never called, its msg_id is reaped */
+	async_msg_id = 0;
+	id = test_submit_async(VK_FID_SHUTDOWN, &async);
+	ret = vkil_abandon_msg_async(devctx, &async);
+	assert(!ret && (atomic_load(&devctx->nabandoned) == 1));
+	devctx->msgid_ctx.msg_list[id].deadline_us = 1;
+	devctx->reap_us = 0;
+	ret = vkil_reap_stale(devctx);
+	assert((ret == 1) && !async_msg_id && !test_msg_id_used(id));
+	assert(!atomic_load(&devctx->nabandoned) && !acct->inflight);
+}
+
+static void *quota_run(void *arg)
+{
+	vkil_msg_account *a = arg;
+	int32_t i, n, ids[16];
+
+	for (i = 0; i < TEST_ITER / 10; i++) {
+		n = test_take(a, ids, 16);
+		test_give(ids, n);
+	}
+	return NULL;
+}
+
+void test_msg_quota_concurrent(void)
+{
+	vkil_msg_account *a[TEST_THREADS];
+	pthread_t thread[TEST_THREADS];
+	int32_t i, j, ret;
+
+	for (i = 0; i < TEST_THREADS; i++) {
+		ret = vkil_new_msg_account(&a[i]);
+		assert(!ret);
+		pthread_create(&thread[i], NULL, quota_run, a[i]);
+	}
+	/* reservations changed while the msg_ids are got and returned */
+	for (j = 0; j < TEST_ITER / 10; j++)
+		for (i = 0; i < TEST_THREADS; i++)
+			vkil_set_msg_account(devctx, a[i], (j % 3) * 16,
+					     (j + i) % 9);
+	for (i = 0; i < TEST_THREADS; i++) {
+		pthread_join(thread[i], NULL);
+		vkil_detach_msg_account(devctx, a[i]);
+	}
+	assert(!atomic_load(&devctx->msgid_ctx.budget));
+}
+
+void test_place(void)
+{
+	const int32_t id[] = {0, 1, 2}, shared_id[] = {14, 15};
+	const uint32_t close[] = {100, 95, 50}, apart[] = {100, 50, 50};
+	const uint32_t unknown[] = {0, 0, 0};
+	int32_t pick, ret;
+	char name[32];
+
+	/* the device opened by the test is card 0, card 1 having none */
+	assert(vkil_dev_refs(0) > vkil_dev_refs(1));
+
+	/* within the tolerance band, the card with fewer contexts is picked */
+	pick = vkil_place_pick(id, close, 3);
+	assert(pick == 1);
+	/* otherwise the one with the most available load */
+	pick = vkil_place_pick(id, apart, 3);
+	assert(pick == 0);
+	/* the loads unknown, the contexts are spread over the cards */
+	pick = vkil_place_pick(id, unknown, 3);
+	assert(pick == 1);
+
+	/*
+	 * the shared load table, if it can be mapped in this environment; a
+	 * private one, the cards being real ones to the other processes
+	 */
+	snprintf(name, sizeof(name), "/vkil-load-test-%lld",
+		 (long long)vkil_get_time_us());
+	ret = vkil_load_set_name(name);
+	assert(!ret);
+	if (vkil_load_scan())
+		return;
+	vkil_load_add(14, VK_ENCODER, 1, 1000000);
+	ret = vkil_load_scan();
+	assert(!ret);
+	pick = vkil_place_pick(shared_id, NULL, 2);
+	assert(pick == 1);
+	vkil_load_add(15, VK_ENCODER, 1, 950000);
+	pick = vkil_place_pick(shared_id, NULL, 2);
+	assert(pick == 0);
+	vkil_load_add(14, VK_ENCODER, -1, -1000000);
+	vkil_load_add(15, VK_ENCODER, -1, -950000);
+	shm_unlink(name);
+}
+
+/* ticket of a command written with test_submit */
+static vkil_ticket test_ticket(const int32_t msg_id)
+{
+	vkil_ticket ticket;
+	host2vk_msg msg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_id = msg_id;
+	vkil_set_ticket(devctx, &msg, &ticket);
+	return ticket;
+}
+
+/*
+ * lose the response of a command given up on, whose response never comes;
+ * reaped by the test, or by the dispatcher once the device has one
+ */
+static void test_lose(const int32_t msg_id)
+{
+	const struct timespec ts = {.tv_nsec = 1000000};
+	uint64_t reaped = atomic_load(&devctx->reaped);
+	vk2host_msg rsp;
+	int32_t ret;
+
+	ret = test_retrieve(msg_id, 0, 0x7a, 0, vkil_get_time_us() + 1000,
+			    &rsp);
+	assert(ret == -ETIMEDOUT);
+	devctx->msgid_ctx.msg_list[msg_id].deadline_us = 1;
+	devctx->reap_us = 0;
+	while (!vkil_reap_stale(devctx) &&
+	       (atomic_load(&devctx->reaped) == reaped))
+		nanosleep(&ts, NULL);
+	assert(atomic_load(&devctx->reaped) == reaped + 1);
+}
+
+void test_tickets(void)
+{
+	static int32_t held[VKIL_MSG_ID_MAX];
+	vkil_devctx *closed = NULL;
+	vkil_ticket t[3];
+	int32_t i, n, ret, id[3];
+	vk2host_msg rsp;
+	host2vk_msg msg;
+
+	/* a command given up on, whose response never comes, is lost */
+	id[0] = test_submit(VK_FID_SHUTDOWN, 0x7a, 0);
+	t[0] = test_ticket(id[0]);
+	ret = vkil_ticket_status(&t[0]);
+	assert(ret == -EINPROGRESS);
+	test_lose(id[0]);
+	ret = vkil_ticket_status(&t[0]);
+	assert(ret == -ECANCELED);
+
+	/* a deposited response completes its ticket, the waiter woken up */
+	id[1] = test_submit(VK_FID_PRIVATE, 0x7a, 0);
+	t[1] = test_ticket(id[1]);
+	id[2] = test_submit(VK_FID_SHUTDOWN, 0x7a, 0);
+	t[2] = test_ticket(id[2]);
+	ret = vkil_wait_tickets(&t[1], 1, 0, INT64_MAX);
+	assert(!ret);
+	ret = vkil_wait_tickets(&t[1], 2, 0, vkil_get_time_us() + 1000);
+	assert(!ret);
+	ret = vkil_wait_tickets(&t[1], 2, 1, vkil_get_time_us() + 1000);
+	assert(ret == -ETIMEDOUT);
+	/* and stays so once retrieved */
+	ret = test_retrieve(id[1], 0, 0x7a, 0, 0, &rsp);
+	assert(!ret);
+	vkil_return_msg_id(devctx, id[1]);
+	ret = vkil_ticket_status(&t[1]);
+	assert(!ret);
+
+	/* a lost ticket completes, its status telling it is in error */
+	ret = vkil_wait_tickets(t, 2, 0, INT64_MAX);
+	assert(ret == 0);
+	ret = vkil_wait_tickets(t, 2, 1, INT64_MAX);
+	assert(ret == -ECANCELED);
+	ret = vkil_wait_tickets(&t[1], 1, 1, INT64_MAX);
+	assert(!ret);
+
+	/* and stays lost once its msg_id is reused, and lost again */
+	for (n = 0; (held[n] = vkil_get_msg_id(devctx, acct)) > 0; n++)
+		;
+	for (i = 0; held[i] != id[0]; i++)
+		assert(i < n);
+	held[i] = held[--n];
+	vkil_return_msg_id(devctx, id[0]);
+	ret = test_submit(VK_FID_SHUTDOWN, 0x7a, 0);
+	assert(ret == id[0]);
+	t[1] = test_ticket(id[0]);
+	test_lose(id[0]);
+	ret = vkil_ticket_status(&t[0]);
+	assert(ret == -ECANCELED);
+	ret = vkil_ticket_status(&t[1]);
+	assert(ret == -ECANCELED);
+	for (i = 0; i < n; i++)
+		vkil_return_msg_id(devctx, held[i]);
+
+	/* a ticket can't be waited for once its device is closed */
+	ret = vkil_init_dev((void **)&closed, 5);
+	assert(ret == 5);
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_id = 1;
+	vkil_set_ticket(closed, &msg, &t[0]);
+	vkil_deinit_dev((void **)&closed);
+	ret = vkil_ticket_status(&t[0]);
+	assert(ret == -ENODEV);
+	ret = vkil_wait_tickets(t, 1, 0, INT64_MAX);
+	assert(ret == -ENODEV);
+
+	vkil_return_msg_id(devctx, id[2]);
+	assert(!acct->inflight);
+}
+
+void test_deinit_dev(void)
+{
+	vkil_detach_msg_account(devctx, acct);
+	vkil_deinit_dev((void **)&devctx);
+	assert(!devctx);
+}
+
+int main(void)
+{
+	test_init_dev();
+	test_msg_id_exhaust();
+	test_msg_id_concurrent();
+	test_cmpl_table();
+	test_rx_batch();
+	test_msg_quota();
+	test_msg_quota_concurrent();
+	test_resp_size();
+	test_credit_wait();
+	test_reaper();
+	test_async_abandon();
+	test_place();
+	/* last, the device getting a completion dispatcher */
+	test_tickets();
+	test_deinit_dev();
+	printf("Passed!\n");
+	return 0;
+}
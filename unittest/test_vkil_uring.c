@@ -0,0 +1,165 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+ * Copyright 2018-2020 Broadcom.
+ */
+
+/*
+ * io_uring transport exercised on a fifo standing for the driver: the
+ * messages written through the tx ring are read back through the rx ring
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "vkil_internal.h"
+
+#define TEST_ROUNDS 1000
+#define TEST_BATCH  5
+
+static char dir[] = "/tmp/test_vkil_uring.XXXXXX";
+static char fifo[sizeof(dir) + 8];
+static vkil_devctx *devctx;
+
+static int32_t test_open(const vkil_transport_ops *tp)
+{
+	int32_t ret;
+
+	ret = vkil_mallocz((void **)&devctx, sizeof(*devctx));
+	assert(!ret);
+	ret = vkil_mallocz((void **)&devctx->rx.blk,
+			   sizeof(vk2host_msg) * VKIL_RX_BUF_BLKS);
+	assert(!ret);
+	ret = tp->open(devctx, fifo);
+	if (ret) {
+		vkil_free((void **)&devctx->rx.blk);
+		vkil_free((void **)&devctx);
+	}
+	return ret;
+}
+
+static void test_close(const vkil_transport_ops *tp)
+{
+	tp->close(devctx);
+	vkil_free((void **)&devctx->rx.blk);
+	vkil_free((void **)&devctx);
+}
+
+static void test_submit(const int32_t first, const int32_t n)
+{
+	host2vk_msg msg[TEST_BATCH];
+	struct iovec iov[TEST_BATCH];
+	ssize_t ret;
+	int32_t i;
+
+	memset(msg, 0, sizeof(msg));
+	for (i = 0; i < n; i++) {
+		msg[i].function_id = VK_FID_PRIVATE;
+		msg[i].args[0] = first + i;
+		iov[i].iov_base = &msg[i];
+		iov[i].iov_len = sizeof(msg[i]);
+	}
+	ret = devctx->tp->submit(devctx, iov, n);
+	assert(ret == (ssize_t)(sizeof(msg[0]) * n));
+}
+
+/* reap n messages at once, waiting for them if not there yet */
+static void test_reap(const int32_t first, const int32_t n)
+{
+	const size_t nbytes = sizeof(vk2host_msg) * VKIL_RX_BUF_BLKS;
+	host2vk_msg *msg = (host2vk_msg *)devctx->rx.blk;
+	ssize_t ret;
+	int32_t i;
+
+	while ((ret = devctx->tp->reap(devctx, 0, devctx->rx.blk,
+				       nbytes)) == -ENOMSG)
+		devctx->tp->poll(devctx, 1000);
+	assert(ret == (ssize_t)(sizeof(*msg) * n));
+	for (i = 0; i < n; i++)
+		assert(msg[i].args[0] == (uint32_t)(first + i));
+}
+
+void test_round_trip(const vkil_transport_ops *tp)
+{
+	const size_t nbytes = sizeof(vk2host_msg) * VKIL_RX_BUF_BLKS;
+	int32_t i, n, first = 0;
+	ssize_t ret;
+
+	if (test_open(tp)) {
+		printf("%s not available, skipped\n", tp->name);
+		return;
+	}
+	devctx->tp = tp;
+	for (i = 0; i < TEST_ROUNDS; i++) {
+		n = i % TEST_BATCH + 1;
+		/* the read is armed before or after the messages are there */
+		if (!(i & 1)) {
+			ret = tp->reap(devctx, 0, devctx->rx.blk, nbytes);
+			assert(ret == -ENOMSG);
+		}
+		test_submit(first, n);
+		test_reap(first, n);
+		first += n;
+	}
+	test_close(tp);
+}
+
+void test_rx_stop(const vkil_transport_ops *tp)
+{
+	const size_t nbytes = sizeof(vk2host_msg) * VKIL_RX_BUF_BLKS;
+	ssize_t ret;
+
+	/* the queued pair is cancelled, the driver is then read directly */
+	ret = test_open(tp);
+	assert(!ret);
+	devctx->tp = tp;
+	ret = tp->reap(devctx, 0, devctx->rx.blk, nbytes);
+	assert(ret == -ENOMSG);
+	tp->rx_stop(devctx);
+	assert(!devctx->rx.len);
+	test_submit(0, 2);
+	test_reap(0, 2);
+	test_close(tp);
+
+	/*
+	 * the messages are either read by the queued pair, and kept, or left
+	 * to the driver if the pair is cancelled first
+	 */
+	ret = test_open(tp);
+	assert(!ret);
+	devctx->tp = tp;
+	ret = tp->reap(devctx, 0, devctx->rx.blk, nbytes);
+	assert(ret == -ENOMSG);
+	test_submit(0, 3);
+	tp->rx_stop(devctx);
+	if (devctx->rx.len)
+		assert((devctx->rx.pos == 0) && (devctx->rx.len == 3));
+	else
+		test_reap(0, 3);
+	test_close(tp);
+}
+
+int main(void)
+{
+	char *tmp;
+	int ret;
+
+	/* a lost completion would hang the test, rather fail it */
+	alarm(60);
+	tmp = mkdtemp(dir);
+	assert(tmp);
+	snprintf(fifo, sizeof(fifo), "%s/fifo", dir);
+	ret = mkfifo(fifo, 0600);
+	assert(!ret);
+
+	test_round_trip(&vkil_uring_ops);
+	test_round_trip(&vkil_sqpoll_ops);
+	test_rx_stop(&vkil_uring_ops);
+
+	unlink(fifo);
+	rmdir(dir);
+	printf("Passed!\n");
+	return 0;
+}